@@ -0,0 +1,104 @@
+// the bulk array natives over a million element packed array,
+// called through scripts the way scoring code does. build with
+// -DCLOX_SCALAR_NATIVES to compare against the plain loops, sort
+// is also timed against qsort on the same data
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "array.h"
+#include "clox.h"
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int compare_numbers(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static ObjArray* random_array(VM* vm, int count, unsigned seed) {
+    ObjArray* array = new_array(vm);
+    array_reserve(vm, array, count);
+    for (int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        array_push(vm, array, NUMBER_VAL((double)(seed >> 8) / (1 << 24) * 200 - 100));
+    }
+    return array;
+}
+
+// best time of runs runs of source, in milliseconds
+static double time_script(VM* vm, const char* source, int runs) {
+    CloxScript* script = clox_compile(vm, source);
+    if (script == NULL) exit(65);
+
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        double start = now();
+        if (clox_run(vm, script) != INTERPRET_OK) exit(70);
+        double elapsed = now() - start;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    clox_free_script(script);
+    return best * 1e3;
+}
+
+int main(int argc, const char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int runs = 10;
+
+    VM* vm = clox_new_vm();
+    ObjArray* a = random_array(vm, count, 1);
+    ObjArray* b = random_array(vm, count, 2);
+    clox_set_global(vm, "a", OBJ_VAL(a));
+    clox_set_global(vm, "b", OBJ_VAL(b));
+
+    double sum = time_script(vm, "var result = sum(a);", runs);
+    double dot = time_script(vm, "var result = dot(a, b);", runs);
+    double scale = time_script(vm, "var result = scale(a, 1.5);", runs);
+
+    Value result;
+    clox_get_global(vm, "result", &result);
+
+    // sort works in place, so each run sorts a fresh copy
+    double* copy = malloc(sizeof(double) * count);
+    double sort = 0;
+    double qsorted = 0;
+    for (int run = 0; run < runs; run++) {
+        ObjArray* unsorted = random_array(vm, count, 3 + run);
+        memcpy(copy, unsorted->as.numbers, sizeof(double) * count);
+        clox_set_global(vm, "c", OBJ_VAL(unsorted));
+
+        double elapsed = time_script(vm, "sort(c);", 1);
+        if (run == 0 || elapsed < sort) sort = elapsed;
+
+        double start = now();
+        qsort(copy, count, sizeof(double), compare_numbers);
+        elapsed = (now() - start) * 1e3;
+        if (run == 0 || elapsed < qsorted) qsorted = elapsed;
+
+        if (memcmp(copy, unsorted->as.numbers, sizeof(double) * count) != 0) {
+            fprintf(stderr, "sort() disagrees with qsort\n");
+            return 1;
+        }
+    }
+
+    printf("%d elements, best of %d:\n", count, runs);
+    printf("  sum   %7.3f ms  %6.0f M elements/sec\n", sum, count / sum / 1e3);
+    printf("  dot   %7.3f ms  %6.0f M elements/sec\n", dot, count / dot / 1e3);
+    printf("  scale %7.3f ms  %6.0f M elements/sec\n", scale, count / scale / 1e3);
+    printf("  sort  %7.3f ms  (qsort %.3f ms)\n", sort, qsorted);
+
+    free(copy);
+    clox_free_vm(vm);
+    return 0;
+}
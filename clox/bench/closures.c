@@ -0,0 +1,78 @@
+// making and calling closures over two locals that are copied into
+// the closure, against the same two locals reassigned after they're
+// captured so the closure has to share them, and a function that
+// captures nothing. both makers run the same instructions apart from
+// which local the reassignment lands on
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+#include "vm.h"
+
+#define STATEMENTS 500
+
+static const char* setup =
+    "fun make_none(a, b) { var t; fun f() { return 1 + 2; } t = a; t = b; return f; }\n"
+    "fun make_copied(a, b) { var t; fun f() { return a + b; } t = a; t = b; return f; }\n"
+    "fun make_shared(a, b) { var t; fun f() { return a + b; } a = a; b = b; return f; }\n"
+    "var none = make_none(1, 2);\n"
+    "var copied = make_copied(1, 2);\n"
+    "var shared = make_shared(1, 2);\n"
+    "var total;\n";
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// ns per statement, best of rounds runs of it repeated
+static double time_statement(VM* vm, const char* statement, int rounds) {
+    size_t length = strlen(statement);
+    char* source = malloc(length * STATEMENTS + 1);
+    for (int i = 0; i < STATEMENTS; i++) memcpy(source + length * i, statement, length);
+    source[length * STATEMENTS] = '\0';
+
+    CloxScript* script = clox_compile(vm, source);
+    free(source);
+    if (script == NULL) exit(65);
+
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        double start = now();
+        if (clox_run(vm, script) != INTERPRET_OK) exit(70);
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best) best = elapsed;
+    }
+
+    clox_free_script(script);
+    return best * 1e9 / STATEMENTS;
+}
+
+int main(int argc, const char* argv[]) {
+    // nothing is collected, so every closure made stays allocated
+    int rounds = argc > 1 ? atoi(argv[1]) : 1000;
+
+    VM* vm = clox_new_vm();
+    if (interpret(vm, setup, strlen(setup)) != INTERPRET_OK) return 70;
+
+    const char* kinds[] = { "none", "copied", "shared" };
+    printf("ns per statement, best of %d rounds of %d statements:\n", rounds, STATEMENTS);
+    printf("  captures     make    call\n");
+    for (int i = 0; i < 3; i++) {
+        char make[64];
+        char call[64];
+        snprintf(make, sizeof(make), "total = make_%s(1, 2);\n", kinds[i]);
+        snprintf(call, sizeof(call), "total = %s();\n", kinds[i]);
+        printf("  %-8s   %6.1f  %6.1f\n", kinds[i],
+            time_statement(vm, make, rounds), time_statement(vm, call, rounds));
+    }
+
+    clox_free_vm(vm);
+    return 0;
+}
@@ -0,0 +1,68 @@
+// evaluations per second of a small rule, compiled once through
+// libclox versus compiled on every evaluation with interpret()
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+#include "vm.h"
+
+static const char* rule =
+    "var total = price * quantity * (1 - discount);\n"
+    "var approved = total < limit;\n";
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void set_inputs(VM* vm, int i) {
+    clox_set_global(vm, "price", NUMBER_VAL(10 + i % 90));
+    clox_set_global(vm, "quantity", NUMBER_VAL(1 + i % 7));
+    clox_set_global(vm, "discount", NUMBER_VAL((i % 4) * 0.05));
+    clox_set_global(vm, "limit", NUMBER_VAL(400));
+}
+
+int main(int argc, const char* argv[]) {
+    int evaluations = argc > 1 ? atoi(argv[1]) : 1000000;
+    VM* vm = clox_new_vm();
+    if (argc > 2) vm->backend = BACKEND_REGISTER;
+
+    CloxScript* script = clox_compile(vm, rule);
+    if (script == NULL) return 65;
+
+    int approved = 0;
+    double start = now();
+    for (int i = 0; i < evaluations; i++) {
+        set_inputs(vm, i);
+        if (clox_run(vm, script) != INTERPRET_OK) return 70;
+
+        Value value;
+        if (clox_get_global(vm, "approved", &value) && AS_BOOL(value)) approved++;
+    }
+    double compiled_once = now() - start;
+
+    // the same work paying compile cost every time, on a tenth
+    // as many evaluations since it's much slower
+    int recompiled = evaluations / 10;
+    start = now();
+    for (int i = 0; i < recompiled; i++) {
+        set_inputs(vm, i);
+        if (interpret(vm, rule, strlen(rule)) != INTERPRET_OK) return 70;
+    }
+    double compiled_each_time = now() - start;
+
+    printf("compiled once:       %10.0f evaluations/sec (%d approved)\n",
+        evaluations / compiled_once, approved);
+    printf("compiled every time: %10.0f evaluations/sec\n",
+        recompiled / compiled_each_time);
+
+    clox_free_script(script);
+    clox_free_vm(vm);
+    return 0;
+}
@@ -0,0 +1,189 @@
+// a resume and yield round trip against a plain call, then many
+// fibers each parked reading its own fifo while a writer thread
+// wakes them one by one. there are no loops, so scripts are
+// statements repeated
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clox.h"
+#include "vm.h"
+
+#define STATEMENTS 500
+// spawns per function, a chunk holds at most 256 constants
+#define BATCH 100
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// prefix, then statement count times, then suffix
+static char* repeat(const char* prefix, const char* statement, int count, const char* suffix) {
+    size_t prefix_length = strlen(prefix);
+    size_t length = strlen(statement);
+    size_t suffix_length = strlen(suffix);
+    char* source = malloc(prefix_length + length * count + suffix_length + 1);
+    memcpy(source, prefix, prefix_length);
+    for (int i = 0; i < count; i++) memcpy(source + prefix_length + length * i, statement, length);
+    memcpy(source + prefix_length + length * count, suffix, suffix_length + 1);
+    return source;
+}
+
+// ns per statement, best of rounds runs
+static double time_script(VM* vm, const char* source, int rounds) {
+    CloxScript* script = clox_compile(vm, source);
+    if (script == NULL) exit(65);
+
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        double start = now();
+        if (clox_run(vm, script) != INTERPRET_OK) exit(70);
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best) best = elapsed;
+    }
+
+    clox_free_script(script);
+    return best * 1e9 / STATEMENTS;
+}
+
+typedef struct {
+    char directory[64];
+    int count;
+    int* fds;
+    bool parked;
+    double parked_at;
+    double writing;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} FifoWriter;
+
+static FifoWriter writer;
+
+// spawned after every reader, so it runs once they have all parked
+static bool parked_native(VM* vm, int arg_count, Value* args, Value* result) {
+    pthread_mutex_lock(&writer.lock);
+    writer.parked = true;
+    writer.parked_at = now();
+    pthread_cond_signal(&writer.ready);
+    pthread_mutex_unlock(&writer.lock);
+    *result = NIL_VAL;
+    return true;
+}
+
+// waits for every reader to park, then writes to each in turn
+static void* write_fifos(void* argument) {
+    pthread_mutex_lock(&writer.lock);
+    while (!writer.parked) pthread_cond_wait(&writer.ready, &writer.lock);
+    pthread_mutex_unlock(&writer.lock);
+
+    writer.writing = now();
+    for (int i = 0; i < writer.count; i++) {
+        if (write(writer.fds[i], "x", 1) != 1) exit(1);
+    }
+    return NULL;
+}
+
+static const char* reader_setup =
+    "var finished = 0;\n"
+    "fun reader(path) {\n"
+    "    fun run() {\n"
+    "        var file = open(path);\n"
+    "        var data = read(file);\n"
+    "        close(file);\n"
+    "        finished = finished + len(data);\n"
+    "    }\n"
+    "    return run;\n"
+    "}\n";
+
+int main(int argc, const char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    int readers = argc > 2 ? atoi(argv[2]) : 5000;
+
+    VM* vm = clox_new_vm();
+    char* generator = repeat("fun generator() {\n", "    yield();\n", STATEMENTS, "}\n");
+    char* callee = "fun callee() {}\n";
+    if (interpret(vm, generator, strlen(generator)) != INTERPRET_OK
+            || interpret(vm, callee, strlen(callee)) != INTERPRET_OK) {
+        return 70;
+    }
+    free(generator);
+
+    // the fiber runs out of yields after one round, so each round
+    // makes a new one
+    char* resumes = repeat("var f = fiber(generator);\n", "resume(f);\n", STATEMENTS, "");
+    char* calls = repeat("", "callee();\n", STATEMENTS, "");
+    double switched = time_script(vm, resumes, rounds);
+    double called = time_script(vm, calls, rounds);
+    free(resumes);
+    free(calls);
+
+    printf("ns per statement, best of %d rounds of %d:\n", rounds, STATEMENTS);
+    printf("  resume and yield back   %6.1f\n", switched);
+    printf("  call and return         %6.1f\n", called);
+
+    strcpy(writer.directory, "/tmp/clox-fibers-XXXXXX");
+    if (mkdtemp(writer.directory) == NULL) return 1;
+    writer.count = readers;
+    writer.fds = malloc(sizeof(int) * readers);
+    pthread_mutex_init(&writer.lock, NULL);
+    pthread_cond_init(&writer.ready, NULL);
+
+    int batches = (readers + BATCH - 1) / BATCH;
+    char* spawns = malloc(readers * 128 + batches * 64 + strlen(reader_setup) + 1);
+    strcpy(spawns, reader_setup);
+    for (int i = 0; i < readers; i++) {
+        char path[96];
+        snprintf(path, sizeof(path), "%s/%d", writer.directory, i);
+        if (mkfifo(path, 0600) != 0) return 1;
+        // a fifo with no writer reads as finished, so hold one open
+        writer.fds[i] = open(path, O_RDWR | O_NONBLOCK);
+        if (writer.fds[i] < 0) return 1;
+        if (i % BATCH == 0) sprintf(spawns + strlen(spawns), "fun batch%d() {\n", i / BATCH);
+        sprintf(spawns + strlen(spawns), "    spawn(reader(\"%s\"));\n", path);
+        if (i % BATCH == BATCH - 1 || i == readers - 1) strcat(spawns, "}\n");
+    }
+    for (int i = 0; i < batches; i++) sprintf(spawns + strlen(spawns), "batch%d();\n", i);
+    strcat(spawns, "fun mark() { parked(); }\nspawn(mark);\n");
+    clox_define_file_natives(vm);
+    if (!clox_define_native(vm, "parked", 0, parked_native)) return 70;
+
+    CloxScript* script = clox_compile(vm, spawns);
+    if (script == NULL) return 65;
+    pthread_t thread;
+    pthread_create(&thread, NULL, write_fifos, &writer);
+    double start = now();
+    if (clox_run(vm, script) != INTERPRET_OK) return 70;
+    double end = now();
+    pthread_join(thread, NULL);
+
+    Value finished;
+    clox_get_global(vm, "finished", &finished);
+    printf("%d fibers each parked on a fifo, %g woken:\n", readers, AS_NUMBER(finished));
+    printf("  start, open and park    %6.1f us per fiber\n", (writer.parked_at - start) * 1e6 / readers);
+    printf("  wake, read and finish   %6.1f us per fiber\n", (end - writer.writing) * 1e6 / readers);
+    printf("  parked fiber            %6zu bytes of stack and frames\n",
+        sizeof(ObjFiber) + sizeof(Value) * FIBER_STACK_MIN + sizeof(CallFrame) * FIBER_FRAMES_MIN);
+
+    clox_free_script(script);
+    free(spawns);
+    for (int i = 0; i < readers; i++) {
+        char path[96];
+        snprintf(path, sizeof(path), "%s/%d", writer.directory, i);
+        close(writer.fds[i]);
+        unlink(path);
+    }
+    rmdir(writer.directory);
+    free(writer.fds);
+    clox_free_vm(vm);
+    return 0;
+}
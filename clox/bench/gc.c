@@ -0,0 +1,135 @@
+// collections a script allocating in a loop of calls sets off,
+// when almost everything it makes is garbage, when it keeps what
+// it makes, and when it makes garbage beside a big live heap,
+// with and without a heap limit and with one gc thread or more.
+// then the same for strings concatenated on the way down, which
+// start out in the nursery. there are no loops, so scripts call
+// through a tree of functions
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+#include "vm.h"
+
+// every leaf is one of 2^DEPTH calls
+#define DEPTH 16
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// leaf, then f0 calling it and each f calling the one before
+// twice. with strings, each passes on what it was given with a
+// letter added, so every leaf gets its own string
+static char* call_tree(const char* leaf, bool strings) {
+    size_t capacity = strlen(leaf) + 64 * (DEPTH + 2);
+    char* source = malloc(capacity);
+    strcpy(source, leaf);
+    if (strings) {
+        strcat(source, "fun f0(p) { leaf(p); }\n");
+        for (int i = 1; i <= DEPTH; i++) {
+            sprintf(source + strlen(source), "fun f%d(p) { f%d(p + \"a\"); f%d(p + \"b\"); }\n", i, i - 1, i - 1);
+        }
+        sprintf(source + strlen(source), "f%d(\"\");\n", DEPTH);
+    } else {
+        strcat(source, "fun f0() { leaf(); }\n");
+        for (int i = 1; i <= DEPTH; i++) {
+            sprintf(source + strlen(source), "fun f%d() { f%d(); f%d(); }\n", i, i - 1, i - 1);
+        }
+        sprintf(source + strlen(source), "f%d();\n", DEPTH);
+    }
+    return source;
+}
+
+// setup runs first, untimed, to build whatever stays live, then
+// the leaf's tree is timed over runs runs
+static void run(const char* name, const char* setup, const char* leaf, bool strings, int runs, size_t limit,
+        int threads) {
+    VM* vm = clox_new_vm();
+    clox_set_heap_limit(vm, limit);
+    clox_set_gc_threads(vm, threads);
+    if (setup != NULL) {
+        char* prepare = call_tree(setup, false);
+        CloxScript* script = clox_compile(vm, prepare);
+        if (script == NULL) exit(65);
+        if (clox_run(vm, script) != INTERPRET_OK) exit(70);
+        clox_free_script(script);
+        free(prepare);
+    }
+    GcStats before;
+    clox_gc_stats(vm, &before);
+
+    char* source = call_tree(leaf, strings);
+    CloxScript* script = clox_compile(vm, source);
+    if (script == NULL) exit(65);
+
+    double start = now();
+    InterpretResult result = INTERPRET_OK;
+    for (int i = 0; i < runs && result == INTERPRET_OK; i++) result = clox_run(vm, script);
+    double elapsed = now() - start;
+
+    GcStats stats;
+    clox_gc_stats(vm, &stats);
+    char limited[32] = "none";
+    if (limit != 0) snprintf(limited, sizeof(limited), "%zu MB", limit >> 20);
+    int full = stats.full.count - before.full.count;
+    double full_paused = stats.full.seconds - before.full.seconds;
+    int young = stats.young.count - before.young.count;
+    double young_paused = stats.young.seconds - before.young.seconds;
+    printf("  %-9s %-7s %2d %7.1f ms %6.1f%% %5d %8.2f ms %6d %7.1f us %8.1f MB%s\n", name, limited, threads,
+        elapsed * 1e3, (full_paused + young_paused) / elapsed * 100, full,
+        full == 0 ? 0 : full_paused / full * 1e3, young, young == 0 ? 0 : young_paused / young * 1e6,
+        vm->bytes_allocated / 1048576.0, result == INTERPRET_OK ? "" : "  out of memory");
+
+    clox_free_script(script);
+    free(source);
+    clox_free_vm(vm);
+}
+
+static const char* garbage =
+    "fun leaf() { var a = array(64, \"x\" + \"y\"); var m = map(8); m[1] = a; }\n";
+
+// keeps every array, about 80 MB by the end
+static const char* retained =
+    "var kept = array(0, 0);\n"
+    "fun leaf() { var s = \"x\" + \"y\"; push(kept, array(64, s)); }\n";
+
+// 2^(DEPTH + 1) strings up to DEPTH long, all garbage by the end
+// of the call they're made for or all kept
+static const char* dropped = "fun leaf(p) {}\n";
+static const char* pushed =
+    "var kept = array(0, 0);\n"
+    "fun leaf(p) { push(kept, p); }\n";
+
+// the big heap is 2^DEPTH arrays of 16 strings, about 35 MB
+static const char* big_heap =
+    "var kept = array(0, 0);\n"
+    "fun leaf() { push(kept, array(16, \"x\" + \"y\")); }\n";
+
+int main(int argc, const char* argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+
+    printf("2^%d calls each allocating ~1.2 KB, 8 times over beside the big heap:\n", DEPTH);
+    printf("  %-9s %-7s %2s %10s %7s %5s %11s %6s %10s %11s\n", "kept", "limit", "gc", "time", "paused",
+        "full", "per full", "young", "per young", "heap after");
+    run("none", NULL, garbage, false, 1, 0, 1);
+    run("none", NULL, garbage, false, 1, (size_t)16 << 20, 1);
+    run("all", NULL, retained, false, 1, 0, 1);
+    run("all", NULL, retained, false, 1, (size_t)128 << 20, 1);
+    run("all", NULL, retained, false, 1, (size_t)16 << 20, 1);
+    run("all", NULL, retained, false, 1, 0, threads);
+    run("big heap", big_heap, garbage, false, 8, 0, 1);
+    run("big heap", big_heap, garbage, false, 8, 0, threads);
+
+    printf("2^%d calls each concatenating two strings, 8 times over:\n", DEPTH);
+    run("none", NULL, dropped, true, 8, 0, 1);
+    run("all", NULL, pushed, true, 1, 0, 1);
+    return 0;
+}
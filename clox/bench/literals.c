@@ -0,0 +1,59 @@
+// compile throughput on a generated script made almost
+// entirely of integer and decimal literals
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+    int lines = argc > 1 ? atoi(argv[1]) : 200000;
+    int runs = 5;
+
+    // few enough distinct values to stay inside one constant pool
+    const char* literals[] = {
+        "0", "1", "2", "10", "42", "255", "1024", "65535", "100000", "1234567",
+        "0.5", "0.25", "1.5", "3.14159", "2.71828", "0.001", "99.99", "12345.678",
+        "0.1", "7.25", "1000000", "31415926", "86400", "3600", "0.75"
+    };
+    int literal_count = sizeof(literals) / sizeof(literals[0]);
+
+    size_t capacity = (size_t)lines * 64 + 1;
+    char* source = malloc(capacity);
+    char* end = source;
+    for (int i = 0; i < lines; i++) {
+        end += sprintf(end, "print %s + %s * %s - %s;\n",
+            literals[i % literal_count], literals[(i * 7 + 3) % literal_count],
+            literals[(i * 11 + 5) % literal_count], literals[(i * 13 + 1) % literal_count]);
+    }
+    size_t bytes = end - source;
+
+    VM* vm = clox_new_vm();
+    double best = 0;
+    for (int run = 0; run < runs; run++) {
+        double start = now();
+        CloxScript* script = clox_compile(vm, source);
+        double elapsed = now() - start;
+        if (script == NULL) return 65;
+        clox_free_script(script);
+
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    printf("%d lines, %.1f MB: best of %d compiles %.3f s, %.1f MB/s, %.0f literals/sec\n",
+        lines, bytes / 1e6, runs, best, bytes / 1e6 / best, lines * 4 / best);
+
+    clox_free_vm(vm);
+    free(source);
+    return 0;
+}
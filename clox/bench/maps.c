@@ -0,0 +1,98 @@
+// map inserts and lookups through the map api, number keys and
+// interned string keys, into a map that grows as it fills and one
+// sized up front the way map(capacity) and literals do. keys() is
+// timed through a script since that's how maps get iterated
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "clox.h"
+#include "map.h"
+#include "table.h"
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+typedef struct {
+    double insert;
+    double lookup;
+} MapTimes;
+
+// best of runs runs, in nanoseconds per key
+static MapTimes time_map(VM* vm, Value* keys, int count, bool reserve, int runs) {
+    MapTimes best = { 0, 0 };
+    for (int run = 0; run < runs; run++) {
+        double start = now();
+        ObjMap* map = new_map(vm);
+        if (reserve) map_reserve(vm, map, count);
+        for (int i = 0; i < count; i++) map_set(vm, map, keys[i], NUMBER_VAL(i));
+        double inserted = now();
+
+        double total = 0;
+        for (int i = 0; i < count; i++) {
+            Value value;
+            if (!map_get(map, keys[i], &value)) exit(1);
+            total += AS_NUMBER(value);
+        }
+        double looked_up = now();
+        if (total != (double)count * (count - 1) / 2) exit(1);
+
+        double insert = (inserted - start) * 1e9 / count;
+        double lookup = (looked_up - inserted) * 1e9 / count;
+        if (run == 0 || insert < best.insert) best.insert = insert;
+        if (run == 0 || lookup < best.lookup) best.lookup = lookup;
+    }
+    return best;
+}
+
+int main(int argc, const char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    int runs = 5;
+
+    VM* vm = clox_new_vm();
+    Value* numbers = malloc(sizeof(Value) * count);
+    Value* strings = malloc(sizeof(Value) * count);
+    for (int i = 0; i < count; i++) {
+        char name[32];
+        int length = snprintf(name, sizeof(name), "key%d", i);
+        numbers[i] = NUMBER_VAL(i * 7.5);
+        strings[i] = OBJ_VAL(copy_string(vm, name, length));
+    }
+
+    MapTimes number_grown = time_map(vm, numbers, count, false, runs);
+    MapTimes number_sized = time_map(vm, numbers, count, true, runs);
+    MapTimes string_grown = time_map(vm, strings, count, false, runs);
+    MapTimes string_sized = time_map(vm, strings, count, true, runs);
+
+    ObjMap* map = new_map(vm);
+    for (int i = 0; i < count; i++) map_set(vm, map, strings[i], numbers[i]);
+    clox_set_global(vm, "m", OBJ_VAL(map));
+    CloxScript* script = clox_compile(vm, "var k = keys(m);");
+    if (script == NULL) return 65;
+    double keys = 0;
+    for (int run = 0; run < runs; run++) {
+        double start = now();
+        if (clox_run(vm, script) != INTERPRET_OK) return 70;
+        double elapsed = (now() - start) * 1e9 / count;
+        if (run == 0 || elapsed < keys) keys = elapsed;
+    }
+    clox_free_script(script);
+
+    printf("%d keys, best of %d, ns per key:\n", count, runs);
+    printf("  number keys, grown   insert %6.1f  lookup %6.1f\n", number_grown.insert, number_grown.lookup);
+    printf("  number keys, sized   insert %6.1f  lookup %6.1f\n", number_sized.insert, number_sized.lookup);
+    printf("  string keys, grown   insert %6.1f  lookup %6.1f\n", string_grown.insert, string_grown.lookup);
+    printf("  string keys, sized   insert %6.1f  lookup %6.1f\n", string_sized.insert, string_sized.lookup);
+    printf("  keys()               %6.1f\n", keys);
+
+    free(numbers);
+    free(strings);
+    clox_free_vm(vm);
+    return 0;
+}
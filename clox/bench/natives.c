@@ -0,0 +1,89 @@
+// a hot helper written in lox, against the same helper moved into
+// c through the embedding api as a general native that checks and
+// unboxes its own arguments and as a number native the vm does
+// that for. the script is the same statement repeated
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+#include "vm.h"
+
+#define STATEMENTS 500
+
+static const char* setup =
+    "fun lox_hypot(a, b) { return sqrt(a * a + b * b); }\n"
+    "var total;\n";
+
+static bool general_hypot(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
+        *result = clox_string(vm, "hypot() takes two numbers.");
+        return false;
+    }
+
+    double a = AS_NUMBER(args[0]);
+    double b = AS_NUMBER(args[1]);
+    *result = NUMBER_VAL(sqrt(a * a + b * b));
+    return true;
+}
+
+static double number_hypot(const double* args) {
+    return sqrt(args[0] * args[0] + args[1] * args[1]);
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// ns per statement, best of rounds runs of it repeated
+static double time_statement(VM* vm, const char* statement, int rounds) {
+    size_t length = strlen(statement);
+    char* source = malloc(length * STATEMENTS + 1);
+    for (int i = 0; i < STATEMENTS; i++) memcpy(source + length * i, statement, length);
+    source[length * STATEMENTS] = '\0';
+
+    CloxScript* script = clox_compile(vm, source);
+    free(source);
+    if (script == NULL) exit(65);
+
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        double start = now();
+        if (clox_run(vm, script) != INTERPRET_OK) exit(70);
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best) best = elapsed;
+    }
+
+    clox_free_script(script);
+    return best * 1e9 / STATEMENTS;
+}
+
+int main(int argc, const char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 5000;
+
+    VM* vm = clox_new_vm();
+    if (!clox_define_native(vm, "general_hypot", 2, general_hypot)
+            || !clox_define_number_native(vm, "number_hypot", 2, number_hypot)
+            || interpret(vm, setup, strlen(setup)) != INTERPRET_OK) {
+        return 70;
+    }
+
+    double lox = time_statement(vm, "total = lox_hypot(3, 4);\n", rounds);
+    double general = time_statement(vm, "total = general_hypot(3, 4);\n", rounds);
+    double number = time_statement(vm, "total = number_hypot(3, 4);\n", rounds);
+
+    printf("ns per call of hypot(3, 4), best of %d rounds of %d statements:\n", rounds, STATEMENTS);
+    printf("  lox function       %6.1f\n", lox);
+    printf("  general native     %6.1f\n", general);
+    printf("  number native      %6.1f\n", number);
+
+    clox_free_vm(vm);
+    return 0;
+}
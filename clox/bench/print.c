@@ -0,0 +1,51 @@
+// time spent printing a million numbers, half whole and half
+// fractional, from a generated script with output to /dev/null
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+#include "vm.h"
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, const char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    const char* header = "var i = 0;\nvar x = 0;\n";
+    const char* lines[] = { "print i = i + 1;\n", "print x = x + 0.37;\n" };
+    size_t capacity = strlen(header) + (size_t)count * strlen(lines[1]) + 1;
+    char* source = malloc(capacity);
+    char* end = source + sprintf(source, "%s", header);
+    for (int i = 0; i < count; i++) {
+        end += sprintf(end, "%s", lines[i % 2]);
+    }
+
+    VM* vm = clox_new_vm();
+    FILE* null = fopen("/dev/null", "w");
+    set_output(vm, null);
+
+    double start = now();
+    CloxScript* script = clox_compile(vm, source);
+    if (script == NULL) return 65;
+    double compiled = now();
+    if (clox_run(vm, script) != INTERPRET_OK) return 70;
+    double ran = now();
+
+    printf("compile %.3f s, run %.3f s, %.0f numbers/sec\n",
+        compiled - start, ran - compiled, count / (ran - compiled));
+
+    clox_free_script(script);
+    clox_free_vm(vm);
+    fclose(null);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,98 @@
+// field reads through inline caches, with every access site seeing
+// one shape, several, and more than a cache holds, against the same
+// reads from a map keyed by field name. the script is the same
+// statement repeated since there are no loops to put it in
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+#include "vm.h"
+
+#define STATEMENTS 500
+
+// a, b and c set in every order, six shapes of the one class
+static const char* setup =
+    "class Record {}\n"
+    "var s0 = Record(); s0.a = 1; s0.b = 2; s0.c = 3;\n"
+    "var s1 = Record(); s1.a = 1; s1.c = 3; s1.b = 2;\n"
+    "var s2 = Record(); s2.b = 2; s2.a = 1; s2.c = 3;\n"
+    "var s3 = Record(); s3.b = 2; s3.c = 3; s3.a = 1;\n"
+    "var s4 = Record(); s4.c = 3; s4.a = 1; s4.b = 2;\n"
+    "var s5 = Record(); s5.c = 3; s5.b = 2; s5.a = 1;\n"
+    "var m0 = {\"a\": 1, \"b\": 2, \"c\": 3};\n"
+    "var n0 = 1;\n"
+    "var total;\n";
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// a fresh script each time, so every site starts with an empty cache
+static CloxScript* repeat(VM* vm, const char* statement) {
+    size_t length = strlen(statement);
+    char* source = malloc(length * STATEMENTS + 1);
+    for (int i = 0; i < STATEMENTS; i++) memcpy(source + length * i, statement, length);
+    source[length * STATEMENTS] = '\0';
+
+    CloxScript* script = clox_compile(vm, source);
+    free(source);
+    if (script == NULL) exit(65);
+    return script;
+}
+
+// ns per statement of statement run with p set to each of the
+// globals prefix0, prefix1 and so on in turn, best of rounds rounds
+static double time_statement(VM* vm, const char* statement, const char* prefix, int count, int rounds) {
+    CloxScript* script = repeat(vm, statement);
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        double elapsed = 0;
+        for (int i = 0; i < count; i++) {
+            // room for any prefix here and any int
+            char name[32];
+            snprintf(name, sizeof(name), "%s%d", prefix, i);
+            Value value;
+            if (!clox_get_global(vm, name, &value)) exit(70);
+            clox_set_global(vm, "p", value);
+
+            double start = now();
+            if (clox_run(vm, script) != INTERPRET_OK) exit(70);
+            elapsed += now() - start;
+        }
+        if (round == 0 || elapsed < best) best = elapsed;
+    }
+
+    clox_free_script(script);
+    return best * 1e9 / ((double)count * STATEMENTS);
+}
+
+int main(int argc, const char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 5000;
+
+    VM* vm = clox_new_vm();
+    if (interpret(vm, setup, strlen(setup)) != INTERPRET_OK) return 70;
+
+    // the rest of the statement, taken off the others
+    double overhead = time_statement(vm, "total = p + p + p;\n", "n", 1, rounds);
+    const char* fields = "total = p.a + p.b + p.c;\n";
+    double monomorphic = time_statement(vm, fields, "s", 1, rounds);
+    double polymorphic = time_statement(vm, fields, "s", 4, rounds);
+    double megamorphic = time_statement(vm, fields, "s", 6, rounds);
+    double hashed = time_statement(vm, "total = p[\"a\"] + p[\"b\"] + p[\"c\"];\n", "m", 1, rounds);
+
+    printf("ns per field read, best of %d rounds of %d statements:\n", rounds, STATEMENTS);
+    printf("  one shape per site      %6.2f\n", (monomorphic - overhead) / 3);
+    printf("  four shapes per site    %6.2f\n", (polymorphic - overhead) / 3);
+    printf("  six shapes per site     %6.2f\n", (megamorphic - overhead) / 3);
+    printf("  map keyed by name       %6.2f\n", (hashed - overhead) / 3);
+
+    clox_free_vm(vm);
+    return 0;
+}
@@ -0,0 +1,73 @@
+// per entry latency of a long interactive session, each entry
+// appended to one session chunk versus compiled into a chunk of its
+// own with interpret(). latency should stay flat from the first
+// entries to the last either way
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "clox.h"
+#include "stream.h"
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// entries reuse a handful of globals and constants the way typing
+// at a prompt does
+static int make_entry(char* buffer, size_t size, int i) {
+    switch (i % 4) {
+        case 0: return snprintf(buffer, size, "var total = %d;\n", i % 10);
+        case 1: return snprintf(buffer, size, "total = total * 2 + 1;\n");
+        case 2: return snprintf(buffer, size, "var label = \"total\";\n");
+        default: return snprintf(buffer, size, "total = (total - 1) / 2;\n");
+    }
+}
+
+static void report(const char* name, double* latencies, int entries) {
+    int window = entries / 10;
+    double first = 0, last = 0;
+    for (int i = 0; i < window; i++) {
+        first += latencies[i];
+        last += latencies[entries - window + i];
+    }
+    printf("%-10s first %d entries %.0f ns/entry, last %d entries %.0f ns/entry\n",
+        name, window, first / window * 1e9, window, last / window * 1e9);
+}
+
+int main(int argc, const char* argv[]) {
+    int entries = argc > 1 ? atoi(argv[1]) : 200000;
+    double* latencies = malloc(sizeof(double) * entries);
+    char entry[64];
+
+    VM* vm = clox_new_vm();
+    Session session;
+    init_session(vm, &session);
+    for (int i = 0; i < entries; i++) {
+        int length = make_entry(entry, sizeof(entry), i);
+        double start = now();
+        if (interpret_entry(vm, &session, entry, length) != INTERPRET_OK) return 70;
+        latencies[i] = now() - start;
+    }
+    free_session(&session);
+    report("session", latencies, entries);
+    clox_free_vm(vm);
+
+    vm = clox_new_vm();
+    for (int i = 0; i < entries; i++) {
+        int length = make_entry(entry, sizeof(entry), i);
+        double start = now();
+        if (interpret(vm, entry, length) != INTERPRET_OK) return 70;
+        latencies[i] = now() - start;
+    }
+    report("interpret", latencies, entries);
+    clox_free_vm(vm);
+
+    free(latencies);
+    return 0;
+}
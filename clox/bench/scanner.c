@@ -0,0 +1,74 @@
+// tokens per second over a generated multi-megabyte source with
+// indentation, comments, long identifiers and strings. the token
+// checksum should match between simd and CLOX_SCALAR_SCANNER builds
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static const char* fragments[] = {
+    "        var accumulated_total_for_region = previous_total_for_region + 12.5;\n",
+    "    // running totals are carried across regions so the report can\n"
+    "    // show the change from one to the next without a second pass\n",
+    "    print \"region summary: totals, averages and the change since last run\";\n",
+    "    /* block comments describe the generated section\n"
+    "       and can run over several lines */\n",
+    "            if (LongIdentifierWithMixedCase_42 >= threshold_value) print nil;\n",
+    "\n\n",
+    "    var message = \"a string that spans\n two lines\";\n",
+};
+
+int main(int argc, const char* argv[]) {
+    size_t target = argc > 1 ? (size_t)atol(argv[1]) : 16 * 1024 * 1024;
+    int runs = 5;
+
+    int fragment_count = sizeof(fragments) / sizeof(fragments[0]);
+    char* source = malloc(target + 256);
+    size_t length = 0;
+    for (unsigned i = 0; length < target; i++) {
+        const char* fragment = fragments[(i * 7 + i / 3) % fragment_count];
+        size_t size = strlen(fragment);
+        memcpy(source + length, fragment, size);
+        length += size;
+    }
+    source[length] = '\0';
+
+    double best = 0;
+    long tokens = 0;
+    unsigned long checksum = 0;
+    for (int run = 0; run < runs; run++) {
+        Scanner scanner;
+        init_scanner(&scanner, source, length);
+        tokens = 0;
+        checksum = 0;
+
+        double start = now();
+        for (;;) {
+            Token token = scan_token(&scanner);
+            tokens++;
+            checksum = checksum * 31 + token.type * 7 + token.length * 3 + token.line
+                + (unsigned long)(token.start - source);
+            if (token.type == TOKEN_EOF) break;
+        }
+        double elapsed = now() - start;
+
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    printf("%.1f MB, %ld tokens: best of %d scans %.3f s, %.1f M tokens/sec, %.0f MB/s, checksum %lx\n",
+        length / 1e6, tokens, runs, best, tokens / best / 1e6, length / 1e6 / best, checksum);
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,94 @@
+// startup time of a vm set up by running an initialization script
+// that defines thousands of string globals, versus restoring the
+// heap it leaves from a snapshot
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+
+// a chunk holds at most 256 constants, so setup is split
+// into parts of this many globals
+#define GLOBALS_PER_PART 100
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static char* make_part(int part) {
+    size_t size = GLOBALS_PER_PART * 96;
+    char* source = malloc(size);
+    size_t length = 0;
+    for (int i = 0; i < GLOBALS_PER_PART; i++) {
+        int n = part * GLOBALS_PER_PART + i;
+        length += snprintf(source + length, size - length,
+            "var setting_%d = \"configured value number %d\" + \"!\";\n", n, n);
+    }
+    return source;
+}
+
+static VM* run_setup(char** parts, int part_count, CloxScript** last) {
+    VM* vm = clox_new_vm();
+    for (int i = 0; i < part_count; i++) {
+        CloxScript* script = clox_compile(vm, parts[i]);
+        if (script == NULL || clox_run(vm, script) != INTERPRET_OK) exit(70);
+        if (i == part_count - 1) {
+            *last = script;
+        } else {
+            clox_free_script(script);
+        }
+    }
+    return vm;
+}
+
+int main(int argc, const char* argv[]) {
+    int globals = argc > 1 ? atoi(argv[1]) : 20000;
+    const char* path = argc > 2 ? argv[2] : "/tmp/clox-bench.snapshot";
+    int runs = 10;
+
+    int part_count = (globals + GLOBALS_PER_PART - 1) / GLOBALS_PER_PART;
+    char** parts = malloc(sizeof(char*) * part_count);
+    for (int i = 0; i < part_count; i++) parts[i] = make_part(i);
+
+    double cold = 0;
+    for (int run = 0; run < runs; run++) {
+        CloxScript* script = NULL;
+        double start = now();
+        VM* vm = run_setup(parts, part_count, &script);
+        double elapsed = now() - start;
+        if (run == 0 || elapsed < cold) cold = elapsed;
+
+        if (run == 0 && !clox_write_snapshot(vm, script, path)) return 74;
+        clox_free_script(script);
+        clox_free_vm(vm);
+    }
+
+    double warm = 0;
+    for (int run = 0; run < runs; run++) {
+        CloxScript* script = NULL;
+        double start = now();
+        VM* vm = clox_read_snapshot(path, &script);
+        double elapsed = now() - start;
+        if (vm == NULL) return 74;
+        if (run == 0 || elapsed < warm) warm = elapsed;
+
+        Value value;
+        if (!clox_get_global(vm, "setting_0", &value)) return 70;
+        clox_free_script(script);
+        clox_free_vm(vm);
+    }
+
+    printf("%d globals: setup script %.2f ms, snapshot restore %.2f ms (%.1fx), best of %d\n",
+        part_count * GLOBALS_PER_PART, cold * 1e3, warm * 1e3, cold / warm, runs);
+
+    for (int i = 0; i < part_count; i++) free(parts[i]);
+    free(parts);
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "array.h"
+#include "memory.h"
+
+static void unpack(VM* vm, ObjArray* array) {
+    Value* values = ALLOCATE(Value, array->capacity);
+    track_allocation(vm, sizeof(Value) * array->capacity);
+    for (int i = 0; i < array->count; i++) {
+        values[i] = NUMBER_VAL(array->as.numbers[i]);
+    }
+
+    FREE_ARRAY(double, array->as.numbers, array->capacity);
+    array->as.values = values;
+    array->packed = false;
+}
+
+static void pack(VM* vm, ObjArray* array) {
+    double* numbers = ALLOCATE(double, array->capacity);
+    track_allocation(vm, sizeof(double) * array->capacity);
+    for (int i = 0; i < array->count; i++) {
+        numbers[i] = AS_NUMBER(array->as.values[i]);
+    }
+
+    FREE_ARRAY(Value, array->as.values, array->capacity);
+    array->as.numbers = numbers;
+    array->packed = true;
+}
+
+void array_reserve(VM* vm, ObjArray* array, int capacity) {
+    if (capacity <= array->capacity) return;
+
+    if (array->packed) {
+        array->as.numbers = GROW_ARRAY(double, array->as.numbers, array->capacity, capacity);
+        track_allocation(vm, sizeof(double) * (capacity - array->capacity));
+    } else {
+        array->as.values = GROW_ARRAY(Value, array->as.values, array->capacity, capacity);
+        track_allocation(vm, sizeof(Value) * (capacity - array->capacity));
+    }
+    array->capacity = capacity;
+}
+
+Value array_get(ObjArray* array, int index) {
+    if (array->packed) return NUMBER_VAL(array->as.numbers[index]);
+    return array->as.values[index];
+}
+
+void array_set(VM* vm, ObjArray* array, int index, Value value) {
+    if (array->packed && !IS_NUMBER(value)) unpack(vm, array);
+
+    if (array->packed) {
+        array->as.numbers[index] = AS_NUMBER(value);
+    } else {
+        array->as.values[index] = value;
+        write_barrier(vm, (Obj*)array, value);
+    }
+}
+
+void array_push(VM* vm, ObjArray* array, Value value) {
+    if (array->count == array->capacity) {
+        array_reserve(vm, array, GROW_CAPACITY(array->capacity));
+    }
+
+    array->count++;
+    array_set(vm, array, array->count - 1, value);
+}
+
+double* array_numbers(VM* vm, ObjArray* array) {
+    if (array->packed) return array->as.numbers;
+
+    for (int i = 0; i < array->count; i++) {
+        if (!IS_NUMBER(array->as.values[i])) return NULL;
+    }
+
+    pack(vm, array);
+    return array->as.numbers;
+}
@@ -0,0 +1,17 @@
+#ifndef clox_array_h
+#define clox_array_h
+
+#include "common.h"
+#include "object.h"
+
+// index must be in range for get and set
+Value array_get(ObjArray* array, int index);
+void array_set(VM* vm, ObjArray* array, int index, Value value);
+void array_push(VM* vm, ObjArray* array, Value value);
+// room for capacity elements without growing
+void array_reserve(VM* vm, ObjArray* array, int capacity);
+// the elements as packed numbers, repacking an unpacked array
+// that only holds numbers again. NULL if it holds anything else
+double* array_numbers(VM* vm, ObjArray* array);
+
+#endif
@@ -1,20 +1,30 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 
 void init_chunk(Chunk* chunk) {
+    chunk->backend = BACKEND_STACK;
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
     init_value_array(&chunk->constants);
+    init_table(&chunk->string_constants);
+    chunk->cache_count = 0;
+    chunk->cache_capacity = 0;
+    chunk->caches = NULL;
 }
 
 void free_chunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    free_value_array(&chunk->constants);
+    free_table(&chunk->string_constants);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cache_capacity);
     init_chunk(chunk);
 }
 
@@ -31,7 +41,69 @@ void write_chunk(Chunk* chunk, uint8_t byte, int line) {
     chunk->count++;
 }
 
+static int find_constant(Chunk* chunk, Value value) {
+    if (IS_STRING(value)) {
+        // strings are interned so the pointer is the identity
+        Value index;
+        if (table_get(&chunk->string_constants, AS_STRING(value), &index)) {
+            return (int)AS_NUMBER(index);
+        }
+        return -1;
+    }
+
+    if (IS_NUMBER(value)) {
+        // compare bits so 0 and -0 (and NaNs) keep their own slots,
+        // few enough numbers fit in a chunk that a scan is fine
+        double number = AS_NUMBER(value);
+        for (int i = 0; i < chunk->constants.count; i++) {
+            Value constant = chunk->constants.values[i];
+            if (IS_NUMBER(constant) &&
+                    memcmp(&constant.as.number, &number, sizeof(double)) == 0) {
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
 int add_constant(Chunk* chunk, Value value) {
+    int index = find_constant(chunk, value);
+    if (index != -1) return index;
+
     write_value_array(&chunk->constants, value);
-    return chunk->constants.count - 1;
-}
\ No newline at end of file
+    index = chunk->constants.count - 1;
+
+    if (IS_STRING(value)) {
+        table_set(&chunk->string_constants, AS_STRING(value), NUMBER_VAL(index));
+    }
+    return index;
+}
+
+int add_cache(Chunk* chunk) {
+    if (chunk->cache_capacity < chunk->cache_count + 1) {
+        int old_capacity = chunk->cache_capacity;
+        chunk->cache_capacity = GROW_CAPACITY(old_capacity);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, old_capacity, chunk->cache_capacity);
+    }
+
+    memset(&chunk->caches[chunk->cache_count], 0, sizeof(InlineCache));
+    return chunk->cache_count++;
+}
+
+void clear_constants(Chunk* chunk) {
+    chunk->constants.count = 0;
+    free_table(&chunk->string_constants);
+}
+
+void truncate_chunk(Chunk* chunk, int count, int constant_count) {
+    chunk->count = count;
+    chunk->constants.count = constant_count;
+
+    for (int i = 0; i < chunk->string_constants.capacity; i++) {
+        Entry* entry = &chunk->string_constants.entries[i];
+        if (!IS_NIL(entry->key) && AS_NUMBER(entry->value) >= constant_count) {
+            table_delete_value(&chunk->string_constants, entry->key);
+        }
+    }
+}
@@ -2,6 +2,7 @@
 #define clox_chunk_h
 
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 typedef enum {
@@ -21,23 +22,109 @@ typedef enum {
     OP_NOT,
     OP_PRINT,
     OP_POP,
+    OP_DUP,
     OP_GET_GLOBAL,
     OP_SET_GLOBAL,
     OP_DEFINE_GLOBAL,
+    OP_BUILD_ARRAY,     // element count
+    OP_BUILD_MAP,       // entry count, to size the table
+    OP_MAP_ENTRY,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_CALL,            // argument count
+    OP_CLASS,           // name constant
+    OP_GET_PROPERTY,    // name constant, 16-bit cache index
+    OP_SET_PROPERTY,    // name constant, 16-bit cache index
+    OP_GET_LOCAL,       // slot
+    OP_SET_LOCAL,       // slot
+    OP_GET_UPVALUE,     // upvalue index
+    OP_SET_UPVALUE,     // upvalue index
+    OP_CLOSURE,         // function constant, then kind and index per upvalue
+    OP_CLOSE_UPVALUE,
     OP_RETURN
 } OpCode;
 
+// where OP_CLOSURE gets each of the closure's upvalues from
+typedef enum {
+    CAPTURE_UPVALUE,    // one of the running closure's own
+    CAPTURE_LOCAL,      // a local, shared with the running function
+    CAPTURE_COPY        // a local that's never assigned again, copied
+} CaptureKind;
+
+// three-address instructions for the register backend, operands
+// are register numbers or, for RK operands, constant indices
+// offset by RK_CONSTANT
+typedef enum {
+    ROP_LOAD_CONSTANT,  // dst, k
+    ROP_NIL,            // dst
+    ROP_TRUE,           // dst
+    ROP_FALSE,          // dst
+    ROP_EQUAL,          // dst, rk, rk
+    ROP_GREATER,        // dst, rk, rk
+    ROP_LESS,           // dst, rk, rk
+    ROP_NEGATE,         // dst, rk
+    ROP_ADD,            // dst, rk, rk
+    ROP_SUBTRACT,       // dst, rk, rk
+    ROP_MULTIPLY,       // dst, rk, rk
+    ROP_DIVIDE,         // dst, rk, rk
+    ROP_NOT,            // dst, rk
+    ROP_PRINT,          // rk
+    ROP_GET_GLOBAL,     // dst, k
+    ROP_SET_GLOBAL,     // k, rk
+    ROP_DEFINE_GLOBAL,  // k, rk
+    ROP_RETURN
+} RegisterOpCode;
+
+// RK operands with the high bit set name a constant
+// instead of a register
+#define RK_CONSTANT 0x80
+#define REGISTERS_MAX RK_CONSTANT
+
+// shapes a property access has seen and where the field was in
+// each. a set that adds the field also moves the instance to next.
+// a site that sees more shapes than fit stops caching new ones
+#define CACHE_WAYS 4
+
+typedef struct {
+    ObjShape* shape;
+    ObjShape* next;
+    int slot;
+} CacheEntry;
+
+typedef struct {
+    CacheEntry entries[CACHE_WAYS];
+} InlineCache;
+
+typedef enum {
+    BACKEND_STACK,
+    BACKEND_REGISTER
+} Backend;
+
 typedef struct {
+    // instruction format of code, picks the dispatch loop
+    Backend backend;
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
     ValueArray constants;
+    // pool index of every string constant so repeated names
+    // and literals share a slot
+    Table string_constants;
+    // one per property access site, found by the index in its code
+    int cache_count;
+    int cache_capacity;
+    InlineCache* caches;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
 void free_chunk(Chunk* chunk);
 void write_chunk(Chunk* chunk, uint8_t byte, int line);
 int add_constant(Chunk* chunk, Value value);
+// a new empty inline cache, returns its index
+int add_cache(Chunk* chunk);
+void clear_constants(Chunk* chunk);
+// drop code and constants added after the chunk had these counts
+void truncate_chunk(Chunk* chunk, int count, int constant_count);
 
 #endif
\ No newline at end of file
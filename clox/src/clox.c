@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "clox.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "snapshot.h"
+#include "table.h"
+
+struct CloxScript {
+    // the vm it was compiled for, which keeps its chunk
+    VM* vm;
+    Chunk chunk;
+};
+
+VM* clox_new_vm() {
+    VM* vm = ALLOCATE(VM, 1);
+    init_VM(vm);
+    return vm;
+}
+
+void clox_free_vm(VM* vm) {
+    free_VM(vm);
+    FREE(VM, vm);
+}
+
+CloxScript* clox_compile(VM* vm, const char* source) {
+    CloxScript* script = ALLOCATE(CloxScript, 1);
+    script->vm = vm;
+    init_chunk(&script->chunk);
+    script->chunk.backend = vm->backend;
+
+    if (!compile(vm, source, strlen(source), &script->chunk)) {
+        clox_free_script(script);
+        return NULL;
+    }
+
+    keep_chunk(vm, &script->chunk);
+    return script;
+}
+
+void clox_free_script(CloxScript* script) {
+    release_chunk(script->vm, &script->chunk);
+    free_chunk(&script->chunk);
+    FREE(CloxScript, script);
+}
+
+InterpretResult clox_run(VM* vm, CloxScript* script) {
+    return run_chunk(vm, &script->chunk);
+}
+
+void clox_set_limits(VM* vm, uint64_t fuel, double seconds) {
+    vm->limits.fuel = fuel;
+    vm->limits.seconds = seconds;
+}
+
+void clox_set_heap_limit(VM* vm, size_t bytes) {
+    vm->limits.heap = bytes;
+}
+
+void clox_set_gc_threads(VM* vm, int threads) {
+    vm->gc_threads = threads < 1 ? 1 : threads;
+}
+
+void clox_gc_stats(VM* vm, GcStats* stats) {
+    *stats = vm->gc_stats;
+}
+
+void clox_set_global(VM* vm, const char* name, Value value) {
+    // a native can call this mid-run, when the name is made young
+    ObjString* key = copy_string(vm, name, (int)strlen(name));
+    globals_barrier(vm, OBJ_VAL(key));
+    globals_barrier(vm, value);
+    table_set(&vm->globals, key, value);
+}
+
+bool clox_get_global(VM* vm, const char* name, Value* value) {
+    return table_get(&vm->globals, copy_string(vm, name, (int)strlen(name)), value);
+}
+
+Value clox_string(VM* vm, const char* chars) {
+    return OBJ_VAL(copy_string(vm, chars, (int)strlen(chars)));
+}
+
+Value clox_number(double number) {
+    return NUMBER_VAL(number);
+}
+
+Value clox_bool(bool boolean) {
+    return BOOL_VAL(boolean);
+}
+
+Value clox_nil() {
+    return NIL_VAL;
+}
+
+bool clox_to_string(Value value, const char** chars) {
+    if (!IS_STRING(value)) return false;
+    *chars = AS_CSTRING(value);
+    return true;
+}
+
+bool clox_to_number(Value value, double* number) {
+    if (!IS_NUMBER(value)) return false;
+    *number = AS_NUMBER(value);
+    return true;
+}
+
+bool clox_to_bool(Value value, bool* boolean) {
+    if (!IS_BOOL(value)) return false;
+    *boolean = AS_BOOL(value);
+    return true;
+}
+
+bool clox_define_native(VM* vm, const char* name, int arity, NativeFn function) {
+    return define_native(vm, name, arity, function, NULL);
+}
+
+bool clox_define_number_native(VM* vm, const char* name, int arity, NumberFn function) {
+    return define_native(vm, name, arity, NULL, function);
+}
+
+void clox_define_file_natives(VM* vm) {
+    define_file_natives(vm);
+}
+
+bool clox_write_snapshot(VM* vm, CloxScript* script, const char* path) {
+    return write_snapshot(vm, &script->chunk, path);
+}
+
+VM* clox_read_snapshot(const char* path, CloxScript** script) {
+    VM* vm = clox_new_vm();
+    *script = ALLOCATE(CloxScript, 1);
+    (*script)->vm = vm;
+    init_chunk(&(*script)->chunk);
+
+    if (!read_snapshot(vm, &(*script)->chunk, path)) {
+        clox_free_script(*script);
+        clox_free_vm(vm);
+        *script = NULL;
+        return NULL;
+    }
+    keep_chunk(vm, &(*script)->chunk);
+
+    vm->backend = (*script)->chunk.backend;
+    return vm;
+}
@@ -0,0 +1,142 @@
+#ifndef clox_h
+#define clox_h
+
+// public interface for embedding clox, link with libclox.a or
+// libclox.so. this is the only header an embedder needs, the
+// library exports nothing but the clox_ functions below
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLOX_API __attribute__((visibility("default")))
+
+// a vm is only ever handled through a pointer
+typedef struct VM VM;
+// a compiled script that can be run any number of times
+typedef struct CloxScript CloxScript;
+
+typedef enum {
+    INTERPRET_OK,
+    INTERPRET_COMPILE_ERROR,
+    INTERPRET_RUNTIME_ERROR,
+    // stopped by one of the vm's limits, which leaves
+    // it ready to run the next script
+    INTERPRET_OUT_OF_FUEL,
+    INTERPRET_TIMEOUT
+} InterpretResult;
+
+typedef enum {
+    VAL_BOOL,
+    VAL_NIL,
+    VAL_NUMBER,
+    VAL_OBJ
+} ValueType;
+
+// a value is passed around whole, what it holds is made and read
+// with the functions below rather than through its fields
+typedef struct {
+    ValueType type;
+    union {
+        bool boolean;
+        double number;
+        struct Obj* obj;
+    } as;
+} Value;
+
+// pause lengths are counted in buckets, the first for under
+// 2us and each after for twice as long as the one before
+#define GC_PAUSE_BUCKETS 24
+
+typedef struct {
+    int count;
+    // time scripts were stopped for them, and the longest stop
+    double seconds;
+    double longest;
+    int histogram[GC_PAUSE_BUCKETS];
+} GcPauses;
+
+typedef struct {
+    // collections of the whole heap, and of just the nursery
+    GcPauses full;
+    GcPauses young;
+    // spent sweeping alongside the script rather than stopping it
+    double background_seconds;
+    // bytes of young strings that outlived the nursery
+    size_t promoted;
+} GcStats;
+
+// natives get their arguments in place on the stack. returning
+// false raises a runtime error with the message left in result
+typedef bool (*NativeFn)(VM* vm, int arg_count, Value* args, Value* result);
+// numbers in, a number out. the vm checks and unboxes the
+// arguments, so there's nothing for the native to check
+typedef double (*NumberFn)(const double* args);
+
+// natives take any number of arguments with this arity
+#define ARITY_ANY -1
+// most arguments a NumberFn gets
+#define NUMBER_ARGS_MAX 4
+
+CLOX_API VM* clox_new_vm();
+// scripts compiled by the vm must be freed before it is
+CLOX_API void clox_free_vm(VM* vm);
+
+// NULL if the source has a compile error, which is reported on stderr
+CLOX_API CloxScript* clox_compile(VM* vm, const char* source);
+CLOX_API void clox_free_script(CloxScript* script);
+CLOX_API InterpretResult clox_run(VM* vm, CloxScript* script);
+// caps on every run after this, 0 for none. a run that hits one
+// ends with INTERPRET_OUT_OF_FUEL or INTERPRET_TIMEOUT and the vm
+// can run scripts again straight away
+CLOX_API void clox_set_limits(VM* vm, uint64_t fuel, double seconds);
+// most bytes the vm's heap can hold, 0 for no limit. a run that
+// needs more once garbage is collected is a runtime error
+CLOX_API void clox_set_heap_limit(VM* vm, size_t bytes);
+// threads a collection can use, 1 by default. with more, a big
+// heap is marked across all of them and its garbage freed on one
+// while the script carries on
+CLOX_API void clox_set_gc_threads(VM* vm, int threads);
+// collections so far, how long scripts were stopped for them and
+// a histogram of pauses. a sweep still in the background is
+// counted once it's done
+CLOX_API void clox_gc_stats(VM* vm, GcStats* stats);
+
+// globals are how inputs go into a script and results come out,
+// setting one defines it if the script hasn't yet. an object is
+// only kept while a global, a script or a later run can reach it,
+// so a value held outside the vm should be set as a global first
+CLOX_API void clox_set_global(VM* vm, const char* name, Value value);
+CLOX_API bool clox_get_global(VM* vm, const char* name, Value* value);
+// string value interned in vm
+CLOX_API Value clox_string(VM* vm, const char* chars);
+CLOX_API Value clox_number(double number);
+CLOX_API Value clox_bool(bool boolean);
+CLOX_API Value clox_nil();
+// what value holds, false if it's something else. a string's
+// characters last as long as the string does
+CLOX_API bool clox_to_string(Value value, const char** chars);
+CLOX_API bool clox_to_number(Value value, double* number);
+CLOX_API bool clox_to_bool(Value value, bool* boolean);
+
+// a C function as a global. it's called with its arguments where
+// they are on the vm's stack, arity can be ARITY_ANY and the count
+// is passed along. false for an arity below that
+CLOX_API bool clox_define_native(VM* vm, const char* name, int arity, NativeFn function);
+// the fast kind for numeric helpers, up to NUMBER_ARGS_MAX numbers
+// in and one out. calling it with anything else is a runtime error
+// raised before it runs. false for an arity it can't take
+CLOX_API bool clox_define_number_native(VM* vm, const char* name, int arity, NumberFn function);
+// open(), read() and close() for scripts that are trusted with
+// every file the process can read. a vm is made without them
+CLOX_API void clox_define_file_natives(VM* vm);
+
+// everything vm holds plus script, written to path so another
+// process can pick up where this one is without running the
+// script's setup again. false, reported on stderr, on failure
+CLOX_API bool clox_write_snapshot(VM* vm, CloxScript* script, const char* path);
+// a new vm restored from path with the script that was saved
+// in *script, NULL if path isn't a snapshot from this build
+CLOX_API VM* clox_read_snapshot(const char* path, CloxScript** script);
+
+#endif
@@ -5,7 +5,15 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// build with -DNDEBUG to drop tracing, e.g. when benchmarking
+#ifndef NDEBUG
 #define DEBUG_TRACE_EXECUTION
 #define DEBUG_PRINT_CODE
+#endif
+
+// define to collect at every call, to shake out missing roots
+// #define DEBUG_STRESS_GC
 
 #endif
\ No newline at end of file
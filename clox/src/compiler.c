@@ -1,19 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "compiler.h"
+#include "ir.h"
+#include "memory.h"
+#include "object.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
-typedef struct {
-    Token current;
-    Token previous;
-    bool had_error;
-    bool panic_mode;
-} Parser;
-
 // precedence levels from highest to lowest 
 typedef enum {
     PREC_NONE,
@@ -29,9 +26,98 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
+typedef enum {
+    OPERAND_REGISTER,
+    OPERAND_CONSTANT
+} OperandType;
+
+// result of an already compiled expression in register mode,
+// constants aren't loaded and are folded into the instruction
+// that consumes them instead
+typedef struct {
+    OperandType type;
+    uint8_t index;
+    // a dup'd register is shared, only the original frees it
+    bool owned;
+} Operand;
+
+// the register backend reuses the stack emitter: each stack op
+// is replayed against a virtual operand stack whose registers
+// are allocated and freed in stack order
+typedef struct {
+    Operand operands[REGISTERS_MAX];
+    int operand_count;
+    int register_count;
+} RegisterAllocator;
+
+typedef struct {
+    Token name;
+    // scope depth, -1 until its initializer has been compiled
+    int depth;
+    // its slot holds its value, not yet while a function
+    // declaration's own body is being compiled
+    bool assigned;
+    // assigned again after its declaration, so closures can't
+    // take a copy and have to share it
+    bool reassigned;
+    // a closure shares it, so leaving its scope closes it
+    bool shared;
+} Local;
+
+typedef struct {
+    uint8_t index;
+    bool is_local;
+} Upvalue;
+
+// an OP_CLOSURE operand copying a local, switched over to
+// sharing it if the local turns out to be reassigned
+typedef struct {
+    int local;
+    int offset;
+} Copy;
+
+// one per function being compiled, innermost first
+typedef struct Compiler {
+    struct Compiler* enclosing;
+    // NULL for the top level script
+    ObjFunction* function;
+    Local locals[UINT8_COUNT];
+    int local_count;
+    Upvalue upvalues[UINT8_COUNT];
+    int scope_depth;
+
+    int copy_count;
+    int copy_capacity;
+    Copy* copies;
+} Compiler;
+
+// everything one compilation touches lives here so several
+// can run at once, each on its own thread
+typedef struct {
+    // vm that owns the strings interned while compiling
+    VM* vm;
+    Scanner scanner;
+    Token current;
+    Token previous;
+    bool had_error;
+    bool panic_mode;
+
+    Chunk* chunk;
+    Compiler* compiler;
+    RegisterAllocator allocator;
+    // set while parsing into IR for the optimizer instead of
+    // emitting straight into the chunk
+    Ir* ir;
+    // an op the IR or register code has no form for was reached,
+    // the source is compiled again as plain stack code. the line
+    // it was on is reported
+    bool needs_stack;
+    int stack_line;
+} Parser;
+
 // typedef for function type signature 'ParseFn' that's void
 // pardon C99's awful function pointer syntax
-typedef void (*ParseFn)(bool can_assign);
+typedef void (*ParseFn)(Parser* parser, bool can_assign);
 
 typedef struct {
     ParseFn prefix;
@@ -39,215 +125,760 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-Parser parser;
-
-Chunk* compiling_chunk;
+static Chunk* compiler_chunk(Parser* parser, Compiler* compiler) {
+    return compiler->function == NULL ? parser->chunk : &compiler->function->chunk;
+}
 
-static Chunk* current_chunk() {
-    return compiling_chunk;
+static Chunk* current_chunk(Parser* parser) {
+    return compiler_chunk(parser, parser->compiler);
 }
 
-static void error_at(Token* token, const char* message) {
+static void error_at(Parser* parser, Token* token, const char* message) {
     // until parser "synchronizes" after panic mode all code evaluated will just have
     // derivative errors the user shouldn't care about 
-    if (parser.panic_mode) return;
-    parser.panic_mode = true;
+    if (parser->panic_mode) return;
+    parser->panic_mode = true;
    
-    fprintf(stderr, "[line %d] Error", token->line);
+    fprintf(parser->vm->err, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(parser->vm->err, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // print nothing extra if error caught by scanner
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->vm->err, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.had_error = true;
+    fprintf(parser->vm->err, ": %s\n", message);
+    parser->had_error = true;
 }
 
-static void error(const char* message) {
-    error_at(&parser.previous, message);
+static void error(Parser* parser, const char* message) {
+    error_at(parser, &parser->previous, message);
 }
 
-static void error_at_current(const char* message) {
-    error_at(&parser.current, message);
+static void error_at_current(Parser* parser, const char* message) {
+    error_at(parser, &parser->current, message);
 }
 
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
 
     for (;;) {
-        parser.current = scan_token();
-        if (parser.current.type != TOKEN_ERROR) break;
+        parser->current = scan_token(&parser->scanner);
+        if (parser->current.type != TOKEN_ERROR) break;
 
-        error_at_current(parser.current.start);
+        error_at_current(parser, parser->current.start);
     }
 }
 
-static void consume(TokenType type, const char* message) {
+static void consume(Parser* parser, TokenType type, const char* message) {
     // same as advance but "expects" token 
     // and throws syntax error otherwise
-    if (parser.current.type == type) {
-        advance();
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
 
-    error_at_current(message);
+    error_at_current(parser, message);
 }
 
-static bool check(TokenType type) {
-    return parser.current.type == type;
+static bool check(Parser* parser, TokenType type) {
+    return parser->current.type == type;
 }
 
-static bool match(TokenType type) {
-    if (!check(type)) return false;
-    advance();
+static bool match(Parser* parser, TokenType type) {
+    if (!check(parser, type)) return false;
+    advance(parser);
     return true;
 }
 
-static void emit_byte(uint8_t byte) {
-    write_chunk(current_chunk(), byte, parser.previous.line);
+static void emit_byte(Parser* parser, uint8_t byte) {
+    write_chunk(current_chunk(parser), byte, parser->previous.line);
 }
 
-static void emit_bytes(uint8_t byte1, uint8_t byte2) {
-    emit_byte(byte1);
-    emit_byte(byte2);
+static void emit_bytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emit_byte(parser, byte1);
+    emit_byte(parser, byte2);
 }
 
-static void emit_return() {
-    emit_byte(OP_RETURN);
-#ifdef DEBUG_PRINT_CODE
-    // if debug flag enabled then print out chunk
-    if (!parser.had_error) {
-        disassemble_chunk(current_chunk(), "code");
+static void push_operand(Parser* parser, OperandType type, uint8_t index) {
+    if (parser->allocator.operand_count == REGISTERS_MAX) {
+        error(parser, "Expression too complex for the register backend.");
+        return;
     }
-#endif
+
+    parser->allocator.operands[parser->allocator.operand_count].type = type;
+    parser->allocator.operands[parser->allocator.operand_count].index = index;
+    parser->allocator.operands[parser->allocator.operand_count].owned = true;
+    parser->allocator.operand_count++;
+}
+
+static Operand pop_operand(Parser* parser) {
+    // stack can only be unbalanced after a syntax error
+    if (parser->allocator.operand_count == 0) return (Operand){ OPERAND_CONSTANT, 0, false };
+
+    Operand operand = parser->allocator.operands[--parser->allocator.operand_count];
+    // registers are handed out in stack order so the popped
+    // register is always the most recently allocated one
+    if (operand.type == OPERAND_REGISTER && operand.owned) parser->allocator.register_count--;
+    return operand;
+}
+
+static uint8_t allocate_register(Parser* parser) {
+    if (parser->allocator.register_count == REGISTERS_MAX) {
+        error(parser, "Expression too complex for the register backend.");
+        return 0;
+    }
+
+    return (uint8_t)parser->allocator.register_count++;
+}
+
+static uint8_t rk(Operand operand) {
+    if (operand.type == OPERAND_CONSTANT) return operand.index | RK_CONSTANT;
+    return operand.index;
+}
+
+static void emit_register_result(Parser* parser, uint8_t op) {
+    uint8_t dst = allocate_register(parser);
+    emit_bytes(parser, op, dst);
+    push_operand(parser, OPERAND_REGISTER, dst);
+}
+
+static void emit_register_unary(Parser* parser, uint8_t op) {
+    Operand a = pop_operand(parser);
+    emit_register_result(parser, op);
+    emit_byte(parser, rk(a));
+}
+
+static void emit_register_binary(Parser* parser, uint8_t op) {
+    // operand registers are freed before dst is allocated so the
+    // result overwrites the left operand
+    Operand b = pop_operand(parser);
+    Operand a = pop_operand(parser);
+    emit_register_result(parser, op);
+    emit_bytes(parser, rk(a), rk(b));
+}
+
+// translate one stack instruction into register code
+static void emit_register_op(Parser* parser, uint8_t op, uint8_t arg) {
+    switch (op) {
+        case OP_CONSTANT:
+            if (arg < RK_CONSTANT) {
+                push_operand(parser, OPERAND_CONSTANT, arg);
+            } else {
+                // index doesn't fit in an RK operand, load it instead
+                emit_register_result(parser, ROP_LOAD_CONSTANT);
+                emit_byte(parser, arg);
+            }
+            break;
+        case OP_NIL:      emit_register_result(parser, ROP_NIL); break;
+        case OP_TRUE:     emit_register_result(parser, ROP_TRUE); break;
+        case OP_FALSE:    emit_register_result(parser, ROP_FALSE); break;
+        case OP_NEGATE:   emit_register_unary(parser, ROP_NEGATE); break;
+        case OP_NOT:      emit_register_unary(parser, ROP_NOT); break;
+        case OP_EQUAL:    emit_register_binary(parser, ROP_EQUAL); break;
+        case OP_GREATER:  emit_register_binary(parser, ROP_GREATER); break;
+        case OP_LESS:     emit_register_binary(parser, ROP_LESS); break;
+        case OP_ADD:      emit_register_binary(parser, ROP_ADD); break;
+        case OP_SUBTRACT: emit_register_binary(parser, ROP_SUBTRACT); break;
+        case OP_MULTIPLY: emit_register_binary(parser, ROP_MULTIPLY); break;
+        case OP_DIVIDE:   emit_register_binary(parser, ROP_DIVIDE); break;
+        case OP_GET_GLOBAL:
+            emit_register_result(parser, ROP_GET_GLOBAL);
+            emit_byte(parser, arg);
+            break;
+        case OP_SET_GLOBAL: {
+            // assignment is an expression so its value stays put
+            if (parser->allocator.operand_count == 0) return;
+            Operand value = parser->allocator.operands[parser->allocator.operand_count - 1];
+            emit_bytes(parser, ROP_SET_GLOBAL, arg);
+            emit_byte(parser, rk(value));
+            break;
+        }
+        case OP_DEFINE_GLOBAL: {
+            Operand value = pop_operand(parser);
+            emit_bytes(parser, ROP_DEFINE_GLOBAL, arg);
+            emit_byte(parser, rk(value));
+            break;
+        }
+        case OP_PRINT:
+            emit_bytes(parser, ROP_PRINT, rk(pop_operand(parser)));
+            break;
+        case OP_POP:
+            pop_operand(parser);
+            break;
+        case OP_DUP: {
+            if (parser->allocator.operand_count == 0) return;
+            Operand copy = parser->allocator.operands[parser->allocator.operand_count - 1];
+            push_operand(parser, copy.type, copy.index);
+            parser->allocator.operands[parser->allocator.operand_count - 1].owned = false;
+            break;
+        }
+        case OP_RETURN:
+            emit_byte(parser, ROP_RETURN);
+            break;
+    }
+}
+
+static bool stack_only(uint8_t op) {
+    switch (op) {
+        case OP_BUILD_ARRAY:
+        case OP_BUILD_MAP:
+        case OP_MAP_ENTRY:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_CALL:
+        case OP_CLASS:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLOSE_UPVALUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool translated(Parser* parser) {
+    return parser->ir != NULL || current_chunk(parser)->backend == BACKEND_REGISTER;
+}
+
+static void need_stack(Parser* parser) {
+    if (!parser->needs_stack) parser->stack_line = parser->previous.line;
+    parser->needs_stack = true;
+}
+
+// once a stack only op turns up nothing more is emitted,
+// the pass is only finished to report syntax errors
+static bool needs_stack(Parser* parser, uint8_t op) {
+    if (translated(parser) && stack_only(op)) need_stack(parser);
+    return parser->needs_stack;
 }
 
-static uint8_t make_constant(Value value) {
-    int constant = add_constant(current_chunk(), value);
+// locals and functions only exist in stack code
+static void require_stack(Parser* parser) {
+    if (translated(parser)) need_stack(parser);
+}
+
+// emit an instruction in whichever format the chunk uses
+static void emit_op(Parser* parser, uint8_t op) {
+    if (needs_stack(parser, op)) return;
+
+    if (parser->ir != NULL) {
+        ir_emit(parser->ir, op, NIL_VAL, parser->previous.line);
+    } else if (current_chunk(parser)->backend == BACKEND_REGISTER) {
+        emit_register_op(parser, op, 0);
+    } else {
+        emit_byte(parser, op);
+    }
+}
+
+static void emit_op_arg(Parser* parser, uint8_t op, uint8_t arg) {
+    if (needs_stack(parser, op)) return;
+
+    if (parser->ir != NULL) {
+        // the IR keeps values, the pool is rebuilt when lowering
+        Value value = current_chunk(parser)->constants.values[arg];
+        ir_emit(parser->ir, op, value, parser->previous.line);
+    } else if (current_chunk(parser)->backend == BACKEND_REGISTER) {
+        emit_register_op(parser, op, arg);
+    } else {
+        emit_bytes(parser, op, arg);
+    }
+}
+
+static void emit_ops(Parser* parser, uint8_t op1, uint8_t op2) {
+    emit_op(parser, op1);
+    emit_op(parser, op2);
+}
+
+static void emit_return(Parser* parser) {
+    emit_op(parser, OP_RETURN);
+}
+
+static uint8_t make_constant(Parser* parser, Value value) {
+    int constant = add_constant(current_chunk(parser), value);
     if (constant > UINT8_MAX) {
-        error("Too many constants in one chunk.");
+        error(parser, "Too many constants in one chunk.");
         return 0;
     }
 
     return (uint8_t)constant;
 }
 
-static void emit_constant(Value value) {
-    emit_bytes(OP_CONSTANT, make_constant(value));
+static void emit_constant(Parser* parser, Value value) {
+    emit_op_arg(parser, OP_CONSTANT, make_constant(parser, value));
 }
 
-static void end_compiler() {
-    emit_return();
+static void lower_expression(Parser* parser, Ir* ir, int index) {
+    IrNode* node = &ir->nodes[index];
+
+    switch (node->kind) {
+        case IR_CONSTANT:
+            parser->previous.line = node->line;
+            emit_constant(parser, node->value);
+            return;
+        case IR_UNARY:
+            lower_expression(parser, ir, node->left);
+            break;
+        case IR_BINARY:
+            lower_expression(parser, ir, node->left);
+            parser->previous.line = node->line;
+            if (node->dup) {
+                emit_op(parser, OP_DUP);
+            } else {
+                lower_expression(parser, ir, node->right);
+            }
+            break;
+        case IR_SET_GLOBAL:
+        case IR_DEFINE_GLOBAL:
+            lower_expression(parser, ir, node->left);
+            parser->previous.line = node->line;
+            emit_op_arg(parser, node->op, make_constant(parser, node->value));
+            return;
+        case IR_GET_GLOBAL:
+            parser->previous.line = node->line;
+            emit_op_arg(parser, node->op, make_constant(parser, node->value));
+            return;
+        case IR_PRINT:
+        case IR_POP:
+            lower_expression(parser, ir, node->left);
+            break;
+        case IR_NOP:
+            return;
+        default:
+            break;
+    }
+
+    parser->previous.line = node->line;
+    emit_op(parser, node->op);
+}
+
+static void lower_ir(Parser* parser, Ir* ir) {
+    IrPassResult results[IR_PASS_COUNT];
+    int before = ir_instruction_count(ir);
+    optimize_ir(ir, results);
+
+    if (parser->vm->print_passes) {
+        for (int i = 0; i < IR_PASS_COUNT; i++) {
+            fprintf(parser->vm->err, "%-24s removed %d instructions\n",
+                results[i].name, results[i].removed);
+        }
+        fprintf(parser->vm->err, "%-24s %d -> %d instructions\n",
+            "total", before, ir_instruction_count(ir));
+    }
+
+    // constants added while parsing only fed the IR
+    clear_constants(current_chunk(parser));
+
+    for (int i = 0; i < ir->statement_count; i++) {
+        lower_expression(parser, ir, ir->statements[i]);
+    }
+}
+
+static void end_compiler(Parser* parser) {
+    emit_return(parser);
+
+    if (parser->ir != NULL) {
+        Ir* ir = parser->ir;
+        parser->ir = NULL;
+        if (!parser->had_error && !parser->needs_stack) lower_ir(parser, ir);
+    }
+
+#ifdef DEBUG_PRINT_CODE
+    // if debug flag enabled then print out chunk
+    if (!parser->had_error && !parser->needs_stack) {
+        disassemble_chunk(current_chunk(parser), "code");
+    }
+#endif
+
+    Compiler* compiler = parser->compiler;
+    FREE_ARRAY(Copy, compiler->copies, compiler->copy_capacity);
+}
+
+static void init_compiler(Parser* parser, Compiler* compiler, ObjFunction* function) {
+    compiler->enclosing = parser->compiler;
+    compiler->function = function;
+    compiler->local_count = 0;
+    compiler->scope_depth = 0;
+    compiler->copy_count = 0;
+    compiler->copy_capacity = 0;
+    compiler->copies = NULL;
+    parser->compiler = compiler;
+
+    // slot 0 of a call holds the function being called
+    if (function != NULL) {
+        Local* local = &compiler->locals[compiler->local_count++];
+        local->name.start = "";
+        local->name.length = 0;
+        local->depth = 0;
+        local->assigned = true;
+        local->reassigned = false;
+        local->shared = false;
+    }
+}
+
+static ObjFunction* end_function(Parser* parser) {
+    emit_op(parser, OP_NIL);
+    emit_return(parser);
+
+    Compiler* compiler = parser->compiler;
+    ObjFunction* function = compiler->function;
+#ifdef DEBUG_PRINT_CODE
+    if (!parser->had_error && !parser->needs_stack) {
+        disassemble_chunk(&function->chunk, function->name->chars);
+    }
+#endif
+
+    FREE_ARRAY(Copy, compiler->copies, compiler->copy_capacity);
+    parser->compiler = compiler->enclosing;
+    return function;
 }
 
 // to get 
-static void expression();
+static void expression(Parser* parser);
+static void declaration(Parser* parser);
 static ParseRule* get_rule(TokenType type);
-static void parse_precedence(Precedence precedence);
+static void parse_precedence(Parser* parser, Precedence precedence);
+static uint8_t identifier_constant(Parser* parser, Token* name);
 
-static void binary(bool can_assign) {
+static void binary(Parser* parser, bool can_assign) {
     // remember operator just consumed
-    TokenType operator_type = parser.previous.type;
+    TokenType operator_type = parser->previous.type;
 
     // compile right operand (binary is left-associative)
     ParseRule* rule = get_rule(operator_type);
-    parse_precedence((Precedence)(rule->precedence + 1));
+    parse_precedence(parser, (Precedence)(rule->precedence + 1));
 
     // emit operator instruction
     switch (operator_type) {
-        case TOKEN_BANG_EQUAL:    emit_bytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL:   emit_byte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emit_byte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emit_bytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emit_byte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emit_bytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS:          emit_byte(OP_ADD); break;
-        case TOKEN_MINUS:         emit_byte(OP_SUBTRACT); break;
-        case TOKEN_STAR:          emit_byte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:         emit_byte(OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL:    emit_ops(parser, OP_EQUAL, OP_NOT); break;
+        case TOKEN_EQUAL_EQUAL:   emit_op(parser, OP_EQUAL); break;
+        case TOKEN_GREATER:       emit_op(parser, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emit_ops(parser, OP_LESS, OP_NOT); break;
+        case TOKEN_LESS:          emit_op(parser, OP_LESS); break;
+        case TOKEN_LESS_EQUAL:    emit_ops(parser, OP_GREATER, OP_NOT); break;
+        case TOKEN_PLUS:          emit_op(parser, OP_ADD); break;
+        case TOKEN_MINUS:         emit_op(parser, OP_SUBTRACT); break;
+        case TOKEN_STAR:          emit_op(parser, OP_MULTIPLY); break;
+        case TOKEN_SLASH:         emit_op(parser, OP_DIVIDE); break;
         default: 
             return; // should be unreachable
     }
 }
 
-static void grouping(bool can_assign) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static uint8_t argument_list(Parser* parser) {
+    int count = 0;
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            expression(parser);
+            if (count == UINT8_MAX) error(parser, "Can't have more than 255 arguments.");
+            count++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return (uint8_t)count;
+}
+
+static void call(Parser* parser, bool can_assign) {
+    uint8_t arg_count = argument_list(parser);
+    emit_op_arg(parser, OP_CALL, arg_count);
+}
+
+static void array_literal(Parser* parser, bool can_assign) {
+    int count = 0;
+    if (!check(parser, TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression(parser);
+            if (count == UINT8_MAX) error(parser, "Can't have more than 255 elements in an array literal.");
+            count++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+    emit_op_arg(parser, OP_BUILD_ARRAY, (uint8_t)count);
+}
+
+static void map_literal(Parser* parser, bool can_assign) {
+    // each entry goes into the map as soon as it's evaluated, the
+    // count is patched in afterwards so the table starts big enough
+    emit_op_arg(parser, OP_BUILD_MAP, 0);
+    int count_offset = current_chunk(parser)->count - 1;
+
+    int count = 0;
+    if (!check(parser, TOKEN_RIGHT_BRACE)) {
+        do {
+            expression(parser);
+            consume(parser, TOKEN_COLON, "Expect ':' after map key.");
+            expression(parser);
+            emit_op(parser, OP_MAP_ENTRY);
+            count++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    if (!parser->needs_stack) {
+        current_chunk(parser)->code[count_offset] = count > UINT8_MAX ? UINT8_MAX : count;
+    }
+}
+
+static void subscript(Parser* parser, bool can_assign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emit_op(parser, OP_SET_INDEX);
+    } else {
+        emit_op(parser, OP_GET_INDEX);
+    }
+}
+
+// every access gets its own inline cache in the chunk
+static void emit_property(Parser* parser, uint8_t op, uint8_t name) {
+    if (needs_stack(parser, op)) return;
+
+    int cache = add_cache(current_chunk(parser));
+    if (cache > UINT16_MAX) {
+        error(parser, "Too many property accesses in one chunk.");
+        return;
+    }
+    emit_bytes(parser, op, name);
+    emit_bytes(parser, cache & 0xff, cache >> 8);
+}
+
+static void dot(Parser* parser, bool can_assign) {
+    consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    uint8_t name = identifier_constant(parser, &parser->previous);
+
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emit_property(parser, OP_SET_PROPERTY, name);
+    } else {
+        emit_property(parser, OP_GET_PROPERTY, name);
+    }
+}
+
+static void grouping(Parser* parser, bool can_assign) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+}
+
+// exactly representable powers of ten
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+
+// value of a number token, digits with an optional fraction.
+// when the digits fit in 53 bits and the scale is an exact power
+// of ten, one correctly rounded division gives the same double
+// strtod would (clinger's fast path), anything else goes to strtod
+static double parse_number(const char* start, int length) {
+    uint64_t digits = 0;
+    int significant = 0;
+    int fraction = 0;
+    bool seen_point = false;
+
+    for (int i = 0; i < length; i++) {
+        char c = start[i];
+        if (c == '.') {
+            seen_point = true;
+            continue;
+        }
+
+        digits = digits * 10 + (c - '0');
+        if (digits != 0) significant++;
+        if (seen_point) fraction++;
+        if (significant > 15) break;
+    }
+
+    if (significant <= 15 && fraction <= 22) {
+        return (double)digits / exact_powers_of_ten[fraction];
+    }
+
+    // copy out the token so strtod can't read past it
+    char buffer[64];
+    char* text = length < (int)sizeof(buffer) ? buffer : ALLOCATE(char, length + 1);
+    memcpy(text, start, length);
+    text[length] = '\0';
+    double value = strtod(text, NULL);
+    if (text != buffer) FREE_ARRAY(char, text, length + 1);
+    return value;
 }
 
-static void number(bool can_assign) {
-    double value = strtod(parser.previous.start, NULL);
-    emit_constant(NUMBER_VAL(value));
+static void number(Parser* parser, bool can_assign) {
+    double value = parse_number(parser->previous.start, parser->previous.length);
+    emit_constant(parser, NUMBER_VAL(value));
 }
 
-static void unary(bool can_assign) {
-    TokenType operator_type = parser.previous.type;
+static void unary(Parser* parser, bool can_assign) {
+    TokenType operator_type = parser->previous.type;
 
     // compile operand
-    parse_precedence(PREC_UNARY);
+    parse_precedence(parser, PREC_UNARY);
 
     switch (operator_type) {
-        case TOKEN_BANG: emit_byte(OP_NOT); break;
-        case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
+        case TOKEN_BANG: emit_op(parser, OP_NOT); break;
+        case TOKEN_MINUS: emit_op(parser, OP_NEGATE); break;
         default: 
             return; // should be unreachable
     }
 }
 
-static void string(bool can_assign) {
-    emit_constant(
+static void string(Parser* parser, bool can_assign) {
+    emit_constant(parser, 
         OBJ_VAL(
             copy_string(
+                parser->vm,
                 // pointer arithmetic to trim "s
-                parser.previous.start + 1,
-                parser.previous.length - 2
+                parser->previous.start + 1,
+                parser->previous.length - 2
             )
         )
     );
 }
 
-static uint8_t identifier_constant(Token* name) {
-    return make_constant(OBJ_VAL(copy_string(name->start, name->length)));
+static uint8_t identifier_constant(Parser* parser, Token* name) {
+    return make_constant(parser, OBJ_VAL(copy_string(parser->vm, name->start, name->length)));
+}
+
+static bool identifiers_equal(Token* a, Token* b) {
+    return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+static int resolve_local(Parser* parser, Compiler* compiler, Token* name) {
+    for (int i = compiler->local_count - 1; i >= 0; i--) {
+        Local* local = &compiler->locals[i];
+        if (identifiers_equal(name, &local->name)) {
+            if (local->depth == -1) {
+                error(parser, "Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int add_upvalue(Parser* parser, Compiler* compiler, uint8_t index, bool is_local) {
+    int upvalue_count = compiler->function->upvalue_count;
+
+    for (int i = 0; i < upvalue_count; i++) {
+        Upvalue* upvalue = &compiler->upvalues[i];
+        if (upvalue->index == index && upvalue->is_local == is_local) return i;
+    }
+
+    if (upvalue_count == UINT8_COUNT) {
+        error(parser, "Too many closure variables in function.");
+        return 0;
+    }
+
+    compiler->upvalues[upvalue_count].is_local = is_local;
+    compiler->upvalues[upvalue_count].index = index;
+    return compiler->function->upvalue_count++;
+}
+
+static int resolve_upvalue(Parser* parser, Compiler* compiler, Token* name) {
+    if (compiler->enclosing == NULL) return -1;
+
+    int local = resolve_local(parser, compiler->enclosing, name);
+    if (local != -1) return add_upvalue(parser, compiler, (uint8_t)local, true);
+
+    int upvalue = resolve_upvalue(parser, compiler->enclosing, name);
+    if (upvalue != -1) return add_upvalue(parser, compiler, (uint8_t)upvalue, false);
+
+    return -1;
+}
+
+// closures already made copying the local have to share it instead
+static void reassign_local(Parser* parser, Compiler* compiler, int slot) {
+    Local* local = &compiler->locals[slot];
+    local->reassigned = true;
+
+    Chunk* chunk = compiler_chunk(parser, compiler);
+    int kept = 0;
+    for (int i = 0; i < compiler->copy_count; i++) {
+        Copy copy = compiler->copies[i];
+        if (copy.local == slot) {
+            chunk->code[copy.offset] = CAPTURE_LOCAL;
+            local->shared = true;
+        } else {
+            compiler->copies[kept++] = copy;
+        }
+    }
+    compiler->copy_count = kept;
+}
+
+// the local an upvalue leads back to, through any enclosing closures
+static void reassign_upvalue(Parser* parser, Compiler* compiler, int index) {
+    Upvalue* upvalue = &compiler->upvalues[index];
+    if (upvalue->is_local) {
+        reassign_local(parser, compiler->enclosing, upvalue->index);
+    } else {
+        reassign_upvalue(parser, compiler->enclosing, upvalue->index);
+    }
 }
 
-static void named_variable(Token name, bool can_assign) {
-    uint8_t arg = identifier_constant(&name);
+static void named_variable(Parser* parser, Token name, bool can_assign) {
+    uint8_t get_op, set_op;
+    int arg = resolve_local(parser, parser->compiler, &name);
+    if (arg != -1) {
+        get_op = OP_GET_LOCAL;
+        set_op = OP_SET_LOCAL;
+    } else if ((arg = resolve_upvalue(parser, parser->compiler, &name)) != -1) {
+        get_op = OP_GET_UPVALUE;
+        set_op = OP_SET_UPVALUE;
+    } else {
+        arg = identifier_constant(parser, &name);
+        get_op = OP_GET_GLOBAL;
+        set_op = OP_SET_GLOBAL;
+    }
 
     // treat lvalue as setter if there's an equals sign
-    if (can_assign && match(TOKEN_EQUAL)) {
-        expression();
-        emit_bytes(OP_SET_GLOBAL, arg);
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        if (set_op == OP_SET_LOCAL) reassign_local(parser, parser->compiler, arg);
+        if (set_op == OP_SET_UPVALUE) reassign_upvalue(parser, parser->compiler, arg);
+
+        expression(parser);
+        emit_op_arg(parser, set_op, (uint8_t)arg);
     } else {
-        emit_bytes(OP_GET_GLOBAL, arg);
+        emit_op_arg(parser, get_op, (uint8_t)arg);
     }
 }
 
-static void variable(bool can_assign) {
-    named_variable(parser.previous, can_assign);
+static void variable(Parser* parser, bool can_assign) {
+    named_variable(parser, parser->previous, can_assign);
 }
 
 // use only single p-code byte for boolean and nil data types
-static void literal(bool can_assign) {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emit_byte(OP_FALSE); break;
-        case TOKEN_NIL: emit_byte(OP_NIL); break;
-        case TOKEN_TRUE: emit_byte(OP_TRUE); break;
+static void literal(Parser* parser, bool can_assign) {
+    switch (parser->previous.type) {
+        case TOKEN_FALSE: emit_op(parser, OP_FALSE); break;
+        case TOKEN_NIL: emit_op(parser, OP_NIL); break;
+        case TOKEN_TRUE: emit_op(parser, OP_TRUE); break;
         default:
             return; // unreachable
     }
 }
 
 ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN]    = { grouping, NULL,   PREC_NONE },
+    [TOKEN_LEFT_PAREN]    = { grouping, call,   PREC_CALL },
     [TOKEN_RIGHT_PAREN]   = { NULL,     NULL,   PREC_NONE },
-    [TOKEN_LEFT_BRACE]    = { NULL,     NULL,   PREC_NONE }, 
+    [TOKEN_LEFT_BRACE]    = { map_literal, NULL, PREC_NONE },
     [TOKEN_RIGHT_BRACE]   = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_LEFT_BRACKET]  = { array_literal, subscript, PREC_CALL },
+    [TOKEN_RIGHT_BRACKET] = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_COLON]         = { NULL,     NULL,   PREC_NONE },
     [TOKEN_COMMA]         = { NULL,     NULL,   PREC_NONE },
-    [TOKEN_DOT]           = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_DOT]           = { NULL,     dot,    PREC_CALL },
     [TOKEN_MINUS]         = { unary,    binary, PREC_TERM },
     [TOKEN_PLUS]          = { NULL,     binary, PREC_TERM },
     [TOKEN_SEMICOLON]     = { NULL,     NULL,   PREC_NONE },
@@ -261,8 +892,7 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = { NULL,     binary, PREC_COMPARISON },
     [TOKEN_LESS]          = { NULL,     binary, PREC_COMPARISON },
     [TOKEN_LESS_EQUAL]    = { NULL,     binary, PREC_COMPARISON },
-    [TOKEN_IDENTIFIER]    = { variable, NULL,   PREC_NONE},
-    [TOKEN_IDENTIFIER]    = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_IDENTIFIER]    = { variable, NULL,   PREC_NONE },
     [TOKEN_STRING]        = { string,   NULL,   PREC_NONE },
     [TOKEN_NUMBER]        = { number,   NULL,   PREC_NONE },
     [TOKEN_AND]           = { NULL,     NULL,   PREC_NONE },
@@ -289,72 +919,178 @@ static ParseRule* get_rule(TokenType type) {
     return &rules[type];
 }
 
-static void parse_precedence(Precedence precedence) {
+static void parse_precedence(Parser* parser, Precedence precedence) {
     // starts at current token and parses any expression at the given
     // precedence or higher
-    advance();
-    ParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
+    advance(parser);
+    ParseFn prefix_rule = get_rule(parser->previous.type)->prefix;
     if (prefix_rule == NULL) {
-        error("Expect expression.");
+        error(parser, "Expect expression.");
         return;
     }
 
     bool can_assign = precedence <= PREC_ASSIGNMENT;
-    prefix_rule(can_assign);
+    prefix_rule(parser, can_assign);
 
-    while (precedence <= get_rule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infix_rule = get_rule(parser.previous.type)->infix;
-        infix_rule(can_assign);
+    while (precedence <= get_rule(parser->current.type)->precedence) {
+        advance(parser);
+        ParseFn infix_rule = get_rule(parser->previous.type)->infix;
+        infix_rule(parser, can_assign);
     }
 
-    if (can_assign && match(TOKEN_EQUAL)) {
-        error("Invalid assignment target.");
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        error(parser, "Invalid assignment target.");
     }
 }
 
-static uint8_t parse_variable(const char* error_message) {
-    consume(TOKEN_IDENTIFIER, error_message);
-    return identifier_constant(&parser.previous);
+static void add_local(Parser* parser, Token name) {
+    require_stack(parser);
+
+    Compiler* compiler = parser->compiler;
+    if (compiler->local_count == UINT8_COUNT) {
+        error(parser, "Too many local variables in function.");
+        return;
+    }
+
+    Local* local = &compiler->locals[compiler->local_count++];
+    local->name = name;
+    local->depth = -1;
+    local->assigned = false;
+    local->reassigned = false;
+    local->shared = false;
 }
 
-static void define_variable(uint8_t global) {
-    emit_bytes(OP_DEFINE_GLOBAL, global);
+static void declare_variable(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    if (compiler->scope_depth == 0) return;
+
+    Token* name = &parser->previous;
+    for (int i = compiler->local_count - 1; i >= 0; i--) {
+        Local* local = &compiler->locals[i];
+        if (local->depth != -1 && local->depth < compiler->scope_depth) break;
+
+        if (identifiers_equal(name, &local->name)) {
+            error(parser, "Already a variable with this name in this scope.");
+        }
+    }
+
+    add_local(parser, *name);
 }
 
-static void expression() {
-    parse_precedence(PREC_ASSIGNMENT);
+// constant index of the name for a global, locals need none
+static uint8_t parse_variable(Parser* parser, const char* error_message) {
+    consume(parser, TOKEN_IDENTIFIER, error_message);
+
+    declare_variable(parser);
+    if (parser->compiler->scope_depth > 0) return 0;
+
+    return identifier_constant(parser, &parser->previous);
+}
+
+// a function can refer to itself before it's been assigned
+static void mark_initialized(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    if (compiler->scope_depth == 0) return;
+    compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
+}
+
+static void define_variable(Parser* parser, uint8_t global) {
+    if (parser->compiler->scope_depth > 0) {
+        // a local's value is already in its slot
+        mark_initialized(parser);
+        parser->compiler->locals[parser->compiler->local_count - 1].assigned = true;
+        return;
+    }
+
+    emit_op_arg(parser, OP_DEFINE_GLOBAL, global);
+}
+
+static void expression(Parser* parser) {
+    parse_precedence(parser, PREC_ASSIGNMENT);
+}
+
+static void expression_statement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emit_op(parser, OP_POP);
+}
+
+static void print_statement(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emit_op(parser, OP_PRINT);
+}
+
+static void return_statement(Parser* parser) {
+    if (parser->compiler->function == NULL) {
+        error(parser, "Can't return from top-level code.");
+    }
+
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emit_op(parser, OP_NIL);
+    } else {
+        expression(parser);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+    }
+    emit_return(parser);
+}
+
+static void begin_scope(Parser* parser) {
+    parser->compiler->scope_depth++;
 }
 
-static void expression_statement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emit_byte(OP_POP);
+static void end_scope(Parser* parser) {
+    Compiler* compiler = parser->compiler;
+    compiler->scope_depth--;
+
+    while (compiler->local_count > 0 &&
+            compiler->locals[compiler->local_count - 1].depth > compiler->scope_depth) {
+        // only a shared local has anything to close
+        bool shared = compiler->locals[compiler->local_count - 1].shared;
+        emit_op(parser, shared ? OP_CLOSE_UPVALUE : OP_POP);
+        compiler->local_count--;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < compiler->copy_count; i++) {
+        if (compiler->copies[i].local < compiler->local_count) {
+            compiler->copies[kept++] = compiler->copies[i];
+        }
+    }
+    compiler->copy_count = kept;
 }
 
-static void print_statement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emit_byte(OP_PRINT);
+static void block(Parser* parser) {
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void statement() {
-    if (match(TOKEN_PRINT)) {
-        print_statement();
+static void statement(Parser* parser) {
+    if (match(parser, TOKEN_PRINT)) {
+        print_statement(parser);
+    } else if (match(parser, TOKEN_RETURN)) {
+        return_statement(parser);
+    } else if (match(parser, TOKEN_LEFT_BRACE)) {
+        begin_scope(parser);
+        block(parser);
+        end_scope(parser);
     } else {
-        expression_statement();
+        expression_statement(parser);
     }
 }
 
-static void synchronize() {
-    parser.panic_mode = false;
+static void synchronize(Parser* parser) {
+    parser->panic_mode = false;
 
-    while (parser.current.type != TOKEN_EOF) {
+    while (parser->current.type != TOKEN_EOF) {
         // skip tokens until semicolon/token indicating
         // statement boundary or EOF is reached
-        if (parser.previous.type == TOKEN_SEMICOLON) return;
+        if (parser->previous.type == TOKEN_SEMICOLON) return;
 
-        switch (parser.current.type) {
+        switch (parser->current.type) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
@@ -370,47 +1106,208 @@ static void synchronize() {
                 ;
         }
 
-        advance();
+        advance(parser);
     }
 }
 
-static void var_declaration() {
-    uint8_t global = parse_variable("Expect variable name.");
+static void var_declaration(Parser* parser) {
+    uint8_t global = parse_variable(parser, "Expect variable name.");
 
-    if (match(TOKEN_EQUAL)) {
-        expression();
+    if (match(parser, TOKEN_EQUAL)) {
+        expression(parser);
     } else {
-        emit_byte(OP_NIL);
+        emit_op(parser, OP_NIL);
     }
-    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
-    define_variable(global);
+    define_variable(parser, global);
 }
 
-static void declaration() {
-    if (match(TOKEN_VAR)) {
-        var_declaration();
+static void add_copy(Compiler* compiler, int local, int offset) {
+    if (compiler->copy_capacity < compiler->copy_count + 1) {
+        int old_capacity = compiler->copy_capacity;
+        compiler->copy_capacity = GROW_CAPACITY(old_capacity);
+        compiler->copies = GROW_ARRAY(Copy, compiler->copies, old_capacity, compiler->copy_capacity);
+    }
+
+    compiler->copies[compiler->copy_count].local = local;
+    compiler->copies[compiler->copy_count].offset = offset;
+    compiler->copy_count++;
+}
+
+// compiler is the function's, done with but not yet gone
+static void emit_closure(Parser* parser, Compiler* compiler) {
+    ObjFunction* function = compiler->function;
+    uint8_t constant = make_constant(parser, OBJ_VAL(function));
+
+    // a function that captures nothing needs no closure
+    if (function->upvalue_count == 0) {
+        emit_op_arg(parser, OP_CONSTANT, constant);
+        return;
+    }
+
+    emit_op_arg(parser, OP_CLOSURE, constant);
+    if (parser->needs_stack) return;
+
+    for (int i = 0; i < function->upvalue_count; i++) {
+        Upvalue* upvalue = &compiler->upvalues[i];
+        uint8_t kind = CAPTURE_UPVALUE;
+
+        if (upvalue->is_local) {
+            // copied unless it's assigned again, which patches
+            // the kind over to sharing
+            Local* local = &parser->compiler->locals[upvalue->index];
+            if (local->assigned && !local->reassigned) {
+                kind = CAPTURE_COPY;
+                add_copy(parser->compiler, upvalue->index, current_chunk(parser)->count);
+            } else {
+                kind = CAPTURE_LOCAL;
+                local->shared = true;
+            }
+        }
+
+        emit_bytes(parser, kind, upvalue->index);
+    }
+}
+
+static void function(Parser* parser, ObjString* name) {
+    require_stack(parser);
+
+    Compiler compiler;
+    init_compiler(parser, &compiler, new_function(parser->vm, name));
+    begin_scope(parser);
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(parser, TOKEN_RIGHT_PAREN)) {
+        do {
+            compiler.function->arity++;
+            if (compiler.function->arity > UINT8_MAX) {
+                error_at_current(parser, "Can't have more than 255 parameters.");
+            }
+            uint8_t constant = parse_variable(parser, "Expect parameter name.");
+            define_variable(parser, constant);
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);
+
+    end_function(parser);
+    emit_closure(parser, &compiler);
+}
+
+static void fun_declaration(Parser* parser) {
+    uint8_t global = parse_variable(parser, "Expect function name.");
+    ObjString* name = copy_string(parser->vm, parser->previous.start, parser->previous.length);
+    mark_initialized(parser);
+    function(parser, name);
+    define_variable(parser, global);
+}
+
+// classes only hold fields for now, an instance is made by
+// calling its class and gets fields by assigning them
+static void class_declaration(Parser* parser) {
+    uint8_t global = parse_variable(parser, "Expect class name.");
+    uint8_t name = identifier_constant(parser, &parser->previous);
+
+    emit_op_arg(parser, OP_CLASS, name);
+    define_variable(parser, global);
+
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+}
+
+static void declaration(Parser* parser) {
+    if (match(parser, TOKEN_CLASS)) {
+        class_declaration(parser);
+    } else if (match(parser, TOKEN_FUN)) {
+        fun_declaration(parser);
+    } else if (match(parser, TOKEN_VAR)) {
+        var_declaration(parser);
     } else {
-        statement();
+        statement(parser);
     }
 
-    if (parser.panic_mode) synchronize();
+    if (parser->panic_mode) synchronize(parser);
+
+    // every statement leaves the operand stack empty, only an
+    // error can leave registers behind
+    parser->allocator.operand_count = 0;
+    parser->allocator.register_count = 0;
 }
 
-bool compile(const char* source, Chunk* chunk) {
-    init_scanner(source);
-    compiling_chunk = chunk;
+bool compile(VM* vm, const char* source, size_t length, Chunk* chunk) {
+    return compile_from_line(vm, source, length, 1, chunk);
+}
 
-    parser.had_error = false;
-    parser.panic_mode = false;
+// one pass over source, plain compiles stack code without the IR.
+// stack_line is where it needed stack code instead, 0 if it didn't
+static bool compile_pass(VM* vm, const char* source, size_t length, int line,
+        Chunk* chunk, bool plain, int* stack_line) {
+    Parser state;
+    Parser* parser = &state;
+
+    parser->vm = vm;
+    init_scanner(&parser->scanner, source, length);
+    parser->scanner.line = line;
+    parser->chunk = chunk;
+    Compiler compiler;
+    parser->compiler = NULL;
+    init_compiler(parser, &compiler, NULL);
+
+    parser->had_error = false;
+    parser->panic_mode = false;
+
+    parser->allocator.operand_count = 0;
+    parser->allocator.register_count = 0;
+
+    Ir ir;
+    init_ir(&ir, vm);
+    parser->ir = vm->optimize && !plain ? &ir : NULL;
+    parser->needs_stack = false;
+    parser->stack_line = 0;
+
+    advance(parser);
+
+    while (!match(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
 
-    advance();
+    consume(parser, TOKEN_EOF, "Expect end of expression.");
+    end_compiler(parser);
 
-    while (!match(TOKEN_EOF)) {
-        declaration();
+    free_ir(&ir);
+    *stack_line = parser->stack_line;
+    return !parser->had_error;
+}
+
+bool compile_from_line(VM* vm, const char* source, size_t length, int line, Chunk* chunk) {
+    int start_count = chunk->count;
+    int start_constants = chunk->constants.count;
+
+    int stack_line;
+    bool compiled = compile_pass(vm, source, length, line, chunk, false, &stack_line);
+    if (!compiled || stack_line == 0) return compiled;
+
+    // code already in the chunk keeps its format, so only a
+    // chunk with nothing in it yet can switch to stack code
+    if (chunk->backend == BACKEND_REGISTER && start_count > 0) {
+        fprintf(vm->err, "[line %d] Error: Locals, functions and objects need the stack backend.\n",
+            stack_line);
+        return false;
+    }
+
+    // the backend or the optimizer was asked for, so not getting
+    // it is said out loud
+    if (chunk->backend == BACKEND_REGISTER) {
+        fprintf(vm->err, "[line %d] Warning: Locals, functions and objects need the stack backend, "
+            "running on it instead.\n", stack_line);
+    } else {
+        fprintf(vm->err, "[line %d] Warning: Locals, functions and objects can't be optimized yet, "
+            "compiling without the optimizer.\n", stack_line);
     }
 
-    consume(TOKEN_EOF, "Expect end of expression.");
-    end_compiler();
-    return !parser.had_error;
+    truncate_chunk(chunk, start_count, start_constants);
+    chunk->backend = BACKEND_STACK;
+    return compile_pass(vm, source, length, line, chunk, true, &stack_line);
 }
\ No newline at end of file
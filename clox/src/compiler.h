@@ -7,6 +7,9 @@
 #include "scanner.h"
 #include "object.h"
 
-bool compile(const char* source, Chunk* chunk);
+bool compile(VM* vm, const char* source, size_t length, Chunk* chunk);
+// for source that continues a script, so errors and the
+// chunk's line table count from where it left off
+bool compile_from_line(VM* vm, const char* source, size_t length, int line, Chunk* chunk);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "object.h"
 #include "value.h"
 
 void disassemble_chunk(Chunk* chunk, const char* name) {
@@ -19,7 +20,7 @@ static int simple_instruction(const char* name, int offset) {
 static int constant_instruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
-    print_value(chunk->constants.values[constant]);
+    print_value(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 2;
 }
@@ -30,11 +31,144 @@ static int constant_instruction_long(const char* name, Chunk* chunk, int offset)
     uint8_t upper_byte = chunk->code[offset + 3];
     long constant = (upper_byte << 16) | (middle_byte << 8) | lower_byte;
     printf("%-16s %4ld '", name, constant);
-    print_value(chunk->constants.values[constant]);
+    print_value(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 4;
 }
 
+static int property_instruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    int cache = chunk->code[offset + 2] | (chunk->code[offset + 3] << 8);
+    printf("%-16s %4d '", name, constant);
+    print_value(stdout, chunk->constants.values[constant]);
+    printf("' cache %d\n", cache);
+    return offset + 4;
+}
+
+static int byte_instruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static int closure_instruction(Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    printf("%-16s %4d ", "OP_CLOSURE", constant);
+    print_value(stdout, chunk->constants.values[constant]);
+    printf("\n");
+    offset += 2;
+
+    static const char* kinds[] = { "upvalue", "local", "copy" };
+    ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+    for (int i = 0; i < function->upvalue_count; i++) {
+        uint8_t kind = chunk->code[offset];
+        uint8_t index = chunk->code[offset + 1];
+        printf("%04d    |                     %s %d\n", offset, kinds[kind], index);
+        offset += 2;
+    }
+    return offset;
+}
+
+static void print_rk(Chunk* chunk, uint8_t operand) {
+    if (operand & RK_CONSTANT) {
+        printf(" '");
+        print_value(stdout, chunk->constants.values[operand & ~RK_CONSTANT]);
+        printf("'");
+    } else {
+        printf(" r%d", operand);
+    }
+}
+
+static int register_instruction(const char* name, Chunk* chunk, int offset) {
+    // dst only
+    printf("%-16s r%d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static int register_constant_instruction(const char* name, Chunk* chunk, int offset) {
+    // dst, k
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s r%d %4d '", name, chunk->code[offset + 1], constant);
+    print_value(stdout, chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static int register_store_instruction(const char* name, Chunk* chunk, int offset) {
+    // k, rk
+    uint8_t constant = chunk->code[offset + 1];
+    printf("%-16s %4d '", name, constant);
+    print_value(stdout, chunk->constants.values[constant]);
+    printf("' <-");
+    print_rk(chunk, chunk->code[offset + 2]);
+    printf("\n");
+    return offset + 3;
+}
+
+static int register_unary_instruction(const char* name, Chunk* chunk, int offset) {
+    // dst, rk
+    printf("%-16s r%d", name, chunk->code[offset + 1]);
+    print_rk(chunk, chunk->code[offset + 2]);
+    printf("\n");
+    return offset + 3;
+}
+
+static int register_binary_instruction(const char* name, Chunk* chunk, int offset) {
+    // dst, rk, rk
+    printf("%-16s r%d", name, chunk->code[offset + 1]);
+    print_rk(chunk, chunk->code[offset + 2]);
+    print_rk(chunk, chunk->code[offset + 3]);
+    printf("\n");
+    return offset + 4;
+}
+
+static int disassemble_register_instruction(Chunk* chunk, int offset) {
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction) {
+        case ROP_LOAD_CONSTANT:
+            return register_constant_instruction("ROP_LOAD_CONSTANT", chunk, offset);
+        case ROP_NIL:
+            return register_instruction("ROP_NIL", chunk, offset);
+        case ROP_TRUE:
+            return register_instruction("ROP_TRUE", chunk, offset);
+        case ROP_FALSE:
+            return register_instruction("ROP_FALSE", chunk, offset);
+        case ROP_EQUAL:
+            return register_binary_instruction("ROP_EQUAL", chunk, offset);
+        case ROP_GREATER:
+            return register_binary_instruction("ROP_GREATER", chunk, offset);
+        case ROP_LESS:
+            return register_binary_instruction("ROP_LESS", chunk, offset);
+        case ROP_NEGATE:
+            return register_unary_instruction("ROP_NEGATE", chunk, offset);
+        case ROP_ADD:
+            return register_binary_instruction("ROP_ADD", chunk, offset);
+        case ROP_SUBTRACT:
+            return register_binary_instruction("ROP_SUBTRACT", chunk, offset);
+        case ROP_MULTIPLY:
+            return register_binary_instruction("ROP_MULTIPLY", chunk, offset);
+        case ROP_DIVIDE:
+            return register_binary_instruction("ROP_DIVIDE", chunk, offset);
+        case ROP_NOT:
+            return register_unary_instruction("ROP_NOT", chunk, offset);
+        case ROP_PRINT:
+            printf("%-16s", "ROP_PRINT");
+            print_rk(chunk, chunk->code[offset + 1]);
+            printf("\n");
+            return offset + 2;
+        case ROP_GET_GLOBAL:
+            return register_constant_instruction("ROP_GET_GLOBAL", chunk, offset);
+        case ROP_SET_GLOBAL:
+            return register_store_instruction("ROP_SET_GLOBAL", chunk, offset);
+        case ROP_DEFINE_GLOBAL:
+            return register_store_instruction("ROP_DEFINE_GLOBAL", chunk, offset);
+        case ROP_RETURN:
+            return simple_instruction("ROP_RETURN", offset);
+        default:
+            printf("Unknown opcode %d\n", instruction);
+            return offset + 1;
+    }
+}
+
 int disassemble_instruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
     if (offset > 0 &&
@@ -44,6 +178,10 @@ int disassemble_instruction(Chunk* chunk, int offset) {
         printf("%4d ", chunk->lines[offset]);
     }
 
+    if (chunk->backend == BACKEND_REGISTER) {
+        return disassemble_register_instruction(chunk, offset);
+    }
+
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
         case OP_CONSTANT:
@@ -82,8 +220,40 @@ int disassemble_instruction(Chunk* chunk, int offset) {
             return simple_instruction("OP_NOT", offset);
         case OP_POP:
             return simple_instruction("OP_POP", offset);
+        case OP_DUP:
+            return simple_instruction("OP_DUP", offset);
         case OP_PRINT:
             return simple_instruction("OP_PRINT", offset);
+        case OP_BUILD_ARRAY:
+            return byte_instruction("OP_BUILD_ARRAY", chunk, offset);
+        case OP_BUILD_MAP:
+            return byte_instruction("OP_BUILD_MAP", chunk, offset);
+        case OP_MAP_ENTRY:
+            return simple_instruction("OP_MAP_ENTRY", offset);
+        case OP_GET_INDEX:
+            return simple_instruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return simple_instruction("OP_SET_INDEX", offset);
+        case OP_CALL:
+            return byte_instruction("OP_CALL", chunk, offset);
+        case OP_CLASS:
+            return constant_instruction("OP_CLASS", chunk, offset);
+        case OP_GET_PROPERTY:
+            return property_instruction("OP_GET_PROPERTY", chunk, offset);
+        case OP_SET_PROPERTY:
+            return property_instruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_GET_LOCAL:
+            return byte_instruction("OP_GET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL:
+            return byte_instruction("OP_SET_LOCAL", chunk, offset);
+        case OP_GET_UPVALUE:
+            return byte_instruction("OP_GET_UPVALUE", chunk, offset);
+        case OP_SET_UPVALUE:
+            return byte_instruction("OP_SET_UPVALUE", chunk, offset);
+        case OP_CLOSURE:
+            return closure_instruction(chunk, offset);
+        case OP_CLOSE_UPVALUE:
+            return simple_instruction("OP_CLOSE_UPVALUE", offset);
         case OP_RETURN:
             return simple_instruction("OP_RETURN", offset);
         default:
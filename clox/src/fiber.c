@@ -0,0 +1,545 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "fiber.h"
+#include "memory.h"
+#include "native.h"
+#include "vm.h"
+
+// most bytes one read() returns
+#define READ_SIZE 4096
+// most parked fibers woken by one look at the files
+#define READY_MAX 64
+
+void init_scheduler(Scheduler* scheduler) {
+    scheduler->head = NULL;
+    scheduler->tail = NULL;
+    scheduler->waiting = NULL;
+    scheduler->waiting_count = 0;
+    scheduler->waiting_capacity = 0;
+    scheduler->poller = -1;
+    init_table(&scheduler->files);
+}
+
+void close_files(Scheduler* scheduler) {
+    Table* files = &scheduler->files;
+    for (int i = 0; i < files->capacity; i++) {
+        if (IS_NUMBER(files->entries[i].key)) close((int)AS_NUMBER(files->entries[i].key));
+    }
+    free_table(files);
+}
+
+void free_scheduler(Scheduler* scheduler) {
+    FREE_ARRAY(ObjFiber*, scheduler->waiting, scheduler->waiting_capacity);
+    if (scheduler->poller >= 0) close(scheduler->poller);
+    close_files(scheduler);
+}
+
+static void enqueue(Scheduler* scheduler, ObjFiber* fiber) {
+    fiber->state = FIBER_QUEUED;
+    fiber->next_queued = NULL;
+    if (scheduler->tail == NULL) {
+        scheduler->head = fiber;
+    } else {
+        scheduler->tail->next_queued = fiber;
+    }
+    scheduler->tail = fiber;
+}
+
+static ObjFiber* dequeue(Scheduler* scheduler) {
+    ObjFiber* fiber = scheduler->head;
+    scheduler->head = fiber->next_queued;
+    if (scheduler->head == NULL) scheduler->tail = NULL;
+    fiber->next_queued = NULL;
+    return fiber;
+}
+
+static void add_waiting(Scheduler* scheduler, ObjFiber* fiber) {
+    if (scheduler->waiting_capacity < scheduler->waiting_count + 1) {
+        int old_capacity = scheduler->waiting_capacity;
+        scheduler->waiting_capacity = GROW_CAPACITY(old_capacity);
+        scheduler->waiting = GROW_ARRAY(ObjFiber*, scheduler->waiting,
+            old_capacity, scheduler->waiting_capacity);
+    }
+    scheduler->waiting[scheduler->waiting_count++] = fiber;
+}
+
+static void remove_waiting(Scheduler* scheduler, ObjFiber* fiber) {
+    for (int i = 0; i < scheduler->waiting_count; i++) {
+        if (scheduler->waiting[i] == fiber) {
+            scheduler->waiting[i] = scheduler->waiting[--scheduler->waiting_count];
+            return;
+        }
+    }
+}
+
+#ifdef __linux__
+
+static bool watch(Scheduler* scheduler, ObjFiber* fiber) {
+    if (scheduler->poller < 0) {
+        scheduler->poller = epoll_create1(EPOLL_CLOEXEC);
+        if (scheduler->poller < 0) return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = fiber;
+    return epoll_ctl(scheduler->poller, EPOLL_CTL_ADD, fiber->fd, &event) == 0;
+}
+
+static void unwatch(Scheduler* scheduler, ObjFiber* fiber) {
+    epoll_ctl(scheduler->poller, EPOLL_CTL_DEL, fiber->fd, NULL);
+}
+
+// parked fibers whose files have something, waiting up to
+// timeout ms for one, or for good if it's -1
+static int ready_fibers(Scheduler* scheduler, ObjFiber** ready, int timeout) {
+    struct epoll_event events[READY_MAX];
+    int count;
+    do {
+        count = epoll_wait(scheduler->poller, events, READY_MAX, timeout);
+    } while (count < 0 && errno == EINTR);
+
+    for (int i = 0; i < count; i++) ready[i] = events[i].data.ptr;
+    return count < 0 ? 0 : count;
+}
+
+#else
+
+// poll() where there's no epoll, over every parked fiber each time
+static bool watch(Scheduler* scheduler, ObjFiber* fiber) {
+    for (int i = 0; i < scheduler->waiting_count; i++) {
+        if (scheduler->waiting[i]->fd == fiber->fd) {
+            errno = EEXIST;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void unwatch(Scheduler* scheduler, ObjFiber* fiber) {
+}
+
+static int ready_fibers(Scheduler* scheduler, ObjFiber** ready, int timeout) {
+    int waiting_count = scheduler->waiting_count;
+    struct pollfd* fds = ALLOCATE(struct pollfd, waiting_count);
+    for (int i = 0; i < waiting_count; i++) {
+        fds[i].fd = scheduler->waiting[i]->fd;
+        fds[i].events = POLLIN;
+    }
+
+    int polled;
+    do {
+        polled = poll(fds, waiting_count, timeout);
+    } while (polled < 0 && errno == EINTR);
+
+    int count = 0;
+    for (int i = 0; i < waiting_count && count < READY_MAX; i++) {
+        if (polled > 0 && fds[i].revents != 0) ready[count++] = scheduler->waiting[i];
+    }
+    FREE_ARRAY(struct pollfd, fds, waiting_count);
+    return count;
+}
+
+#endif
+
+// false with the error in result if reading fails, *again if
+// there's nothing to read yet. nil at the end of the file
+static bool read_file(VM* vm, int fd, Value* result, bool* again) {
+    char buffer[READ_SIZE];
+    ssize_t length;
+    do {
+        length = read(fd, buffer, sizeof(buffer));
+    } while (length < 0 && errno == EINTR);
+
+    *again = length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    if (length < 0 && !*again) return native_error(vm, result, "Could not read file.");
+
+    *result = length > 0 ? OBJ_VAL(copy_string(vm, buffer, (int)length)) : NIL_VAL;
+    return true;
+}
+
+// read for the parked fibers whose files have something and queue
+// them with what they read. a read that fails once it's waited
+// gives nil, like the end of the file
+static void wake_ready(VM* vm, int timeout) {
+    Scheduler* scheduler = &vm->scheduler;
+    ObjFiber* ready[READY_MAX];
+    int count = ready_fibers(scheduler, ready, timeout);
+
+    for (int i = 0; i < count; i++) {
+        ObjFiber* fiber = ready[i];
+        Value value = NIL_VAL;
+        bool again = false;
+        if (!read_file(vm, fiber->fd, &value, &again)) value = NIL_VAL;
+        if (again) continue;
+
+        unwatch(scheduler, fiber);
+        remove_waiting(scheduler, fiber);
+        fiber->fd = -1;
+        fiber->value = value;
+        write_barrier(vm, (Obj*)fiber, value);
+        enqueue(scheduler, fiber);
+    }
+}
+
+// the next fiber to run, blocking on files if none is ready.
+// NULL once there are none left, or with vm->stopped set if the
+// run's deadline passes while they're all parked
+static ObjFiber* next_runnable(VM* vm) {
+    Scheduler* scheduler = &vm->scheduler;
+    for (;;) {
+        int timeout = 0;
+        if (scheduler->head == NULL && scheduler->waiting_count > 0) {
+            timeout = wait_limit(vm);
+            if (timeout == 0) {
+                vm->stopped = INTERPRET_TIMEOUT;
+                return NULL;
+            }
+        }
+
+        // parked fibers get a look in at every switch so
+        // busy ones can't starve them
+        if (scheduler->waiting_count > 0) wake_ready(vm, timeout);
+        if (scheduler->head != NULL) return dequeue(scheduler);
+        if (scheduler->waiting_count == 0) return NULL;
+    }
+}
+
+// closures still holding a fiber's variables keep what they held
+static void close_all(VM* vm, ObjUpvalue* upvalue) {
+    while (upvalue != NULL) {
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        write_barrier(vm, (Obj*)upvalue, upvalue->closed);
+        upvalue = upvalue->next;
+    }
+}
+
+static void save_fiber(VM* vm) {
+    ObjFiber* fiber = vm->fiber;
+    if (vm->frame_count > 0) vm->frames[vm->frame_count - 1].ip = vm->ip;
+    fiber->frame_count = vm->frame_count;
+    fiber->stack_top = vm->stack_top;
+    fiber->open_upvalues = vm->open_upvalues;
+    // its stack isn't the running one any more, so young
+    // collections have to be told about it
+    if (!fiber->obj.remembered) remember_object(vm, (Obj*)fiber);
+}
+
+// the vm working on fiber, as it was left
+static void point_at(VM* vm, ObjFiber* fiber) {
+    vm->fiber = fiber;
+    vm->frames = fiber->frames;
+    vm->frame_count = fiber->frame_count;
+    vm->stack = fiber->stack;
+    vm->stack_top = fiber->stack_top;
+    vm->open_upvalues = fiber->open_upvalues;
+}
+
+// a new fiber calls its function, with the value it's first
+// resumed with if it takes one
+static void start_fiber(VM* vm, ObjFiber* fiber) {
+    ObjFunction* function;
+    Value* upvalues = NULL;
+    if (IS_CLOSURE(fiber->function)) {
+        function = AS_CLOSURE(fiber->function)->function;
+        upvalues = AS_CLOSURE(fiber->function)->upvalues;
+    } else {
+        function = AS_FUNCTION(fiber->function);
+    }
+
+    *vm->stack_top++ = fiber->function;
+    if (function->arity == 1) *vm->stack_top++ = fiber->value;
+
+    CallFrame* frame = &vm->frames[vm->frame_count++];
+    frame->function = function;
+    frame->chunk = &function->chunk;
+    frame->ip = function->chunk.code;
+    frame->slots = vm->stack;
+    frame->upvalues = upvalues;
+}
+
+static void load_fiber(VM* vm, ObjFiber* fiber) {
+    point_at(vm, fiber);
+    fiber->state = FIBER_RUNNING;
+    if (vm->frame_count == 0) {
+        start_fiber(vm, fiber);
+    } else {
+        // the native call it stopped in returns this
+        vm->stack_top[-1] = fiber->value;
+    }
+    fiber->value = NIL_VAL;
+
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    vm->chunk = frame->chunk;
+    vm->ip = frame->ip;
+}
+
+void switch_fiber(VM* vm) {
+    ObjFiber* fiber = vm->switch_to;
+    vm->switch_to = NULL;
+    save_fiber(vm);
+    load_fiber(vm, fiber);
+}
+
+bool finish_fiber(VM* vm, Value result) {
+    ObjFiber* fiber = vm->fiber;
+    close_all(vm, vm->open_upvalues);
+    vm->open_upvalues = NULL;
+    fiber->state = FIBER_DONE;
+    fiber->frame_count = 0;
+
+    // one that was resumed goes back to what resumed it, a
+    // scheduled one or the script lets the next in line run
+    ObjFiber* next;
+    if (fiber->caller != NULL) {
+        next = fiber->caller;
+        next->value = result;
+        write_barrier(vm, (Obj*)next, result);
+        fiber->caller = NULL;
+    } else {
+        next = next_runnable(vm);
+    }
+
+    if (next == NULL) {
+        point_at(vm, &vm->root);
+    } else {
+        load_fiber(vm, next);
+    }
+    if (fiber != &vm->root) free_fiber_stack(fiber);
+    return next != NULL;
+}
+
+void grow_fiber(VM* vm) {
+    ObjFiber* fiber = vm->fiber;
+    if (vm->frame_count == fiber->frame_capacity) {
+        int old_capacity = fiber->frame_capacity;
+        fiber->frame_capacity = GROW_CAPACITY(old_capacity);
+        if (fiber->frame_capacity > FRAMES_MAX) fiber->frame_capacity = FRAMES_MAX;
+        fiber->frames = GROW_ARRAY(CallFrame, fiber->frames, old_capacity, fiber->frame_capacity);
+        track_allocation(vm, sizeof(CallFrame) * (fiber->frame_capacity - old_capacity));
+        vm->frames = fiber->frames;
+    }
+
+    int needed = (int)(vm->stack_top - vm->stack) + UINT8_COUNT;
+    if (needed <= fiber->stack_capacity) return;
+
+    // everything pointing into the stack moves with it
+    int capacity = fiber->stack_capacity;
+    while (capacity < needed) capacity *= 2;
+    Value* stack = ALLOCATE(Value, capacity);
+    track_allocation(vm, sizeof(Value) * (capacity - fiber->stack_capacity));
+    memcpy(stack, vm->stack, sizeof(Value) * (vm->stack_top - vm->stack));
+    for (int i = 0; i < vm->frame_count; i++) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    }
+    for (ObjUpvalue* upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm->stack);
+    }
+    vm->stack_top = stack + (vm->stack_top - vm->stack);
+
+    FREE_ARRAY(Value, fiber->stack, fiber->stack_capacity);
+    fiber->stack = stack;
+    fiber->stack_capacity = capacity;
+    vm->stack = stack;
+}
+
+static void end_fiber(VM* vm, ObjFiber* fiber) {
+    close_all(vm, fiber->open_upvalues);
+    fiber->open_upvalues = NULL;
+    fiber->caller = NULL;
+    fiber->state = FIBER_DONE;
+    if (fiber != &vm->root) free_fiber_stack(fiber);
+}
+
+void reset_fibers(VM* vm) {
+    Scheduler* scheduler = &vm->scheduler;
+    vm->fiber->open_upvalues = vm->open_upvalues;
+    vm->open_upvalues = NULL;
+
+    ObjFiber* fiber = vm->fiber;
+    while (fiber != NULL) {
+        ObjFiber* caller = fiber->caller;
+        end_fiber(vm, fiber);
+        fiber = caller;
+    }
+    while (scheduler->head != NULL) end_fiber(vm, dequeue(scheduler));
+    for (int i = 0; i < scheduler->waiting_count; i++) {
+        scheduler->waiting[i]->fd = -1;
+        end_fiber(vm, scheduler->waiting[i]);
+    }
+    scheduler->waiting_count = 0;
+
+    // dropping the epoll instance drops everything it watched
+    if (scheduler->poller >= 0) {
+        close(scheduler->poller);
+        scheduler->poller = -1;
+    }
+}
+
+// a closure or function that takes at most the one value
+static bool fiber_function(Value value) {
+    if (IS_CLOSURE(value)) return AS_CLOSURE(value)->function->arity <= 1;
+    if (IS_FUNCTION(value)) return AS_FUNCTION(value)->arity <= 1;
+    return false;
+}
+
+bool fiber_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!fiber_function(args[0])) {
+        return native_error(vm, result, "fiber() takes a function of at most one parameter.");
+    }
+
+    *result = OBJ_VAL(new_fiber(vm, args[0]));
+    return true;
+}
+
+// the new fiber runs once the running one yields, waits
+// on a file or finishes
+bool spawn_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!fiber_function(args[0])) {
+        return native_error(vm, result, "spawn() takes a function of at most one parameter.");
+    }
+
+    ObjFiber* fiber = new_fiber(vm, args[0]);
+    enqueue(&vm->scheduler, fiber);
+    *result = OBJ_VAL(fiber);
+    return true;
+}
+
+// runs fiber until it yields or returns, which is what resume()
+// returns. its yield() returns the value it's resumed with
+bool resume_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (arg_count < 1 || arg_count > 2 || !IS_FIBER(args[0])) {
+        return native_error(vm, result, "resume() takes a fiber and a value.");
+    }
+
+    ObjFiber* fiber = AS_FIBER(args[0]);
+    switch (fiber->state) {
+        case FIBER_NEW:
+        case FIBER_SUSPENDED:
+            break;
+        case FIBER_RUNNING:
+            return native_error(vm, result, "Fiber is already running.");
+        case FIBER_QUEUED:
+        case FIBER_WAITING:
+            return native_error(vm, result, "Can't resume a scheduled fiber.");
+        case FIBER_DONE:
+            return native_error(vm, result, "Can't resume a finished fiber.");
+    }
+
+    fiber->caller = vm->fiber;
+    fiber->value = arg_count == 2 ? args[1] : NIL_VAL;
+    write_barrier(vm, (Obj*)fiber, fiber->value);
+    vm->switch_to = fiber;
+    *result = NIL_VAL;
+    return true;
+}
+
+// a resumed fiber hands value back to what resumed it, a scheduled
+// one or the script goes to the back of the run queue
+bool yield_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (arg_count > 1) return native_error(vm, result, "yield() takes at most one value.");
+
+    ObjFiber* fiber = vm->fiber;
+    Value value = arg_count == 1 ? args[0] : NIL_VAL;
+    if (fiber->caller != NULL) {
+        fiber->state = FIBER_SUSPENDED;
+        fiber->caller->value = value;
+        write_barrier(vm, (Obj*)fiber->caller, value);
+        vm->switch_to = fiber->caller;
+        fiber->caller = NULL;
+    } else {
+        enqueue(&vm->scheduler, fiber);
+        vm->switch_to = next_runnable(vm);
+    }
+
+    *result = NIL_VAL;
+    return true;
+}
+
+bool done_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_FIBER(args[0])) return native_error(vm, result, "done() takes a fiber.");
+
+    *result = BOOL_VAL(AS_FIBER(args[0])->state == FIBER_DONE);
+    return true;
+}
+
+// a descriptor open() returned
+static bool file_argument(VM* vm, Value value, int* fd) {
+    Value open;
+    if (!IS_NUMBER(value) || !table_get_value(&vm->scheduler.files, value, &open)) return false;
+    *fd = (int)AS_NUMBER(value);
+    return true;
+}
+
+// files are opened for reading without blocking, so a fifo or
+// a device only holds up the fiber reading it
+bool open_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_STRING(args[0])) return native_error(vm, result, "open() takes a path.");
+
+    int fd = open(AS_CSTRING(args[0]), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        char message[64];
+        snprintf(message, sizeof(message), "Could not open file: %s.", strerror(errno));
+        return native_error(vm, result, message);
+    }
+
+    *result = NUMBER_VAL(fd);
+    table_set_value(&vm->scheduler.files, *result, BOOL_VAL(true));
+    return true;
+}
+
+// up to READ_SIZE bytes as a string, nil at the end of the file.
+// with nothing to read yet the fiber is parked until there is
+bool read_native(VM* vm, int arg_count, Value* args, Value* result) {
+    int fd;
+    if (!file_argument(vm, args[0], &fd)) return native_error(vm, result, "read() takes a file.");
+
+    bool again;
+    if (!read_file(vm, fd, result, &again)) return false;
+    if (!again) return true;
+
+    Scheduler* scheduler = &vm->scheduler;
+    ObjFiber* fiber = vm->fiber;
+    fiber->fd = fd;
+    if (!watch(scheduler, fiber)) {
+        fiber->fd = -1;
+        return native_error(vm, result, errno == EEXIST
+            ? "Another fiber is already reading that file."
+            : "Could not wait on that file.");
+    }
+
+    fiber->state = FIBER_WAITING;
+    add_waiting(scheduler, fiber);
+    vm->switch_to = next_runnable(vm);
+    if (vm->switch_to == NULL) return native_error(vm, result, "Ran past the deadline.");
+    *result = NIL_VAL;
+    return true;
+}
+
+bool close_native(VM* vm, int arg_count, Value* args, Value* result) {
+    int fd;
+    if (!file_argument(vm, args[0], &fd)) return native_error(vm, result, "close() takes a file.");
+    for (int i = 0; i < vm->scheduler.waiting_count; i++) {
+        if (vm->scheduler.waiting[i]->fd == fd) {
+            return native_error(vm, result, "A fiber is waiting to read that file.");
+        }
+    }
+
+    table_delete_value(&vm->scheduler.files, args[0]);
+    close(fd);
+    *result = NIL_VAL;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef clox_fiber_h
+#define clox_fiber_h
+
+#include "common.h"
+#include "object.h"
+#include "table.h"
+
+// fibers that are ready to run go through a queue in turn, ones
+// reading a file that has nothing yet are parked until it does.
+// when nothing is ready the vm blocks until one of those files is
+typedef struct {
+    ObjFiber* head;
+    ObjFiber* tail;
+    ObjFiber** waiting;
+    int waiting_count;
+    int waiting_capacity;
+    // epoll instance, -1 until the first read has to wait
+    int poller;
+    // descriptors open() returned, the only ones scripts can touch
+    Table files;
+} Scheduler;
+
+void init_scheduler(Scheduler* scheduler);
+void free_scheduler(Scheduler* scheduler);
+// close every file scripts left open
+void close_files(Scheduler* scheduler);
+
+// hand control to vm->switch_to, saving where the running fiber is
+void switch_fiber(VM* vm);
+// the running fiber's function returned result. false once nothing
+// is left to run, the main fiber is running again by then
+bool finish_fiber(VM* vm, Value result);
+// room for another frame and a frame's worth of stack
+void grow_fiber(VM* vm);
+// after a runtime error, every fiber that was running, queued or
+// parked is finished and the main fiber is running again
+void reset_fibers(VM* vm);
+
+bool fiber_native(VM* vm, int arg_count, Value* args, Value* result);
+bool spawn_native(VM* vm, int arg_count, Value* args, Value* result);
+bool resume_native(VM* vm, int arg_count, Value* args, Value* result);
+bool yield_native(VM* vm, int arg_count, Value* args, Value* result);
+bool done_native(VM* vm, int arg_count, Value* args, Value* result);
+bool open_native(VM* vm, int arg_count, Value* args, Value* result);
+bool read_native(VM* vm, int arg_count, Value* args, Value* result);
+bool close_native(VM* vm, int arg_count, Value* args, Value* result);
+
+#endif
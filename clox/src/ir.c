@@ -0,0 +1,604 @@
+#include <string.h>
+
+#include "chunk.h"
+#include "ir.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+
+typedef enum {
+    TYPE_UNKNOWN,
+    TYPE_NIL,
+    TYPE_BOOL,
+    TYPE_NUMBER,
+    TYPE_STRING
+} StaticType;
+
+void init_ir(Ir* ir, VM* vm) {
+    ir->vm = vm;
+    ir->count = 0;
+    ir->capacity = 0;
+    ir->nodes = NULL;
+    ir->statement_count = 0;
+    ir->statement_capacity = 0;
+    ir->statements = NULL;
+    ir->stack_count = 0;
+    ir->stack_capacity = 0;
+    ir->stack = NULL;
+}
+
+void free_ir(Ir* ir) {
+    FREE_ARRAY(IrNode, ir->nodes, ir->capacity);
+    FREE_ARRAY(int, ir->statements, ir->statement_capacity);
+    FREE_ARRAY(int, ir->stack, ir->stack_capacity);
+    init_ir(ir, ir->vm);
+}
+
+static int add_node(Ir* ir, IrKind kind, uint8_t op, int left, int right, Value value, int line) {
+    if (ir->capacity < ir->count + 1) {
+        int old_capacity = ir->capacity;
+        ir->capacity = GROW_CAPACITY(old_capacity);
+        ir->nodes = GROW_ARRAY(IrNode, ir->nodes, old_capacity, ir->capacity);
+    }
+
+    IrNode* node = &ir->nodes[ir->count];
+    node->kind = kind;
+    node->op = op;
+    node->dup = false;
+    node->left = left;
+    node->right = right;
+    node->value = value;
+    node->line = line;
+    return ir->count++;
+}
+
+static void push_node(Ir* ir, int node) {
+    if (ir->stack_capacity < ir->stack_count + 1) {
+        int old_capacity = ir->stack_capacity;
+        ir->stack_capacity = GROW_CAPACITY(old_capacity);
+        ir->stack = GROW_ARRAY(int, ir->stack, old_capacity, ir->stack_capacity);
+    }
+
+    ir->stack[ir->stack_count++] = node;
+}
+
+static int pop_node(Ir* ir) {
+    // only reachable after a syntax error, the chunk is
+    // thrown away anyway
+    if (ir->stack_count == 0) return -1;
+    return ir->stack[--ir->stack_count];
+}
+
+static void add_statement(Ir* ir, int node) {
+    if (ir->statement_capacity < ir->statement_count + 1) {
+        int old_capacity = ir->statement_capacity;
+        ir->statement_capacity = GROW_CAPACITY(old_capacity);
+        ir->statements = GROW_ARRAY(int, ir->statements, old_capacity, ir->statement_capacity);
+    }
+
+    ir->statements[ir->statement_count++] = node;
+}
+
+void ir_emit(Ir* ir, uint8_t op, Value arg, int line) {
+    switch (op) {
+        case OP_CONSTANT:
+            push_node(ir, add_node(ir, IR_CONSTANT, op, -1, -1, arg, line));
+            break;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            push_node(ir, add_node(ir, IR_LITERAL, op, -1, -1, NIL_VAL, line));
+            break;
+        case OP_NEGATE:
+        case OP_NOT: {
+            int operand = pop_node(ir);
+            push_node(ir, add_node(ir, IR_UNARY, op, operand, -1, NIL_VAL, line));
+            break;
+        }
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            int right = pop_node(ir);
+            int left = pop_node(ir);
+            push_node(ir, add_node(ir, IR_BINARY, op, left, right, NIL_VAL, line));
+            break;
+        }
+        case OP_GET_GLOBAL:
+            push_node(ir, add_node(ir, IR_GET_GLOBAL, op, -1, -1, arg, line));
+            break;
+        case OP_SET_GLOBAL: {
+            int value = pop_node(ir);
+            push_node(ir, add_node(ir, IR_SET_GLOBAL, op, value, -1, arg, line));
+            break;
+        }
+        case OP_DEFINE_GLOBAL: {
+            int value = pop_node(ir);
+            add_statement(ir, add_node(ir, IR_DEFINE_GLOBAL, op, value, -1, arg, line));
+            break;
+        }
+        case OP_PRINT: {
+            int value = pop_node(ir);
+            add_statement(ir, add_node(ir, IR_PRINT, op, value, -1, NIL_VAL, line));
+            break;
+        }
+        case OP_POP: {
+            int value = pop_node(ir);
+            add_statement(ir, add_node(ir, IR_POP, op, value, -1, NIL_VAL, line));
+            break;
+        }
+        case OP_RETURN:
+            add_statement(ir, add_node(ir, IR_RETURN, op, -1, -1, NIL_VAL, line));
+            break;
+    }
+}
+
+static int count_instructions(Ir* ir, int index) {
+    if (index < 0) return 0;
+
+    IrNode* node = &ir->nodes[index];
+    switch (node->kind) {
+        case IR_BINARY:
+            // a dup stands in for the whole right operand
+            return count_instructions(ir, node->left) + 1 +
+                (node->dup ? 1 : count_instructions(ir, node->right));
+        case IR_NOP:
+            return 0;
+        default:
+            return count_instructions(ir, node->left) + 1;
+    }
+}
+
+int ir_instruction_count(Ir* ir) {
+    int count = 0;
+    for (int i = 0; i < ir->statement_count; i++) {
+        count += count_instructions(ir, ir->statements[i]);
+    }
+
+    return count;
+}
+
+static bool node_constant(Ir* ir, int index, Value* value) {
+    IrNode* node = &ir->nodes[index];
+    if (node->kind == IR_CONSTANT) {
+        *value = node->value;
+        return true;
+    }
+
+    if (node->kind != IR_LITERAL) return false;
+
+    switch (node->op) {
+        case OP_NIL: *value = NIL_VAL; break;
+        case OP_TRUE: *value = BOOL_VAL(true); break;
+        case OP_FALSE: *value = BOOL_VAL(false); break;
+    }
+    return true;
+}
+
+// nodes have exactly one parent so they can be
+// replaced by overwriting them
+static void set_constant(Ir* ir, int index, Value value) {
+    IrNode* node = &ir->nodes[index];
+    node->left = -1;
+    node->right = -1;
+    node->dup = false;
+
+    if (IS_NIL(value) || IS_BOOL(value)) {
+        node->kind = IR_LITERAL;
+        node->op = IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+        return;
+    }
+
+    node->kind = IR_CONSTANT;
+    node->op = OP_CONSTANT;
+    node->value = value;
+}
+
+static StaticType static_type(Ir* ir, int index) {
+    IrNode* node = &ir->nodes[index];
+    switch (node->kind) {
+        case IR_CONSTANT:
+            if (IS_NUMBER(node->value)) return TYPE_NUMBER;
+            if (IS_STRING(node->value)) return TYPE_STRING;
+            return TYPE_UNKNOWN;
+        case IR_LITERAL:
+            return node->op == OP_NIL ? TYPE_NIL : TYPE_BOOL;
+        case IR_UNARY:
+            return node->op == OP_NOT ? TYPE_BOOL : TYPE_NUMBER;
+        case IR_BINARY:
+            switch (node->op) {
+                case OP_EQUAL:
+                case OP_GREATER:
+                case OP_LESS:
+                    return TYPE_BOOL;
+                case OP_ADD: {
+                    StaticType left = static_type(ir, node->left);
+                    StaticType right = node->dup ? left : static_type(ir, node->right);
+                    if (left != right) return TYPE_UNKNOWN;
+                    return left == TYPE_NUMBER || left == TYPE_STRING ? left : TYPE_UNKNOWN;
+                }
+                default:
+                    return TYPE_NUMBER;
+            }
+        case IR_SET_GLOBAL:
+            return static_type(ir, node->left);
+        default:
+            return TYPE_UNKNOWN;
+    }
+}
+
+static bool is_defined(Table* defined, Value name) {
+    Value unused;
+    return table_get(defined, AS_STRING(name), &unused);
+}
+
+// whether evaluating a node can raise a runtime error given the
+// globals already defined by earlier statements of the chunk
+static bool may_fail(Ir* ir, int index, Table* defined) {
+    IrNode* node = &ir->nodes[index];
+    switch (node->kind) {
+        case IR_UNARY:
+            if (may_fail(ir, node->left, defined)) return true;
+            return node->op == OP_NEGATE &&
+                static_type(ir, node->left) != TYPE_NUMBER;
+        case IR_BINARY: {
+            if (may_fail(ir, node->left, defined)) return true;
+            if (!node->dup && may_fail(ir, node->right, defined)) return true;
+            if (node->op == OP_EQUAL) return false;
+
+            StaticType left = static_type(ir, node->left);
+            StaticType right = node->dup ? left : static_type(ir, node->right);
+            if (node->op == OP_ADD && left == TYPE_STRING && right == TYPE_STRING) return false;
+            return left != TYPE_NUMBER || right != TYPE_NUMBER;
+        }
+        case IR_GET_GLOBAL:
+            return !is_defined(defined, node->value);
+        case IR_SET_GLOBAL:
+            return may_fail(ir, node->left, defined) || !is_defined(defined, node->value);
+        case IR_DEFINE_GLOBAL:
+        case IR_PRINT:
+        case IR_POP:
+            return may_fail(ir, node->left, defined);
+        default:
+            return false;
+    }
+}
+
+static bool is_pure(Ir* ir, int index) {
+    if (index < 0) return true;
+
+    IrNode* node = &ir->nodes[index];
+    if (node->kind == IR_SET_GLOBAL) return false;
+    return is_pure(ir, node->left) && (node->dup || is_pure(ir, node->right));
+}
+
+static bool is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static void fold(Ir* ir, int index) {
+    IrNode* node = &ir->nodes[index];
+    Value a;
+    Value b;
+
+    if (node->kind == IR_UNARY) {
+        if (!node_constant(ir, node->left, &a)) return;
+
+        if (node->op == OP_NOT) {
+            set_constant(ir, index, BOOL_VAL(is_falsey(a)));
+        } else if (IS_NUMBER(a)) {
+            set_constant(ir, index, NUMBER_VAL(-AS_NUMBER(a)));
+        }
+        return;
+    }
+
+    if (node->kind != IR_BINARY) return;
+    if (!node_constant(ir, node->left, &a)) return;
+    if (node->dup) {
+        b = a;
+    } else if (!node_constant(ir, node->right, &b)) {
+        return;
+    }
+
+    if (node->op == OP_EQUAL) {
+        set_constant(ir, index, BOOL_VAL(values_equal(a, b)));
+        return;
+    }
+
+    if (node->op == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+        ObjString* left = AS_STRING(a);
+        ObjString* right = AS_STRING(b);
+
+        int length = left->length + right->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+
+        set_constant(ir, index, OBJ_VAL(take_string(ir->vm, chars, length)));
+        return;
+    }
+
+    // anything else that isn't numeric fails at runtime
+    // and has to stay that way
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return;
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (node->op) {
+        case OP_GREATER:  set_constant(ir, index, BOOL_VAL(x > y)); break;
+        case OP_LESS:     set_constant(ir, index, BOOL_VAL(x < y)); break;
+        case OP_ADD:      set_constant(ir, index, NUMBER_VAL(x + y)); break;
+        case OP_SUBTRACT: set_constant(ir, index, NUMBER_VAL(x - y)); break;
+        case OP_MULTIPLY: set_constant(ir, index, NUMBER_VAL(x * y)); break;
+        case OP_DIVIDE:   set_constant(ir, index, NUMBER_VAL(x / y)); break;
+    }
+}
+
+// record the value a store leaves in a global, if it's known
+static void track_store(Ir* ir, Table* known, Value name, int value) {
+    Value constant;
+    if (node_constant(ir, value, &constant)) {
+        table_set(known, AS_STRING(name), constant);
+    } else {
+        table_delete(known, AS_STRING(name));
+    }
+}
+
+// nodes are visited in evaluation order so known holds exactly
+// the globals whose value is a compile time constant at that point
+static void propagate(Ir* ir, int index, Table* known) {
+    if (index < 0) return;
+
+    IrNode* node = &ir->nodes[index];
+    switch (node->kind) {
+        case IR_UNARY:
+            propagate(ir, node->left, known);
+            fold(ir, index);
+            break;
+        case IR_BINARY:
+            propagate(ir, node->left, known);
+            if (!node->dup) propagate(ir, node->right, known);
+            fold(ir, index);
+            break;
+        case IR_GET_GLOBAL: {
+            Value value;
+            if (table_get(known, AS_STRING(node->value), &value)) {
+                set_constant(ir, index, value);
+            }
+            break;
+        }
+        case IR_SET_GLOBAL:
+        case IR_DEFINE_GLOBAL:
+            propagate(ir, node->left, known);
+            track_store(ir, known, node->value, node->left);
+            break;
+        case IR_PRINT:
+        case IR_POP:
+            propagate(ir, node->left, known);
+            break;
+        default:
+            break;
+    }
+}
+
+static void propagate_constants(Ir* ir) {
+    Table known;
+    init_table(&known);
+
+    for (int i = 0; i < ir->statement_count; i++) {
+        propagate(ir, ir->statements[i], &known);
+    }
+
+    free_table(&known);
+}
+
+static bool identical_constants(Value a, Value b) {
+    // 0 and -0 compare equal but don't behave the same
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+
+    return values_equal(a, b);
+}
+
+static bool same_expression(Ir* ir, int a, int b) {
+    IrNode* x = &ir->nodes[a];
+    IrNode* y = &ir->nodes[b];
+    if (x->kind != y->kind || x->op != y->op || x->dup != y->dup) return false;
+
+    switch (x->kind) {
+        case IR_CONSTANT:
+            return identical_constants(x->value, y->value);
+        case IR_LITERAL:
+            return true;
+        case IR_GET_GLOBAL:
+            return AS_STRING(x->value) == AS_STRING(y->value);
+        case IR_UNARY:
+            return same_expression(ir, x->left, y->left);
+        case IR_BINARY:
+            return same_expression(ir, x->left, y->left) &&
+                (x->dup || same_expression(ir, x->right, y->right));
+        default:
+            return false;
+    }
+}
+
+static void eliminate_subexpressions(Ir* ir, int index) {
+    if (index < 0) return;
+
+    IrNode* node = &ir->nodes[index];
+    eliminate_subexpressions(ir, node->left);
+    if (node->kind != IR_BINARY || node->dup) return;
+
+    eliminate_subexpressions(ir, node->right);
+    // nothing between the two operands can change a pure
+    // expression's value so the left result can be reused
+    if (is_pure(ir, node->left) && same_expression(ir, node->left, node->right)) {
+        node->dup = true;
+        node->right = -1;
+    }
+}
+
+static void eliminate_common_subexpressions(Ir* ir) {
+    for (int i = 0; i < ir->statement_count; i++) {
+        eliminate_subexpressions(ir, ir->statements[i]);
+    }
+}
+
+// global written by a top-level assignment or definition statement
+static bool store_target(Ir* ir, int statement, Value* name, int* value) {
+    IrNode* node = &ir->nodes[statement];
+    if (node->kind == IR_DEFINE_GLOBAL) {
+        *name = node->value;
+        *value = node->left;
+        return true;
+    }
+
+    if (node->kind == IR_POP && node->left >= 0 &&
+            ir->nodes[node->left].kind == IR_SET_GLOBAL) {
+        *name = ir->nodes[node->left].value;
+        *value = ir->nodes[node->left].left;
+        return true;
+    }
+
+    return false;
+}
+
+static void forget_reads(Ir* ir, int index, Table* overwritten) {
+    if (index < 0) return;
+
+    IrNode* node = &ir->nodes[index];
+    if (node->kind == IR_GET_GLOBAL) {
+        table_delete(overwritten, AS_STRING(node->value));
+    }
+
+    forget_reads(ir, node->left, overwritten);
+    if (!node->dup) forget_reads(ir, node->right, overwritten);
+}
+
+// overwritten maps a global to the generation it was last seen
+// stored in, doubled and tagged with whether that store defines it
+static void mark_overwritten(Table* overwritten, Value name, int generation, bool defines) {
+    table_set(overwritten, AS_STRING(name), NUMBER_VAL(generation * 2 + (defines ? 1 : 0)));
+}
+
+static bool is_overwritten(Table* overwritten, Value name, int generation, bool* by_definition) {
+    Value value;
+    if (!table_get(overwritten, AS_STRING(name), &value)) return false;
+
+    int tag = (int)AS_NUMBER(value);
+    *by_definition = tag % 2 == 1;
+    return tag / 2 == generation;
+}
+
+static void eliminate_dead_stores(Ir* ir) {
+    int count = ir->statement_count;
+    bool* failing = ALLOCATE(bool, count);
+    bool* stores = ALLOCATE(bool, count);
+    bool* redefines = ALLOCATE(bool, count);
+
+    Table defined;
+    init_table(&defined);
+
+    // a store that runs before a runtime error stays visible to
+    // whoever looks at the globals afterwards, so note which
+    // statements can fail and which stores can't
+    for (int i = 0; i < count; i++) {
+        int statement = ir->statements[i];
+        failing[i] = may_fail(ir, statement, &defined);
+
+        Value name;
+        int value;
+        stores[i] = false;
+        redefines[i] = false;
+        if (store_target(ir, statement, &name, &value)) {
+            redefines[i] = is_defined(&defined, name);
+            stores[i] = ir->nodes[statement].kind == IR_DEFINE_GLOBAL || redefines[i];
+        }
+
+        if (ir->nodes[statement].kind == IR_DEFINE_GLOBAL) {
+            table_set(&defined, AS_STRING(name), BOOL_VAL(true));
+        }
+    }
+
+    // walk backwards tracking the globals that are stored again
+    // before anything reads them, bumping the generation
+    // forgets all of them at once
+    Table overwritten;
+    init_table(&overwritten);
+    int generation = 0;
+
+    for (int i = count - 1; i >= 0; i--) {
+        int statement = ir->statements[i];
+        Value name;
+        int value;
+
+        if (stores[i] && store_target(ir, statement, &name, &value)) {
+            IrNode* node = &ir->nodes[statement];
+            bool defines = node->kind == IR_DEFINE_GLOBAL;
+            bool by_definition;
+
+            // an assignment needs the global to exist so it can only
+            // replace a definition that isn't the first one
+            if (is_overwritten(&overwritten, name, generation, &by_definition) &&
+                    (by_definition || redefines[i])) {
+                // keep evaluating the value for its side effects
+                node->kind = IR_POP;
+                node->op = OP_POP;
+                node->left = value;
+            } else {
+                mark_overwritten(&overwritten, name, generation, defines);
+            }
+        }
+
+        if (failing[i]) generation++;
+        forget_reads(ir, statement, &overwritten);
+    }
+
+    // expression statements whose value is unused and that can't
+    // fail do nothing at all
+    free_table(&defined);
+    init_table(&defined);
+
+    for (int i = 0; i < count; i++) {
+        IrNode* node = &ir->nodes[ir->statements[i]];
+        if (node->kind == IR_POP && is_pure(ir, node->left) &&
+                !may_fail(ir, node->left, &defined)) {
+            node->kind = IR_NOP;
+        } else if (node->kind == IR_DEFINE_GLOBAL) {
+            table_set(&defined, AS_STRING(node->value), BOOL_VAL(true));
+        }
+    }
+
+    free_table(&overwritten);
+    free_table(&defined);
+    FREE_ARRAY(bool, redefines, count);
+    FREE_ARRAY(bool, stores, count);
+    FREE_ARRAY(bool, failing, count);
+}
+
+void optimize_ir(Ir* ir, IrPassResult results[IR_PASS_COUNT]) {
+    static const char* names[IR_PASS_COUNT] = {
+        "constant propagation",
+        "common subexpressions",
+        "dead stores"
+    };
+
+    for (int pass = 0; pass < IR_PASS_COUNT; pass++) {
+        int before = ir_instruction_count(ir);
+        switch (pass) {
+            case 0: propagate_constants(ir); break;
+            case 1: eliminate_common_subexpressions(ir); break;
+            case 2: eliminate_dead_stores(ir); break;
+        }
+
+        results[pass].name = names[pass];
+        results[pass].removed = before - ir_instruction_count(ir);
+    }
+}
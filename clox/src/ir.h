@@ -0,0 +1,74 @@
+#ifndef clox_ir_h
+#define clox_ir_h
+
+#include "common.h"
+#include "value.h"
+
+typedef enum {
+    // expressions
+    IR_CONSTANT,
+    IR_LITERAL,       // nil, true or false, op says which
+    IR_UNARY,
+    IR_BINARY,
+    IR_GET_GLOBAL,
+    IR_SET_GLOBAL,
+
+    // statements
+    IR_DEFINE_GLOBAL,
+    IR_PRINT,
+    IR_POP,
+    IR_RETURN,
+    IR_NOP            // statement removed by a pass
+} IrKind;
+
+// nodes reference their operands by index into the arena so
+// the whole tree is one allocation that passes rewrite in place
+typedef struct {
+    IrKind kind;
+    // stack opcode the node lowers to
+    uint8_t op;
+    // binary node whose right operand is a copy of the left,
+    // lowered as OP_DUP instead of evaluating it twice
+    bool dup;
+    int left;
+    int right;
+    // constant value or global name
+    Value value;
+    int line;
+} IrNode;
+
+typedef struct {
+    // folded strings are interned here
+    VM* vm;
+
+    int count;
+    int capacity;
+    IrNode* nodes;
+
+    // top-level statements in program order
+    int statement_count;
+    int statement_capacity;
+    int* statements;
+
+    // operands of the statement being built, stack code is
+    // postfix so each op just pops its children from here
+    int stack_count;
+    int stack_capacity;
+    int* stack;
+} Ir;
+
+typedef struct {
+    const char* name;
+    int removed;
+} IrPassResult;
+
+#define IR_PASS_COUNT 3
+
+void init_ir(Ir* ir, VM* vm);
+void free_ir(Ir* ir);
+// append a stack instruction, arg is the constant or global name
+void ir_emit(Ir* ir, uint8_t op, Value arg, int line);
+int ir_instruction_count(Ir* ir);
+void optimize_ir(Ir* ir, IrPassResult results[IR_PASS_COUNT]);
+
+#endif
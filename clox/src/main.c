@@ -1,85 +1,505 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "memory.h"
+#include "native.h"
+#include "pool.h"
+#include "serve.h"
+#include "snapshot.h"
+#include "source.h"
+#include "stream.h"
 #include "value.h"
 #include "vm.h"
 #include "table.h"
 
-static void repl();
-static void run_file(const char* path);
-static char* read_file(const char* path);
+static void repl(VM* vm);
+static void run_file(VM* vm, const char* path);
+static void run_stream(VM* vm, const char* path);
+static void snapshot_file(VM* vm, const char* path, const char* snapshot_path);
+static void compile_only(VM* vm, const char* path, int workers);
+static int run_batch(VM* vm, const char** paths, int count, int workers);
+static Source read_file(const char* path);
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: clox [--stack|--register] [--optimize] [--print-passes] [--fuel calls] [--timeout seconds]\n"
+        "            [--heap megabytes] [--gc-threads n] [--gc-stats] [--stream] [--restore snapshot] [path|-]\n"
+        "       clox [options] --snapshot snapshot path\n"
+        "       clox [options] [--threads n] --compile-only dir\n"
+        "       clox [options] [--threads n] --batch path|@manifest...\n"
+        "       clox [options] [--threads n] --serve socket\n"
+        "       clox --send socket path\n");
+    exit(64);
+}
 
 int main(int argc, const char* argv[]) {
-    init_VM();
+    VM vm;
+    init_VM(&vm);
+
+    const char* path = NULL;
+    const char** paths = ALLOCATE(const char*, argc);
+    int path_count = 0;
+    const char* serve_path = NULL;
+    const char* send_path = NULL;
+    const char* snapshot_path = NULL;
+    const char* restore_path = NULL;
+    bool check_only = false;
+    bool batch = false;
+    bool stream = false;
+    bool gc_stats = false;
+    int workers = default_worker_count();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compile-only") == 0) {
+            check_only = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--send") == 0 && i + 1 < argc) {
+            send_path = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_path = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            if (workers < 1) usage();
+        } else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc) {
+            vm.limits.fuel = strtoull(argv[++i], NULL, 10);
+            if (vm.limits.fuel == 0) usage();
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            vm.limits.seconds = atof(argv[++i]);
+            if (vm.limits.seconds <= 0) usage();
+        } else if (strcmp(argv[i], "--heap") == 0 && i + 1 < argc) {
+            double megabytes = atof(argv[++i]);
+            if (megabytes <= 0) usage();
+            vm.limits.heap = (size_t)(megabytes * 1024 * 1024);
+        } else if (strcmp(argv[i], "--gc-threads") == 0 && i + 1 < argc) {
+            vm.gc_threads = atoi(argv[++i]);
+            if (vm.gc_threads < 1) usage();
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_stats = true;
+        } else if (strcmp(argv[i], "--stack") == 0) {
+            vm.backend = BACKEND_STACK;
+        } else if (strcmp(argv[i], "--register") == 0) {
+            vm.backend = BACKEND_REGISTER;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            vm.optimize = true;
+        } else if (strcmp(argv[i], "--print-passes") == 0) {
+            vm.optimize = true;
+            vm.print_passes = true;
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            paths[path_count++] = argv[i];
+        } else {
+            usage();
+        }
+    }
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
+    // only a batch takes more than one path
+    if (path_count == 1) path = paths[0];
+    if (path_count > 1 && !batch) usage();
+
+    // globals and strings from the snapshot, its chunk is kept
+    // alive with them but not run again
+    Chunk restored;
+    init_chunk(&restored);
+    if (restore_path != NULL && !read_snapshot(&vm, &restored, restore_path)) exit(74);
+    // scripts given on the command line can read files, the ones
+    // sent to --serve can't
+    define_file_natives(&vm);
+
+    if (batch) {
+        if (path_count == 0) usage();
+        int code = run_batch(&vm, paths, path_count, workers);
+        FREE_ARRAY(const char*, paths, argc);
+        free_VM(&vm);
+        return code;
+    } else if (serve_path != NULL) {
+        serve(serve_path, workers, vm.backend, vm.optimize, vm.print_passes, vm.limits, vm.gc_threads);
+    } else if (send_path != NULL) {
+        if (path == NULL) usage();
+        Source source = read_file(path);
+        int code = send_script(send_path, source.bytes, source.length);
+        free_source(&source);
+        FREE_ARRAY(const char*, paths, argc);
+        free_VM(&vm);
+        return code;
+    } else if (snapshot_path != NULL) {
+        if (path == NULL) usage();
+        snapshot_file(&vm, path, snapshot_path);
+    } else if (check_only) {
+        if (path == NULL) usage();
+        compile_only(&vm, path, workers);
+    } else if (stream) {
+        run_stream(&vm, path == NULL ? "-" : path);
+    } else if (path == NULL) {
+        repl(&vm);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        run_file(&vm, path);
     }
 
-    free_VM();
+    if (gc_stats) print_gc_stats(&vm, stderr);
+    FREE_ARRAY(const char*, paths, argc);
+    free_chunk(&restored);
+    free_VM(&vm);
     return 0;
 }
 
-static void repl() {
-    char line[1024];
+static void repl(VM* vm) {
+    // piped input is a script, not a session
+    if (!isatty(STDIN_FILENO)) {
+        run_stream(vm, "-");
+        return;
+    }
+
+    Session session;
+    init_session(vm, &session);
+
+    // lines are gathered until brackets and strings are closed so
+    // an entry can run over several of them
+    char* line = NULL;
+    size_t line_capacity = 0;
+    size_t capacity = 256;
+    size_t length = 0;
+    char* entry = ALLOCATE(char, capacity);
+
     for (;;) {
-        printf("> ");
+        printf(length == 0 ? "> " : "... ");
+        fflush(stdout);
 
-        if (!fgets(line, sizeof(line), stdin)) {
+        ssize_t count = getline(&line, &line_capacity, stdin);
+        if (count < 0) {
             printf("\n");
             break;
         }
 
-        interpret(line);
+        if (length + count > capacity) {
+            size_t old_capacity = capacity;
+            while (length + count > capacity) capacity *= 2;
+            entry = GROW_ARRAY(char, entry, old_capacity, capacity);
+        }
+        memcpy(entry + length, line, count);
+        length += count;
+
+        if (!input_complete(entry, length)) continue;
+
+        interpret_entry(vm, &session, entry, length);
+        length = 0;
     }
+
+    free(line);
+    FREE_ARRAY(char, entry, capacity);
+    free_session(&session);
 }
 
-static void run_file(const char* path) {
-    char* source = read_file(path);
-    InterpretResult result = interpret(source);
-    free(source);
+static void run_file(VM* vm, const char* path) {
+    Source source = read_file(path);
+    InterpretResult result = interpret(vm, source.bytes, source.length);
+    free_source(&source);
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result != INTERPRET_OK) exit(exit_code(result));
 }
 
-static char* read_file(const char* path) {
-    // open file in read mode ('b' is redundant but best practice)
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
+// compiled and run as it's read instead of loaded whole first
+static void run_stream(VM* vm, const char* path) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
 
-    // seek to end of stream to find
-    // number of bytes to allocate
-    fseek(file, 0L, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
+    InterpretResult result = interpret_stream(vm, fd);
+    if (fd != STDIN_FILENO) close(fd);
 
-    // allocate buffer and write
-    char* buffer = (char*)malloc(file_size + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+    if (result != INTERPRET_OK) exit(exit_code(result));
+}
+
+// runs path then saves the heap it leaves, for --restore
+static void snapshot_file(VM* vm, const char* path, const char* snapshot_path) {
+    Source source = read_file(path);
+    Chunk chunk;
+    init_chunk(&chunk);
+    chunk.backend = vm->backend;
+
+    bool compiled = compile(vm, source.bytes, source.length, &chunk);
+    free_source(&source);
+    if (!compiled) exit(65);
+    InterpretResult result = run_chunk(vm, &chunk);
+    if (result != INTERPRET_OK) exit(exit_code(result));
+
+    bool written = write_snapshot(vm, &chunk, snapshot_path);
+    free_chunk(&chunk);
+    if (!written) exit(74);
+}
+
+static double elapsed_ms(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// settings copied into each worker's VM, pool jobs
+// start with one so they can share the worker callbacks
+typedef struct {
+    Backend backend;
+    bool optimize;
+    bool print_passes;
+    Limits limits;
+    int gc_threads;
+} WorkerSettings;
+
+typedef struct {
+    WorkerSettings settings;
+    char** paths;
+    int count;
+    atomic_int failures;
+} CompileJob;
+
+// each worker gets its own VM so threads never
+// share a heap or intern table
+static void* start_worker(void* context) {
+    WorkerSettings* settings = (WorkerSettings*)context;
+    VM* vm = ALLOCATE(VM, 1);
+    init_VM(vm);
+    vm->backend = settings->backend;
+    vm->optimize = settings->optimize;
+    vm->print_passes = settings->print_passes;
+    vm->limits = settings->limits;
+    vm->gc_threads = settings->gc_threads;
+    define_file_natives(vm);
+    return vm;
+}
+
+static void stop_worker(void* context, void* worker) {
+    VM* vm = (VM*)worker;
+    free_VM(vm);
+    FREE(VM, vm);
+}
+
+static void compile_task(void* context, void* worker, int task) {
+    CompileJob* job = (CompileJob*)context;
+    VM* vm = (VM*)worker;
+
+    // read_file() would exit from under the other workers, a file
+    // that can't be read is just another failure
+    Source source;
+    if (!load_source(job->paths[task], &source, stderr)) {
+        atomic_fetch_add(&job->failures, 1);
+        return;
     }
+    Chunk chunk;
+    init_chunk(&chunk);
+    chunk.backend = vm->backend;
 
-    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
-    if (bytes_read < file_size) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
+    if (!compile(vm, source.bytes, source.length, &chunk)) {
+        fprintf(stderr, "in %s\n", job->paths[task]);
+        atomic_fetch_add(&job->failures, 1);
+    }
+
+    free_chunk(&chunk);
+    free_source(&source);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// every .lox file directly in dir, or path itself if it isn't one
+static char** list_scripts(const char* path, int* count) {
+    int capacity = 0;
+    char** paths = NULL;
+    *count = 0;
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        paths = ALLOCATE(char*, 1);
+        paths[0] = strdup(path);
+        *count = 1;
+        return paths;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length < 4 || strcmp(entry->d_name + length - 4, ".lox") != 0) continue;
+
+        if (capacity < *count + 1) {
+            int old_capacity = capacity;
+            capacity = GROW_CAPACITY(old_capacity);
+            paths = GROW_ARRAY(char*, paths, old_capacity, capacity);
+        }
+
+        char* script = ALLOCATE(char, strlen(path) + length + 2);
+        sprintf(script, "%s/%s", path, entry->d_name);
+        paths[(*count)++] = script;
+    }
+    closedir(dir);
+
+    // keep error output in a stable order
+    qsort(paths, *count, sizeof(char*), compare_paths);
+    return paths;
+}
+
+static void compile_only(VM* vm, const char* path, int workers) {
+    CompileJob job;
+    job.paths = list_scripts(path, &job.count);
+    atomic_init(&job.failures, 0);
+    job.settings.backend = vm->backend;
+    job.settings.optimize = vm->optimize;
+    job.settings.print_passes = vm->print_passes;
+    job.settings.print_passes = vm->print_passes;
+    job.settings.limits = vm->limits;
+    job.settings.gc_threads = vm->gc_threads;
+
+    PoolJob pool_job = { start_worker, compile_task, stop_worker, &job };
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_pool(&pool_job, job.count, workers);
+    double elapsed = elapsed_ms(&start);
+    int failures = atomic_load(&job.failures);
+    fprintf(stderr, "compiled %d scripts, %d failed, in %.1f ms on %d threads\n",
+        job.count, failures, elapsed, workers < job.count ? workers : job.count);
+
+    for (int i = 0; i < job.count; i++) free(job.paths[i]);
+    FREE_ARRAY(char*, job.paths, job.count);
+
+    if (failures > 0) exit(65);
+}
+
+typedef struct {
+    char* path;
+    int code;
+    double elapsed;
+
+    // captured so scripts running at once don't interleave
+    char* output;
+    size_t output_size;
+} BatchScript;
+
+typedef struct {
+    WorkerSettings settings;
+    BatchScript* scripts;
+    int count;
+} BatchJob;
+
+static void batch_task(void* context, void* worker, int task) {
+    BatchJob* job = (BatchJob*)context;
+    VM* vm = (VM*)worker;
+    BatchScript* script = &job->scripts[task];
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    FILE* out = open_memstream(&script->output, &script->output_size);
+    set_output(vm, out);
+    vm->err = out;
+
+    Source source;
+    if (!load_source(script->path, &source, out)) {
+        script->code = 74;
+    } else {
+        script->code = exit_code(interpret(vm, source.bytes, source.length));
+        free_source(&source);
     }
-    buffer[bytes_read] = '\0';
 
-    fclose(file);
-    return buffer;
-}
\ No newline at end of file
+    // the next script on this worker starts with only the natives
+    reset_globals(vm);
+
+    set_output(vm, stdout);
+    vm->err = stderr;
+    fclose(out);
+
+    script->elapsed = elapsed_ms(&start);
+}
+
+static void add_script(BatchJob* job, int* capacity, const char* path, size_t length) {
+    if (*capacity < job->count + 1) {
+        int old_capacity = *capacity;
+        *capacity = GROW_CAPACITY(old_capacity);
+        job->scripts = GROW_ARRAY(BatchScript, job->scripts, old_capacity, *capacity);
+    }
+
+    BatchScript* script = &job->scripts[job->count++];
+    script->path = strndup(path, length);
+    script->output = NULL;
+    script->output_size = 0;
+}
+
+// paths starting with @ name a manifest of scripts, one per line
+static void add_scripts(BatchJob* job, int* capacity, const char* path) {
+    if (path[0] != '@') {
+        add_script(job, capacity, path, strlen(path));
+        return;
+    }
+
+    Source manifest = read_file(path + 1);
+    const char* end = manifest.bytes + manifest.length;
+    for (const char* line = manifest.bytes; line < end;) {
+        const char* line_end = line;
+        while (line_end < end && *line_end != '\n' && *line_end != '\r') line_end++;
+        if (line_end > line) add_script(job, capacity, line, line_end - line);
+        line = line_end + 1;
+    }
+    free_source(&manifest);
+}
+
+static int run_batch(VM* vm, const char** paths, int count, int workers) {
+    BatchJob job;
+    job.settings.backend = vm->backend;
+    job.settings.optimize = vm->optimize;
+    job.settings.limits = vm->limits;
+    job.settings.gc_threads = vm->gc_threads;
+    job.scripts = NULL;
+    job.count = 0;
+
+    int capacity = 0;
+    for (int i = 0; i < count; i++) add_scripts(&job, &capacity, paths[i]);
+
+    PoolJob pool_job = { start_worker, batch_task, stop_worker, &job };
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_pool(&pool_job, job.count, workers);
+    double elapsed = elapsed_ms(&start);
+
+    // output and timings in the order scripts were given
+    int code = 0;
+    int failures = 0;
+    for (int i = 0; i < job.count; i++) {
+        BatchScript* script = &job.scripts[i];
+        fwrite(script->output, 1, script->output_size, stdout);
+        fprintf(stderr, "%s: exit %d in %.3f ms\n", script->path, script->code, script->elapsed);
+
+        if (script->code > code) code = script->code;
+        if (script->code != 0) failures++;
+        free(script->output);
+        free(script->path);
+    }
+
+    fprintf(stderr, "ran %d scripts, %d failed, in %.1f ms on %d threads\n",
+        job.count, failures, elapsed, workers < job.count ? workers : job.count);
+
+    FREE_ARRAY(BatchScript, job.scripts, capacity);
+    return code;
+}
+
+static Source read_file(const char* path) {
+    Source source;
+    if (!load_source(path, &source, stderr)) exit(74);
+    return source;
+}
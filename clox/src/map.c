@@ -0,0 +1,33 @@
+#include "map.h"
+#include "memory.h"
+#include "table.h"
+
+bool valid_key(Value key) {
+    // nil marks empty slots and NaN never equals itself
+    if (IS_NIL(key)) return false;
+    return !IS_NUMBER(key) || AS_NUMBER(key) == AS_NUMBER(key);
+}
+
+bool map_get(ObjMap* map, Value key, Value* value) {
+    return table_get_value(&map->table, key, value);
+}
+
+void map_set(VM* vm, ObjMap* map, Value key, Value value) {
+    int capacity = map->table.capacity;
+    if (table_set_value(&map->table, key, value)) map->count++;
+    write_barrier(vm, (Obj*)map, key);
+    write_barrier(vm, (Obj*)map, value);
+    track_allocation(vm, sizeof(Entry) * (map->table.capacity - capacity));
+}
+
+void map_reserve(VM* vm, ObjMap* map, int count) {
+    int capacity = map->table.capacity;
+    table_reserve(&map->table, count);
+    track_allocation(vm, sizeof(Entry) * (map->table.capacity - capacity));
+}
+
+bool map_delete(ObjMap* map, Value key) {
+    if (!table_delete_value(&map->table, key)) return false;
+    map->count--;
+    return true;
+}
@@ -0,0 +1,15 @@
+#ifndef clox_map_h
+#define clox_map_h
+
+#include "common.h"
+#include "object.h"
+
+// false when key isn't one a map can hold
+bool valid_key(Value key);
+bool map_get(ObjMap* map, Value key, Value* value);
+void map_set(VM* vm, ObjMap* map, Value key, Value value);
+// room for count entries without growing
+void map_reserve(VM* vm, ObjMap* map, int count);
+bool map_delete(ObjMap* map, Value key);
+
+#endif
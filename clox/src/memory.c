@@ -1,9 +1,26 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "memory.h"
 #include "object.h"
+#include "pool.h"
+#include "table.h"
 #include "vm.h"
 
+// fraction of the time between collections they should take at most
+#define GC_TIME_TARGET 0.1
+#define GC_STRETCH_MAX 16
+// heap a collection marks, or garbage it frees, before it's worth
+// starting threads for. below it they take longer to start
+#define GC_PARALLEL_MIN (4 * 1024 * 1024)
+// gray objects a marker keeps back before it shares any
+#define GRAY_SHARE_MIN 64
+
 void* reallocate(void* pointer, size_t old_size, size_t new_size) {
     // if old size is 0 then free allocation
     if (new_size == 0) {
@@ -17,6 +34,32 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size) {
     return result;
 }
 
+void keep_chunk(VM* vm, Chunk* chunk) {
+    if (vm->kept_capacity < vm->kept_count + 1) {
+        vm->kept_capacity = GROW_CAPACITY(vm->kept_capacity);
+        vm->kept_chunks = realloc(vm->kept_chunks, sizeof(Chunk*) * vm->kept_capacity);
+        if (vm->kept_chunks == NULL) exit(1);
+    }
+    vm->kept_chunks[vm->kept_count++] = chunk;
+}
+
+void release_chunk(VM* vm, Chunk* chunk) {
+    for (int i = 0; i < vm->kept_count; i++) {
+        if (vm->kept_chunks[i] != chunk) continue;
+        vm->kept_chunks[i] = vm->kept_chunks[--vm->kept_count];
+        return;
+    }
+}
+
+void push_object(ObjStack* stack, Obj* object) {
+    if (stack->capacity < stack->count + 1) {
+        stack->capacity = GROW_CAPACITY(stack->capacity);
+        stack->objects = realloc(stack->objects, sizeof(Obj*) * stack->capacity);
+        if (stack->objects == NULL) exit(1);
+    }
+    stack->objects[stack->count++] = object;
+}
+
 void free_object(Obj* object) {
     switch (object->type) {
         case OBJ_STRING: {
@@ -25,14 +68,654 @@ void free_object(Obj* object) {
             FREE(ObjString, object);
             break;
         }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (array->packed) {
+                FREE_ARRAY(double, array->as.numbers, array->capacity);
+            } else {
+                FREE_ARRAY(Value, array->as.values, array->capacity);
+            }
+            FREE(ObjArray, object);
+            break;
+        }
+        case OBJ_MAP:
+            free_table(&((ObjMap*)object)->table);
+            FREE(ObjMap, object);
+            break;
+        case OBJ_NATIVE:
+            FREE(ObjNative, object);
+            break;
+        case OBJ_SHAPE:
+            free_table(&((ObjShape*)object)->transitions);
+            FREE(ObjShape, object);
+            break;
+        case OBJ_CLASS:
+            FREE(ObjClass, object);
+            break;
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            FREE_ARRAY(Value, instance->fields, instance->capacity);
+            FREE(ObjInstance, object);
+            break;
+        }
+        case OBJ_FUNCTION:
+            free_chunk(&((ObjFunction*)object)->chunk);
+            FREE(ObjFunction, object);
+            break;
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            reallocate(object, sizeof(ObjClosure) + sizeof(Value) * closure->upvalue_count, 0);
+            break;
+        }
+        case OBJ_UPVALUE:
+            FREE(ObjUpvalue, object);
+            break;
+        case OBJ_FIBER:
+            free_fiber_stack((ObjFiber*)object);
+            FREE(ObjFiber, object);
+            break;
     }
 }
 
-void free_objects() {
-    Obj* object = vm.objects;
+void free_objects(VM* vm) {
+    finish_sweep(vm);
+    Obj* object = vm->objects;
     while (object != NULL) {
         Obj* next = object->next;
         free_object(object);
         object = next;
     }
 }
+
+void track_allocation(VM* vm, size_t bytes) {
+    vm->bytes_allocated += bytes;
+    // collections wait for the next safepoint, where nothing
+    // live is held anywhere the collector can't see
+    if (vm->running && vm->bytes_allocated > vm->next_gc) request_safepoint(vm);
+}
+
+static bool fits(VM* vm, size_t bytes, size_t limit) {
+    return bytes <= limit && vm->bytes_allocated <= limit - bytes;
+}
+
+bool heap_room(VM* vm, size_t bytes) {
+    size_t limit = vm->limits.heap != 0 ? vm->limits.heap : vm->memory;
+    if (fits(vm, bytes, limit)) return true;
+    collect_garbage(vm);
+    return fits(vm, bytes, limit);
+}
+
+// what an object holds, the same as it was charged with give or
+// take what it's grown by since
+static size_t object_size(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:
+            return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            return sizeof(ObjArray) + array->capacity * (array->packed ? sizeof(double) : sizeof(Value));
+        }
+        case OBJ_MAP:
+            return sizeof(ObjMap) + sizeof(Entry) * ((ObjMap*)object)->table.capacity;
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
+        case OBJ_SHAPE:
+            return sizeof(ObjShape) + sizeof(Entry) * ((ObjShape*)object)->transitions.capacity;
+        case OBJ_CLASS:
+            return sizeof(ObjClass);
+        case OBJ_INSTANCE:
+            return sizeof(ObjInstance) + sizeof(Value) * ((ObjInstance*)object)->capacity;
+        case OBJ_FUNCTION: {
+            Chunk* chunk = &((ObjFunction*)object)->chunk;
+            return sizeof(ObjFunction) + chunk->capacity * (1 + sizeof(int))
+                + sizeof(Value) * chunk->constants.capacity;
+        }
+        case OBJ_CLOSURE:
+            return sizeof(ObjClosure) + sizeof(Value) * ((ObjClosure*)object)->upvalue_count;
+        case OBJ_UPVALUE:
+            return sizeof(ObjUpvalue);
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            return sizeof(ObjFiber) + sizeof(Value) * fiber->stack_capacity
+                + sizeof(CallFrame) * fiber->frame_capacity;
+        }
+    }
+    return 0;
+}
+
+// one marking thread's part of a collection. its gray stack is
+// its own, what it moves to shared any other marker can take
+typedef struct {
+    ObjStack gray;
+    // bytes of the objects it marked
+    size_t live;
+    pthread_mutex_t lock;
+    ObjStack shared;
+    // shared's count, to look at without the lock
+    atomic_int available;
+} Marker;
+
+typedef struct {
+    Marker* markers;
+    int count;
+    // markers holding objects to trace, marking is over at none
+    atomic_int busy;
+} Marking;
+
+static void mark_object(Marker* marker, Obj* object) {
+    // young strings are left for collect_young() to sort out
+    if (object == NULL || object->permanent || object->young) return;
+    // most objects reached are marked already, so look before
+    // paying for the exchange that settles which marker has it
+    if (atomic_load_explicit(&object->marked, memory_order_relaxed)
+            || atomic_exchange_explicit(&object->marked, true, memory_order_relaxed)) {
+        return;
+    }
+    marker->live += object_size(object);
+    // nothing to trace from a string
+    if (object->type == OBJ_STRING) return;
+    push_object(&marker->gray, object);
+}
+
+static void mark_value(Marker* marker, Value value) {
+    if (IS_OBJ(value)) mark_object(marker, AS_OBJ(value));
+}
+
+static void mark_values(Marker* marker, Value* values, int count) {
+    for (int i = 0; i < count; i++) mark_value(marker, values[i]);
+}
+
+static void mark_table(Marker* marker, Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        mark_value(marker, table->entries[i].key);
+        mark_value(marker, table->entries[i].value);
+    }
+}
+
+// constants, and the shapes property accesses have cached, which
+// nothing else might hold
+static void mark_chunk(Marker* marker, Chunk* chunk) {
+    mark_values(marker, chunk->constants.values, chunk->constants.count);
+    for (int i = 0; i < chunk->cache_count; i++) {
+        for (int j = 0; j < CACHE_WAYS; j++) {
+            mark_object(marker, (Obj*)chunk->caches[i].entries[j].shape);
+            mark_object(marker, (Obj*)chunk->caches[i].entries[j].next);
+        }
+    }
+}
+
+static void mark_fiber(Marker* marker, ObjFiber* fiber) {
+    mark_value(marker, fiber->function);
+    mark_value(marker, fiber->value);
+    mark_object(marker, (Obj*)fiber->caller);
+    if (fiber->stack != NULL) mark_values(marker, fiber->stack, (int)(fiber->stack_top - fiber->stack));
+    for (int i = 0; i < fiber->frame_count; i++) {
+        // a top level script's chunk isn't held by any object
+        CallFrame* frame = &fiber->frames[i];
+        if (frame->function == NULL) {
+            mark_chunk(marker, frame->chunk);
+        } else {
+            mark_object(marker, (Obj*)frame->function);
+        }
+    }
+    for (ObjUpvalue* upvalue = fiber->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+        mark_object(marker, (Obj*)upvalue);
+    }
+}
+
+static void blacken_object(Marker* marker, Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:
+            break;
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (!array->packed) mark_values(marker, array->as.values, array->count);
+            break;
+        }
+        case OBJ_MAP:
+            mark_table(marker, &((ObjMap*)object)->table);
+            break;
+        case OBJ_NATIVE:
+            mark_object(marker, (Obj*)((ObjNative*)object)->name);
+            break;
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            mark_object(marker, (Obj*)shape->parent);
+            mark_object(marker, (Obj*)shape->name);
+            mark_table(marker, &shape->transitions);
+            break;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            mark_object(marker, (Obj*)klass->name);
+            mark_object(marker, (Obj*)klass->root);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            mark_object(marker, (Obj*)instance->klass);
+            mark_object(marker, (Obj*)instance->shape);
+            mark_values(marker, instance->fields, instance->shape->count);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            mark_object(marker, (Obj*)function->name);
+            mark_chunk(marker, &function->chunk);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            mark_object(marker, (Obj*)closure->function);
+            mark_values(marker, closure->upvalues, closure->upvalue_count);
+            break;
+        }
+        case OBJ_UPVALUE: {
+            // an open one keeps the stack it points into alive
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            mark_value(marker, upvalue->closed);
+            if (upvalue->location != &upvalue->closed) mark_object(marker, (Obj*)upvalue->fiber);
+            break;
+        }
+        case OBJ_FIBER:
+            mark_fiber(marker, (ObjFiber*)object);
+            break;
+    }
+}
+
+static void mark_roots(VM* vm, Marker* marker) {
+    // the running fiber's own fields are only brought up to
+    // date when it switches away
+    ObjFiber* running = vm->fiber;
+    running->stack_top = vm->stack_top;
+    running->frame_count = vm->frame_count;
+    running->open_upvalues = vm->open_upvalues;
+
+    mark_fiber(marker, &vm->root);
+    mark_object(marker, (Obj*)vm->fiber);
+    mark_object(marker, (Obj*)vm->switch_to);
+    Scheduler* scheduler = &vm->scheduler;
+    for (ObjFiber* fiber = scheduler->head; fiber != NULL; fiber = fiber->next_queued) {
+        mark_object(marker, (Obj*)fiber);
+    }
+    for (int i = 0; i < scheduler->waiting_count; i++) {
+        mark_object(marker, (Obj*)scheduler->waiting[i]);
+    }
+
+    mark_table(marker, &vm->globals);
+    for (int i = 0; i < vm->kept_count; i++) mark_chunk(marker, vm->kept_chunks[i]);
+}
+
+static void trace_references(Marker* marker) {
+    while (marker->gray.count > 0) blacken_object(marker, marker->gray.objects[--marker->gray.count]);
+}
+
+// the top half of from, onto to
+static void move_half(ObjStack* from, ObjStack* to) {
+    int moving = (from->count + 1) / 2;
+    for (int i = 0; i < moving; i++) push_object(to, from->objects[--from->count]);
+}
+
+static void share(Marker* marker) {
+    pthread_mutex_lock(&marker->lock);
+    move_half(&marker->gray, &marker->shared);
+    atomic_store(&marker->available, marker->shared.count);
+    pthread_mutex_unlock(&marker->lock);
+}
+
+// all of what the thief shared itself if there's any, otherwise
+// half of what the next marker along with some shared
+static bool steal(Marking* marking, int thief) {
+    Marker* into = &marking->markers[thief];
+    for (int i = 0; i < marking->count; i++) {
+        Marker* victim = &marking->markers[(thief + i) % marking->count];
+        if (atomic_load(&victim->available) == 0) continue;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim == into) {
+            while (victim->shared.count > 0) push_object(&into->gray, victim->shared.objects[--victim->shared.count]);
+        } else {
+            move_half(&victim->shared, &into->gray);
+        }
+        atomic_store(&victim->available, victim->shared.count);
+        pthread_mutex_unlock(&victim->lock);
+        if (into->gray.count > 0) return true;
+    }
+    return false;
+}
+
+static bool anything_shared(Marking* marking) {
+    for (int i = 0; i < marking->count; i++) {
+        if (atomic_load(&marking->markers[i].available) > 0) return true;
+    }
+    return false;
+}
+
+// a marker traces from its own stack, keeping part of it shared
+// while it's big enough to split. out of work, it's busy again
+// before it steals, so busy can only reach zero once every gray
+// object everywhere has been traced
+static void mark_in_parallel(void* context, void* worker, int task) {
+    Marking* marking = (Marking*)context;
+    Marker* marker = &marking->markers[task];
+    atomic_fetch_add(&marking->busy, 1);
+    for (;;) {
+        while (marker->gray.count > 0) {
+            blacken_object(marker, marker->gray.objects[--marker->gray.count]);
+            if (marker->gray.count >= GRAY_SHARE_MIN
+                    && atomic_load_explicit(&marker->available, memory_order_relaxed) == 0) {
+                share(marker);
+            }
+        }
+
+        atomic_fetch_sub(&marking->busy, 1);
+        for (;;) {
+            if (anything_shared(marking)) {
+                atomic_fetch_add(&marking->busy, 1);
+                if (steal(marking, task)) break;
+                atomic_fetch_sub(&marking->busy, 1);
+            }
+            if (atomic_load(&marking->busy) == 0) return;
+            sched_yield();
+        }
+    }
+}
+
+static void init_marker(Marker* marker) {
+    marker->gray.count = 0;
+    marker->gray.capacity = 0;
+    marker->gray.objects = NULL;
+    marker->live = 0;
+    pthread_mutex_init(&marker->lock, NULL);
+    marker->shared = marker->gray;
+    atomic_init(&marker->available, 0);
+}
+
+// the roots are marked here, then traced from on this thread or,
+// for a heap big enough to make starting threads worth it, on
+// gc_threads of them. returns the bytes reached
+static size_t mark(VM* vm, size_t heap) {
+    Marker first;
+    first.gray = vm->gray;
+    first.live = 0;
+    mark_roots(vm, &first);
+
+    int count = vm->gc_threads;
+    if (count <= 1 || heap < GC_PARALLEL_MIN) {
+        trace_references(&first);
+        vm->gray = first.gray;
+        return first.live;
+    }
+
+    Marking marking;
+    marking.count = count;
+    marking.markers = ALLOCATE(Marker, count);
+    for (int i = 0; i < count; i++) init_marker(&marking.markers[i]);
+    atomic_init(&marking.busy, 0);
+    // the roots are shared, for whichever thread starts first
+    marking.markers[0].shared = first.gray;
+    marking.markers[0].live = first.live;
+    atomic_store(&marking.markers[0].available, first.gray.count);
+
+    PoolJob job = { NULL, mark_in_parallel, NULL, &marking };
+    run_pool(&job, count, count);
+
+    size_t live = 0;
+    for (int i = 0; i < count; i++) {
+        Marker* marker = &marking.markers[i];
+        live += marker->live;
+        free(marker->gray.objects);
+        if (i > 0) free(marker->shared.objects);
+        pthread_mutex_destroy(&marker->lock);
+    }
+    vm->gray = marking.markers[0].shared;
+    FREE_ARRAY(Marker, marking.markers, count);
+    return live;
+}
+
+// frees what wasn't marked from the list at objects and clears
+// the marks on the rest, leaving last at the final one kept
+static void sweep_objects(Obj** objects, Obj** last) {
+    *last = NULL;
+    Obj** link = objects;
+    while (*link != NULL) {
+        Obj* object = *link;
+        if (atomic_load_explicit(&object->marked, memory_order_relaxed)) {
+            atomic_store_explicit(&object->marked, false, memory_order_relaxed);
+            *last = object;
+            link = &object->next;
+        } else {
+            *link = object->next;
+            free_object(object);
+        }
+    }
+}
+
+static void* sweep_in_background(void* argument) {
+    VM* vm = (VM*)argument;
+    double start = monotonic_seconds();
+    sweep_objects(&vm->swept, &vm->swept_last);
+    vm->sweep_seconds = monotonic_seconds() - start;
+    return NULL;
+}
+
+void finish_sweep(VM* vm) {
+    if (!vm->sweeping) return;
+    pthread_join(vm->sweeper, NULL);
+    vm->sweeping = false;
+    vm->gc_stats.background_seconds += vm->sweep_seconds;
+
+    // what it kept goes behind whatever was made since
+    if (vm->swept != NULL) {
+        vm->swept_last->next = vm->objects;
+        vm->objects = vm->swept;
+        vm->swept = NULL;
+    }
+}
+
+// with enough to free to be worth a thread, the script carries
+// on while it's freed and what it makes meanwhile starts a new
+// list. nothing but the sweeper touches the old one until
+// finish_sweep() joins them back up
+static void sweep(VM* vm, size_t dead) {
+    if (vm->gc_threads > 1 && dead >= GC_PARALLEL_MIN) {
+        vm->swept = vm->objects;
+        vm->objects = NULL;
+        if (pthread_create(&vm->sweeper, NULL, sweep_in_background, vm) == 0) {
+            vm->sweeping = true;
+            return;
+        }
+        vm->objects = vm->swept;
+        vm->swept = NULL;
+    }
+
+    Obj* last;
+    sweep_objects(&vm->objects, &last);
+}
+
+// the headroom before the next collection is a multiple of the
+// live heap that grows with the share of it that survived: when
+// most did, collecting again soon would find little. the multiple
+// is stretched while collections take more than GC_TIME_TARGET of
+// the time between them, which is what allocating fast looks like
+static void pace(VM* vm, size_t before, double start, double end) {
+    double mutator = start - vm->gc_end;
+    if (end - start > GC_TIME_TARGET * mutator) {
+        if (vm->gc_stretch < GC_STRETCH_MAX) vm->gc_stretch *= 2;
+    } else if (end - start < GC_TIME_TARGET / 4 * mutator && vm->gc_stretch > 1) {
+        vm->gc_stretch /= 2;
+    }
+
+    size_t live = vm->bytes_allocated;
+    double survived = before == 0 ? 1 : (double)live / before;
+    double headroom = live * (0.5 + 1.5 * survived) * vm->gc_stretch;
+    if (headroom < GC_HEAP_MIN) headroom = GC_HEAP_MIN;
+    vm->next_gc = live + (size_t)headroom;
+
+    // collect on the way up to the limit rather than past it
+    if (vm->limits.heap != 0 && vm->next_gc > vm->limits.heap) vm->next_gc = vm->limits.heap;
+    vm->gc_end = end;
+}
+
+static void count_pause(GcPauses* pauses, double seconds) {
+    pauses->count++;
+    pauses->seconds += seconds;
+    if (seconds > pauses->longest) pauses->longest = seconds;
+
+    int bucket = 0;
+    double bound = 2e-6;
+    while (seconds >= bound && bucket < GC_PAUSE_BUCKETS - 1) {
+        bucket++;
+        bound *= 2;
+    }
+    pauses->histogram[bucket]++;
+}
+
+// what's about to be swept can't stay remembered
+static void forget_unmarked(Nursery* nursery) {
+    int kept = 0;
+    for (int i = 0; i < nursery->remembered.count; i++) {
+        Obj* object = nursery->remembered.objects[i];
+        if (object->permanent || atomic_load_explicit(&object->marked, memory_order_relaxed)) {
+            nursery->remembered.objects[kept++] = object;
+        }
+    }
+    nursery->remembered.count = kept;
+}
+
+void collect_garbage(VM* vm) {
+    double start = monotonic_seconds();
+    size_t before = vm->bytes_allocated;
+
+    // the last sweep has to be done before anything's marked again
+    finish_sweep(vm);
+    size_t live = mark(vm, before);
+    // interned strings nothing else holds go with the rest
+    table_remove_white(&vm->strings);
+    forget_unmarked(&vm->nursery);
+    vm->bytes_allocated = live;
+    sweep(vm, before > live ? before - live : 0);
+
+    double end = monotonic_seconds();
+    pace(vm, before, start, end);
+    count_pause(&vm->gc_stats.full, end - start);
+}
+
+void remember_object(VM* vm, Obj* object) {
+    object->remembered = true;
+    push_object(&vm->nursery.remembered, object);
+}
+
+void remember_globals(VM* vm) {
+    vm->nursery.globals_remembered = true;
+}
+
+static void forward_value(VM* vm, Value* slot) {
+    if (IS_OBJ(*slot) && AS_OBJ(*slot)->young) *slot = OBJ_VAL(promote_string(vm, AS_STRING(*slot)));
+}
+
+static void forward_values(VM* vm, Value* values, int count) {
+    for (int i = 0; i < count; i++) forward_value(vm, &values[i]);
+}
+
+// keys keep their place, a promoted string hashes the same
+static void forward_table(VM* vm, Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        forward_value(vm, &table->entries[i].key);
+        forward_value(vm, &table->entries[i].value);
+    }
+}
+
+// everywhere an old object can hold a string
+static void forward_object(VM* vm, Obj* object) {
+    switch (object->type) {
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (!array->packed) forward_values(vm, array->as.values, array->count);
+            break;
+        }
+        case OBJ_MAP:
+            forward_table(vm, &((ObjMap*)object)->table);
+            break;
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            forward_values(vm, instance->fields, instance->shape->count);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            forward_values(vm, closure->upvalues, closure->upvalue_count);
+            break;
+        }
+        case OBJ_UPVALUE:
+            forward_value(vm, &((ObjUpvalue*)object)->closed);
+            break;
+        case OBJ_FIBER: {
+            ObjFiber* fiber = (ObjFiber*)object;
+            forward_value(vm, &fiber->value);
+            if (fiber->stack != NULL) forward_values(vm, fiber->stack, (int)(fiber->stack_top - fiber->stack));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// strings are leaves, so there's no tracing: everything that can
+// hold a young one is the running stack, the remembered objects
+// and maybe the globals. whatever they hold is promoted and they're
+// pointed at the copy. a walk over the nursery then moves interned
+// survivors to their copies and drops the rest
+void collect_young(VM* vm) {
+    Nursery* nursery = &vm->nursery;
+    if (nursery->top == nursery->start && nursery->remembered.count == 0) return;
+    double start = monotonic_seconds();
+
+    // a suspended fiber's stack is remembered when it switches
+    // away, the running one's is brought up to date here
+    vm->fiber->stack_top = vm->stack_top;
+    forward_values(vm, vm->stack, (int)(vm->stack_top - vm->stack));
+    if (nursery->globals_remembered) forward_table(vm, &vm->globals);
+    for (int i = 0; i < nursery->remembered.count; i++) {
+        Obj* object = nursery->remembered.objects[i];
+        forward_object(vm, object);
+        object->remembered = false;
+    }
+    nursery->remembered.count = 0;
+    nursery->globals_remembered = false;
+
+    char* young = nursery->start;
+    while (young < nursery->top) {
+        ObjString* string = (ObjString*)young;
+        table_move_string(&vm->strings, string, (ObjString*)string->obj.next);
+        young += YOUNG_STRING_SIZE(string->length);
+    }
+    nursery->top = nursery->start;
+
+    count_pause(&vm->gc_stats.young, monotonic_seconds() - start);
+}
+
+static void print_pauses(FILE* file, const char* kind, GcPauses* pauses) {
+    if (pauses->count == 0) return;
+    fprintf(file, "%d %s collections, %.3f ms paused, longest %.3f ms\n", pauses->count, kind,
+        pauses->seconds * 1e3, pauses->longest * 1e3);
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (pauses->histogram[i] == 0) continue;
+        if (i == 0) {
+            fprintf(file, "  %12s us %8d\n", "under 2", pauses->histogram[i]);
+        } else if (i == GC_PAUSE_BUCKETS - 1) {
+            fprintf(file, "  %9ld and up %8d\n", 1L << i, pauses->histogram[i]);
+        } else {
+            fprintf(file, "  %6ld-%-6ld us %8d\n", 1L << i, 1L << (i + 1), pauses->histogram[i]);
+        }
+    }
+}
+
+void print_gc_stats(VM* vm, FILE* file) {
+    finish_sweep(vm);
+    GcStats* stats = &vm->gc_stats;
+    print_pauses(file, "full", &stats->full);
+    print_pauses(file, "young", &stats->young);
+    fprintf(file, "%.3f ms swept in the background, %.1f KB promoted from the nursery\n",
+        stats->background_seconds * 1e3, stats->promoted / 1024.0);
+}
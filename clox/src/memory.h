@@ -1,25 +1,79 @@
 #ifndef clox_memory_h
 #define clox_memory_h
 
+#include <stdio.h>
+
 #include "common.h"
 #include "object.h"
 
 #define ALLOCATE(type, count) \
-    (type*)reallocate(NULL, 0, sizeof(type) * count)
+    (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+// heap size the first collection waits for, and the least
+// headroom any later one leaves
+#define GC_HEAP_MIN (1024 * 1024)
+// the nursery, collected once it's half full at a safepoint
+#define NURSERY_SIZE (256 * 1024)
+// or once this many objects point into it, since each of them
+// is walked over again
+#define REMEMBERED_MAX 4096
+// a young string with its chars after it, 8 byte aligned
+#define YOUNG_STRING_SIZE(length) ((sizeof(ObjString) + (length) + 1 + 7) & ~(size_t)7)
+
 #define GROW_CAPACITY(capacity) \
-    capacity < 8 ? 8 : capacity * 2
+    ((capacity) < 8 ? 8 : (capacity) * 2)
 
 #define GROW_ARRAY(type, pointer, old_count, new_count) \
-    (type*)reallocate(pointer, sizeof(type)*  old_count, sizeof(type)*  new_count)
+    (type*)reallocate(pointer, sizeof(type) * (old_count), sizeof(type) * (new_count))
 
 #define FREE_ARRAY(type, pointer, old_count) \
-    reallocate(pointer, sizeof(type)*  old_count, 0)
+    reallocate(pointer, sizeof(type) * (old_count), 0)
 
 void* reallocate(void* pointer, size_t old_size, size_t new_size);
+// a chunk's constants are only reachable while it runs. one that's
+// run again later, after other chunks have, is kept between runs
+// until it's released, before it's freed
+void keep_chunk(VM* vm, Chunk* chunk);
+void release_chunk(VM* vm, Chunk* chunk);
+void push_object(ObjStack* stack, Obj* object);
 void free_object(Obj* object);
-void free_objects();
+void free_objects(VM* vm);
+
+// bytes a heap object was made with or grew by, which counts
+// toward the next collection and the vm's heap limit
+void track_allocation(VM* vm, size_t bytes);
+// whether bytes more fit under the heap limit, or in the machine's
+// memory without one, collecting first if they wouldn't. only for
+// where everything live is reachable from the vm, before whatever
+// the bytes are for is made
+bool heap_room(VM* vm, size_t bytes);
+// mark and sweep, from the running fibers and their chunks,
+// globals and kept chunks. with gc_threads above 1, big
+// heaps are marked in parallel and swept in the background
+void collect_garbage(VM* vm);
+// waits for a background sweep, anything walking vm->objects
+// outside a collection has to first
+void finish_sweep(VM* vm);
+// copies the young strings something can still reach out of the
+// nursery and empties it. only where nothing holds an object the
+// vm can't see: at a safepoint, or once a run's over
+void collect_young(VM* vm);
+void remember_object(VM* vm, Obj* object);
+void remember_globals(VM* vm);
+
+// stores of a value into an old object, or a global, have to go
+// through these so a young string they hold is found and moved
+static inline void write_barrier(VM* vm, Obj* object, Value value) {
+    if (IS_OBJ(value) && AS_OBJ(value)->young && !object->remembered) remember_object(vm, object);
+}
+
+static inline void globals_barrier(VM* vm, Value value) {
+    if (IS_OBJ(value) && AS_OBJ(value)->young) remember_globals(vm);
+}
+
+// collections and their pauses so far, with a histogram of how long
+void print_gc_stats(VM* vm, FILE* file);
 
 #endif
\ No newline at end of file
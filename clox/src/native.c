@@ -0,0 +1,415 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "array.h"
+#include "fiber.h"
+#include "map.h"
+#include "memory.h"
+#include "native.h"
+#include "table.h"
+#include "vm.h"
+
+// the bulk kernels work through packed arrays two doubles at a
+// time with SSE2, build with -DCLOX_SCALAR_NATIVES for the plain
+// loops only. sums keep several partial totals, so they can differ
+// from a left to right sum in the last bits
+#if defined(__SSE2__) && !defined(CLOX_SCALAR_NATIVES)
+#define NATIVE_SIMD
+#include <emmintrin.h>
+#endif
+
+static double sum_numbers(const double* numbers, int count) {
+    int i = 0;
+    double total = 0;
+
+#ifdef NATIVE_SIMD
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4) {
+        low = _mm_add_pd(low, _mm_loadu_pd(numbers + i));
+        high = _mm_add_pd(high, _mm_loadu_pd(numbers + i + 2));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(low, high));
+    total = lanes[0] + lanes[1];
+#endif
+
+    for (; i < count; i++) total += numbers[i];
+    return total;
+}
+
+static double dot_numbers(const double* a, const double* b, int count) {
+    int i = 0;
+    double total = 0;
+
+#ifdef NATIVE_SIMD
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4) {
+        low = _mm_add_pd(low, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        high = _mm_add_pd(high, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(low, high));
+    total = lanes[0] + lanes[1];
+#endif
+
+    for (; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+static void scale_numbers(double* result, const double* numbers, double factor, int count) {
+    int i = 0;
+
+#ifdef NATIVE_SIMD
+    __m128d scale = _mm_set1_pd(factor);
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(result + i, _mm_mul_pd(_mm_loadu_pd(numbers + i), scale));
+    }
+#endif
+
+    for (; i < count; i++) result[i] = numbers[i] * factor;
+}
+
+// numbers are sorted as integer keys that order the same way,
+// negative numbers have every bit flipped and positive ones just
+// the sign bit. a least significant digit radix sort on those is
+// linear and has no data dependent branches, unlike a comparison sort
+#define SIGN_BIT 0x8000000000000000u
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_PASSES 6
+// below this an insertion sort wins over building six histograms
+#define RADIX_MIN 64
+
+static inline uint64_t sort_key(double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return (bits & SIGN_BIT) ? ~bits : bits | SIGN_BIT;
+}
+
+static inline double key_number(uint64_t key) {
+    uint64_t bits = (key & SIGN_BIT) ? key & ~SIGN_BIT : ~key;
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+static void insertion_sort(uint64_t* keys, int count) {
+    for (int i = 1; i < count; i++) {
+        uint64_t key = keys[i];
+        int j = i - 1;
+        while (j >= 0 && keys[j] > key) {
+            keys[j + 1] = keys[j];
+            j--;
+        }
+        keys[j + 1] = key;
+    }
+}
+
+static void sort_numbers(double* numbers, int count) {
+    uint64_t* keys = ALLOCATE(uint64_t, count);
+    for (int i = 0; i < count; i++) keys[i] = sort_key(numbers[i]);
+
+    if (count < RADIX_MIN) {
+        insertion_sort(keys, count);
+    } else {
+        uint64_t* scratch = ALLOCATE(uint64_t, count);
+        uint32_t* counts = ALLOCATE(uint32_t, RADIX_PASSES * RADIX_SIZE);
+        memset(counts, 0, sizeof(uint32_t) * RADIX_PASSES * RADIX_SIZE);
+
+        // every pass's histogram in one read of the keys
+        for (int i = 0; i < count; i++) {
+            for (int pass = 0; pass < RADIX_PASSES; pass++) {
+                counts[pass * RADIX_SIZE + ((keys[i] >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1))]++;
+            }
+        }
+
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            uint32_t* offsets = counts + pass * RADIX_SIZE;
+            int shift = pass * RADIX_BITS;
+            // a digit every key shares doesn't move anything
+            if (offsets[(keys[0] >> shift) & (RADIX_SIZE - 1)] == (uint32_t)count) continue;
+
+            uint32_t offset = 0;
+            for (int digit = 0; digit < RADIX_SIZE; digit++) {
+                uint32_t digit_count = offsets[digit];
+                offsets[digit] = offset;
+                offset += digit_count;
+            }
+
+            for (int i = 0; i < count; i++) {
+                scratch[offsets[(keys[i] >> shift) & (RADIX_SIZE - 1)]++] = keys[i];
+            }
+
+            uint64_t* sorted = scratch;
+            scratch = keys;
+            keys = sorted;
+        }
+
+        FREE_ARRAY(uint32_t, counts, RADIX_PASSES * RADIX_SIZE);
+        FREE_ARRAY(uint64_t, scratch, count);
+    }
+
+    for (int i = 0; i < count; i++) numbers[i] = key_number(keys[i]);
+    FREE_ARRAY(uint64_t, keys, count);
+}
+
+bool native_error(VM* vm, Value* result, const char* message) {
+    *result = OBJ_VAL(copy_string(vm, message, (int)strlen(message)));
+    return false;
+}
+
+// the packed numbers of an array argument, NULL if it isn't
+// an array of numbers
+static double* numbers_argument(VM* vm, Value value) {
+    if (!IS_ARRAY(value)) return NULL;
+    return array_numbers(vm, AS_ARRAY(value));
+}
+
+static bool len_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (IS_ARRAY(args[0])) {
+        *result = NUMBER_VAL(AS_ARRAY(args[0])->count);
+    } else if (IS_MAP(args[0])) {
+        *result = NUMBER_VAL(AS_MAP(args[0])->count);
+    } else if (IS_STRING(args[0])) {
+        *result = NUMBER_VAL(AS_STRING(args[0])->length);
+    } else {
+        return native_error(vm, result, "len() takes an array, a map or a string.");
+    }
+    return true;
+}
+
+static bool sum_native(VM* vm, int arg_count, Value* args, Value* result) {
+    double* numbers = numbers_argument(vm, args[0]);
+    if (numbers == NULL) return native_error(vm, result, "sum() takes an array of numbers.");
+
+    *result = NUMBER_VAL(sum_numbers(numbers, AS_ARRAY(args[0])->count));
+    return true;
+}
+
+static bool dot_native(VM* vm, int arg_count, Value* args, Value* result) {
+    double* a = numbers_argument(vm, args[0]);
+    double* b = numbers_argument(vm, args[1]);
+    if (a == NULL || b == NULL || AS_ARRAY(args[0])->count != AS_ARRAY(args[1])->count) {
+        return native_error(vm, result, "dot() takes two arrays of numbers the same length.");
+    }
+
+    *result = NUMBER_VAL(dot_numbers(a, b, AS_ARRAY(args[0])->count));
+    return true;
+}
+
+static bool scale_native(VM* vm, int arg_count, Value* args, Value* result) {
+    double* numbers = numbers_argument(vm, args[0]);
+    if (numbers == NULL || !IS_NUMBER(args[1])) {
+        return native_error(vm, result, "scale() takes an array of numbers and a number.");
+    }
+
+    int count = AS_ARRAY(args[0])->count;
+    if (!heap_room(vm, sizeof(ObjArray) + sizeof(double) * count)) {
+        return native_error(vm, result, "Out of memory.");
+    }
+    ObjArray* scaled = new_array(vm);
+    array_reserve(vm, scaled, count);
+    scale_numbers(scaled->as.numbers, numbers, AS_NUMBER(args[1]), count);
+    scaled->count = count;
+
+    *result = OBJ_VAL(scaled);
+    return true;
+}
+
+static bool sort_native(VM* vm, int arg_count, Value* args, Value* result) {
+    double* numbers = numbers_argument(vm, args[0]);
+    if (numbers == NULL) return native_error(vm, result, "sort() takes an array of numbers.");
+
+    sort_numbers(numbers, AS_ARRAY(args[0])->count);
+    *result = args[0];
+    return true;
+}
+
+static bool push_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (arg_count < 1 || !IS_ARRAY(args[0])) {
+        return native_error(vm, result, "push() takes an array and values.");
+    }
+
+    for (int i = 1; i < arg_count; i++) array_push(vm, AS_ARRAY(args[0]), args[i]);
+    *result = args[0];
+    return true;
+}
+
+static bool array_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_NUMBER(args[0]) || !(AS_NUMBER(args[0]) >= 0 && AS_NUMBER(args[0]) <= INT32_MAX)) {
+        return native_error(vm, result, "array() takes a count and a value.");
+    }
+
+    int count = (int)AS_NUMBER(args[0]);
+    if (!heap_room(vm, sizeof(ObjArray) + sizeof(Value) * count)) {
+        return native_error(vm, result, "Out of memory.");
+    }
+    ObjArray* array = new_array(vm);
+    array_reserve(vm, array, count);
+    for (int i = 0; i < count; i++) array_push(vm, array, args[1]);
+
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+// capacity is a hint, the map holds that many entries before
+// its table first has to grow
+static bool map_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_NUMBER(args[0]) || !(AS_NUMBER(args[0]) >= 0 && AS_NUMBER(args[0]) <= TABLE_RESERVE_MAX)) {
+        return native_error(vm, result, "map() takes a capacity.");
+    }
+
+    if (!heap_room(vm, sizeof(ObjMap) + sizeof(Entry) * 2 * (size_t)AS_NUMBER(args[0]))) {
+        return native_error(vm, result, "Out of memory.");
+    }
+    ObjMap* map = new_map(vm);
+    map_reserve(vm, map, (int)AS_NUMBER(args[0]));
+    *result = OBJ_VAL(map);
+    return true;
+}
+
+// keys() and values() list a map in table order
+static ObjArray* map_column(VM* vm, ObjMap* map, bool keys) {
+    ObjArray* array = new_array(vm);
+    array_reserve(vm, array, map->count);
+    for (int i = 0; i < map->table.capacity; i++) {
+        Entry* entry = &map->table.entries[i];
+        if (IS_NIL(entry->key)) continue;
+        array_push(vm, array, keys ? entry->key : entry->value);
+    }
+    return array;
+}
+
+static bool keys_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_MAP(args[0])) return native_error(vm, result, "keys() takes a map.");
+
+    *result = OBJ_VAL(map_column(vm, AS_MAP(args[0]), true));
+    return true;
+}
+
+static bool values_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_MAP(args[0])) return native_error(vm, result, "values() takes a map.");
+
+    *result = OBJ_VAL(map_column(vm, AS_MAP(args[0]), false));
+    return true;
+}
+
+static bool has_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_MAP(args[0])) return native_error(vm, result, "has() takes a map and a key.");
+
+    Value value;
+    *result = BOOL_VAL(valid_key(args[1]) && map_get(AS_MAP(args[0]), args[1], &value));
+    return true;
+}
+
+static bool remove_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (!IS_MAP(args[0])) return native_error(vm, result, "remove() takes a map and a key.");
+
+    *result = BOOL_VAL(valid_key(args[1]) && map_delete(AS_MAP(args[0]), args[1]));
+    return true;
+}
+
+static double sqrt_native(const double* args) {
+    return sqrt(args[0]);
+}
+
+static double floor_native(const double* args) {
+    return floor(args[0]);
+}
+
+// processor time in seconds, for timing scripts
+static double clock_native(const double* args) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+typedef struct {
+    const char* name;
+    int arity;
+    NativeFn function;
+    NumberFn number;
+} NativeEntry;
+
+static const NativeEntry natives[] = {
+    { "len",    1, len_native },
+    { "sum",    1, sum_native },
+    { "dot",    2, dot_native },
+    { "scale",  2, scale_native },
+    { "sort",   1, sort_native },
+    { "push",   ARITY_ANY, push_native },
+    { "array",  2, array_native },
+    { "map",    1, map_native },
+    { "keys",   1, keys_native },
+    { "values", 1, values_native },
+    { "has",    2, has_native },
+    { "remove", 2, remove_native },
+    { "sqrt",   1, NULL, sqrt_native },
+    { "floor",  1, NULL, floor_native },
+    { "clock",  0, NULL, clock_native },
+    { "fiber",  1, fiber_native },
+    { "spawn",  1, spawn_native },
+    { "resume", ARITY_ANY, resume_native },
+    { "yield",  ARITY_ANY, yield_native },
+    { "done",   1, done_native },
+};
+
+// only for a vm that's trusted with the files it can see
+static const NativeEntry file_natives[] = {
+    { "open",   1, open_native },
+    { "read",   1, read_native },
+    { "close",  1, close_native },
+};
+
+#define NATIVE_COUNT (int)(sizeof(natives) / sizeof(natives[0]))
+#define FILE_NATIVE_COUNT (int)(sizeof(file_natives) / sizeof(file_natives[0]))
+
+bool define_native(VM* vm, const char* name, int arity, NativeFn function, NumberFn number) {
+    if (number != NULL ? arity < 0 || arity > NUMBER_ARGS_MAX : arity < ARITY_ANY) return false;
+
+    ObjString* key = copy_string(vm, name, (int)strlen(name));
+    Value existing;
+    if (table_get(&vm->globals, key, &existing) && IS_NATIVE(existing) &&
+            AS_NATIVE(existing)->name == key &&
+            AS_NATIVE(existing)->function == NULL && AS_NATIVE(existing)->number == NULL) {
+        // left unbound by a snapshot, so whatever already
+        // holds it gets the definition too
+        ObjNative* native = AS_NATIVE(existing);
+        native->arity = arity;
+        native->function = function;
+        native->number = number;
+        return true;
+    }
+
+    table_set(&vm->globals, key, OBJ_VAL(new_native(vm, key, arity, function, number)));
+    return true;
+}
+
+static void define_entries(VM* vm, const NativeEntry* entries, int count) {
+    for (int i = 0; i < count; i++) {
+        const NativeEntry* entry = &entries[i];
+        define_native(vm, entry->name, entry->arity, entry->function, entry->number);
+    }
+}
+
+void define_natives(VM* vm) {
+    define_entries(vm, natives, NATIVE_COUNT);
+}
+
+void define_file_natives(VM* vm) {
+    define_entries(vm, file_natives, FILE_NATIVE_COUNT);
+}
+
+void restore_native(ObjNative* native) {
+    for (int i = 0; i < NATIVE_COUNT; i++) {
+        if (strcmp(natives[i].name, native->name->chars) == 0) {
+            native->arity = natives[i].arity;
+            native->function = natives[i].function;
+            native->number = natives[i].number;
+            return;
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef clox_native_h
+#define clox_native_h
+
+#include "common.h"
+#include "object.h"
+
+// returns false with message as the error, for natives to fail with
+bool native_error(VM* vm, Value* result, const char* message);
+// a native as the global name, exactly one of function and
+// number set. false if arity doesn't suit the kind of native
+bool define_native(VM* vm, const char* name, int arity, NativeFn function, NumberFn number);
+// every built in native as a global of vm, but for the file ones
+void define_natives(VM* vm);
+// open(), read() and close(), which a vm doesn't get unless it's
+// given them. a script can read any file the process can
+void define_file_natives(VM* vm);
+// snapshots store natives by name. fills in the built in one
+// native is named after, the host has to define any other again,
+// the file natives included
+void restore_native(ObjNative* native);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.h"
@@ -8,26 +9,32 @@
 #include "table.h"
 
 #define ALLOCATE_OBJ(type, object_type) \
-    (type*)allocate_object(sizeof(type), object_type)
+    (type*)allocate_object(vm, sizeof(type), object_type)
 
-static Obj* allocate_object(size_t size, ObjType type) {
+static Obj* allocate_object(VM* vm, size_t size, ObjType type) {
     Obj* object = (Obj*)reallocate(NULL, 0, size);
     object->type = type;
+    object->marked = false;
+    object->permanent = false;
+    object->young = false;
+    object->remembered = false;
+    track_allocation(vm, size);
 
     // insert into linked list for VM GC
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = vm->objects;
+    vm->objects = object;
     return object;
 }
 
-static ObjString* allocate_string(char* chars, int length, uint32_t hash) {
+static ObjString* allocate_string(VM* vm, char* chars, int length, uint32_t hash) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    track_allocation(vm, length + 1);
 
     // intern string on allocation
-    table_set(&vm.strings, string, NIL_VAL);
+    table_set(&vm->strings, string, NIL_VAL);
 
     return string;
 }
@@ -40,35 +47,348 @@ uint32_t hash_string(const char* key, int length) {
         hash ^= (uint8_t)key[i];
         hash *= 16777619;
     }
+
+    return hash;
 }
 
-ObjString* take_string(char* chars, int length) {
+// a string for length chars to be written into, bumped off the
+// nursery. NULL outside a run, where everything made is kept, or
+// once the nursery's full, for the caller to make an old one
+static ObjString* allocate_young_string(VM* vm, int length) {
+    if (!vm->running) return NULL;
+    Nursery* nursery = &vm->nursery;
+    if (nursery->start == NULL) {
+        nursery->start = malloc(NURSERY_SIZE);
+        if (nursery->start == NULL) exit(1);
+        nursery->top = nursery->start;
+        nursery->end = nursery->start + NURSERY_SIZE;
+    }
+
+    size_t size = YOUNG_STRING_SIZE(length);
+    if (size > (size_t)(nursery->end - nursery->top)) {
+        request_safepoint(vm);
+        return NULL;
+    }
+    // past half full the next call empties it
+    char* half = nursery->start + NURSERY_SIZE / 2;
+    if (nursery->top <= half && nursery->top + size > half) request_safepoint(vm);
+
+    ObjString* string = (ObjString*)nursery->top;
+    nursery->top += size;
+    string->obj.type = OBJ_STRING;
+    string->obj.marked = false;
+    string->obj.permanent = false;
+    string->obj.young = true;
+    string->obj.remembered = false;
+    string->obj.next = NULL;
+    string->length = length;
+    string->chars = (char*)(string + 1);
+    string->chars[length] = '\0';
+    return string;
+}
+
+ObjString* take_string(VM* vm, char* chars, int length) {
     uint32_t hash = hash_string(chars, length);
-    ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
 
-    return allocate_string(chars, length, hash);
+    return allocate_string(vm, chars, length, hash);
 }
 
-ObjString* copy_string(const char* chars, int length) {
+ObjString* copy_string(VM* vm, const char* chars, int length) {
    uint32_t hash = hash_string(chars, length); 
-   ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
+   ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
    if (interned != NULL) return interned;
 
+    ObjString* young = allocate_young_string(vm, length);
+    if (young != NULL) {
+        memcpy(young->chars, chars, length);
+        young->hash = hash;
+        table_set(&vm->strings, young, NIL_VAL);
+        return young;
+    }
+
     char* heap_chars = ALLOCATE(char, length + 1);
     memcpy(heap_chars, chars, length);
     heap_chars[length] = '\0';
 
-    return allocate_string(heap_chars, length, hash);
+    return allocate_string(vm, heap_chars, length, hash);
+}
+
+ObjString* concatenate_strings(VM* vm, ObjString* a, ObjString* b) {
+    int length = a->length + b->length;
+    ObjString* young = allocate_young_string(vm, length);
+    char* chars = young != NULL ? young->chars : ALLOCATE(char, length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+    if (young == NULL) return take_string(vm, chars, length);
+
+    uint32_t hash = hash_string(chars, length);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
+    if (interned != NULL) {
+        // it was the last thing bumped, so it can be given back
+        vm->nursery.top = (char*)young;
+        return interned;
+    }
+    young->hash = hash;
+    table_set(&vm->strings, young, NIL_VAL);
+    return young;
+}
+
+ObjString* promote_string(VM* vm, ObjString* string) {
+    if (string->obj.next != NULL) return (ObjString*)string->obj.next;
+
+    char* chars = ALLOCATE(char, string->length + 1);
+    memcpy(chars, string->chars, string->length + 1);
+    ObjString* promoted = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    promoted->length = string->length;
+    promoted->chars = chars;
+    promoted->hash = string->hash;
+    track_allocation(vm, string->length + 1);
+    vm->gc_stats.promoted += sizeof(ObjString) + string->length + 1;
+
+    string->obj.next = (Obj*)promoted;
+    return promoted;
+}
+
+ObjString* restore_string(VM* vm, char* chars, int length, uint32_t hash) {
+    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    string->length = length;
+    string->chars = chars;
+    string->hash = hash;
+    track_allocation(vm, length + 1);
+    return string;
+}
+
+ObjArray* new_array(VM* vm) {
+    ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    array->packed = true;
+    array->count = 0;
+    array->capacity = 0;
+    array->as.numbers = NULL;
+    return array;
+}
+
+ObjMap* new_map(VM* vm) {
+    ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+    map->count = 0;
+    init_table(&map->table);
+    return map;
+}
+
+ObjNative* new_native(VM* vm, ObjString* name, int arity, NativeFn function, NumberFn number) {
+    ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+    native->name = name;
+    native->arity = arity;
+    native->function = function;
+    native->number = number;
+    return native;
+}
+
+ObjShape* new_shape(VM* vm, ObjShape* parent, ObjString* name) {
+    ObjShape* shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->count = parent == NULL ? 0 : parent->count + 1;
+    init_table(&shape->transitions);
+    return shape;
+}
+
+ObjClass* new_class(VM* vm, ObjString* name, ObjShape* root) {
+    ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+    klass->name = name;
+    klass->root = root;
+    return klass;
+}
+
+ObjInstance* new_instance(VM* vm, ObjClass* klass, ObjShape* shape) {
+    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    instance->klass = klass;
+    instance->shape = shape;
+    instance->capacity = 0;
+    instance->fields = NULL;
+    return instance;
+}
+
+ObjFunction* new_function(VM* vm, ObjString* name) {
+    ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
+    function->arity = 0;
+    function->upvalue_count = 0;
+    function->name = name;
+    init_chunk(&function->chunk);
+    return function;
+}
+
+ObjClosure* new_closure(VM* vm, ObjFunction* function) {
+    ObjClosure* closure = restore_closure(vm, function->upvalue_count);
+    closure->function = function;
+    return closure;
+}
+
+ObjClosure* restore_closure(VM* vm, int upvalue_count) {
+    ObjClosure* closure = (ObjClosure*)allocate_object(vm,
+        sizeof(ObjClosure) + sizeof(Value) * upvalue_count, OBJ_CLOSURE);
+    closure->function = NULL;
+    closure->upvalue_count = upvalue_count;
+    for (int i = 0; i < upvalue_count; i++) closure->upvalues[i] = NIL_VAL;
+    return closure;
+}
+
+ObjUpvalue* new_upvalue(VM* vm, Value* slot) {
+    ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = NIL_VAL;
+    upvalue->next = NULL;
+    upvalue->fiber = vm->fiber;
+    return upvalue;
+}
+
+ObjFiber* new_fiber(VM* vm, Value function) {
+    ObjFiber* fiber = ALLOCATE_OBJ(ObjFiber, OBJ_FIBER);
+    init_fiber(fiber, function, FIBER_STACK_MIN, FIBER_FRAMES_MIN);
+    track_allocation(vm, sizeof(Value) * FIBER_STACK_MIN + sizeof(CallFrame) * FIBER_FRAMES_MIN);
+    return fiber;
+}
+
+void init_fiber(ObjFiber* fiber, Value function, int stack_capacity, int frame_capacity) {
+    fiber->obj.type = OBJ_FIBER;
+    fiber->state = FIBER_NEW;
+    fiber->function = function;
+    fiber->caller = NULL;
+    fiber->next_queued = NULL;
+    fiber->value = NIL_VAL;
+    fiber->fd = -1;
+
+    fiber->frames = ALLOCATE(CallFrame, frame_capacity);
+    fiber->frame_count = 0;
+    fiber->frame_capacity = frame_capacity;
+    fiber->stack = ALLOCATE(Value, stack_capacity);
+    fiber->stack_top = fiber->stack;
+    fiber->stack_capacity = stack_capacity;
+    fiber->open_upvalues = NULL;
+}
+
+void free_fiber_stack(ObjFiber* fiber) {
+    FREE_ARRAY(CallFrame, fiber->frames, fiber->frame_capacity);
+    FREE_ARRAY(Value, fiber->stack, fiber->stack_capacity);
+    fiber->frames = NULL;
+    fiber->frame_capacity = 0;
+    fiber->frame_count = 0;
+    fiber->stack = NULL;
+    fiber->stack_top = NULL;
+    fiber->stack_capacity = 0;
+}
+
+static void write_function(Writer* writer, ObjFunction* function) {
+    write_string(writer, "<fn ");
+    write_bytes(writer, function->name->chars, function->name->length);
+    write_string(writer, ">");
+}
+
+// arrays and maps nested deeper than this are cut short
+#define WRITE_DEPTH_MAX 16
+
+static void write_nested(Writer* writer, Value value, Obj** path, int depth);
+
+static void write_array(Writer* writer, ObjArray* array, Obj** path, int depth) {
+    write_string(writer, "[");
+    for (int i = 0; i < array->count; i++) {
+        if (i > 0) write_string(writer, ", ");
+
+        if (array->packed) {
+            write_number(writer, array->as.numbers[i]);
+        } else {
+            write_nested(writer, array->as.values[i], path, depth);
+        }
+    }
+    write_string(writer, "]");
+}
+
+static void write_map(Writer* writer, ObjMap* map, Obj** path, int depth) {
+    write_string(writer, "{");
+    bool first = true;
+    for (int i = 0; i < map->table.capacity; i++) {
+        Entry* entry = &map->table.entries[i];
+        if (IS_NIL(entry->key)) continue;
+
+        if (!first) write_string(writer, ", ");
+        first = false;
+        write_nested(writer, entry->key, path, depth);
+        write_string(writer, ": ");
+        write_nested(writer, entry->value, path, depth);
+    }
+    write_string(writer, "}");
 }
 
-void print_object(Value value) {
+// path holds the containers being written around this value, so
+// one that contains itself is written as [...] or {...} instead
+// of forever
+static void write_nested(Writer* writer, Value value, Obj** path, int depth) {
+    if (!IS_ARRAY(value) && !IS_MAP(value)) {
+        write_value(writer, value);
+        return;
+    }
+
+    bool cycle = depth == WRITE_DEPTH_MAX;
+    for (int i = 0; i < depth && !cycle; i++) cycle = path[i] == AS_OBJ(value);
+    if (cycle) {
+        write_string(writer, IS_ARRAY(value) ? "[...]" : "{...}");
+        return;
+    }
+
+    path[depth] = AS_OBJ(value);
+    if (IS_ARRAY(value)) {
+        write_array(writer, AS_ARRAY(value), path, depth + 1);
+    } else {
+        write_map(writer, AS_MAP(value), path, depth + 1);
+    }
+}
+
+void write_object(Writer* writer, Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            write_bytes(writer, AS_CSTRING(value), AS_STRING(value)->length);
+            break;
+        case OBJ_ARRAY:
+        case OBJ_MAP: {
+            Obj* path[WRITE_DEPTH_MAX];
+            write_nested(writer, value, path, 0);
+            break;
+        }
+        case OBJ_NATIVE:
+            write_string(writer, "<native ");
+            write_bytes(writer, AS_NATIVE(value)->name->chars, AS_NATIVE(value)->name->length);
+            write_string(writer, ">");
+            break;
+        case OBJ_SHAPE:
+            write_string(writer, "<shape>");
+            break;
+        case OBJ_CLASS: {
+            ObjString* name = AS_CLASS(value)->name;
+            write_bytes(writer, name->chars, name->length);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjString* name = AS_INSTANCE(value)->klass->name;
+            write_bytes(writer, name->chars, name->length);
+            write_string(writer, " instance");
+            break;
+        }
+        case OBJ_FUNCTION:
+            write_function(writer, AS_FUNCTION(value));
+            break;
+        case OBJ_CLOSURE:
+            write_function(writer, AS_CLOSURE(value)->function);
+            break;
+        case OBJ_UPVALUE:
+            write_string(writer, "upvalue");
+            break;
+        case OBJ_FIBER:
+            write_string(writer, "<fiber>");
             break;
     }
 }
\ No newline at end of file
@@ -1,20 +1,54 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include <stdatomic.h>
+
+#include "chunk.h"
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
 typedef enum {
-    OBJ_STRING
+    OBJ_STRING,
+    OBJ_ARRAY,
+    OBJ_MAP,
+    OBJ_NATIVE,
+    OBJ_SHAPE,
+    OBJ_CLASS,
+    OBJ_INSTANCE,
+    OBJ_FUNCTION,
+    OBJ_CLOSURE,
+    OBJ_UPVALUE,
+    OBJ_FIBER
 } ObjType;
 
 struct Obj {
     ObjType type;
+    // reached by the collection in progress, set by whichever
+    // marking thread gets to it first
+    atomic_bool marked;
+    // part of the vm itself rather than the heap, like its root
+    // fiber, traced from instead of collected
+    bool permanent;
+    // a string in the nursery, see collect_young()
+    bool young;
+    // in the nursery's remembered set
+    bool remembered;
+    // the next object, or for a young string that's been
+    // promoted, the copy it was promoted to
     struct Obj* next;
 };
 
+// objects the collector keeps track of for itself, in memory
+// that isn't counted as the script's heap
+typedef struct {
+    int count;
+    int capacity;
+    Obj** objects;
+} ObjStack;
+
 // A struct stores memory in the way in it's defined
 // so an Obj* could be a generic object or an ObjString
 // which enables inheritance and type pruning
@@ -25,9 +59,204 @@ struct ObjString {
     uint32_t hash;
 };
 
-ObjString* take_string(char* chars, int length);
-ObjString* copy_string(const char* chars, int length);
-void print_object(Value value);
+// numbers are stored packed in a plain double array so bulk
+// natives can run straight over them, storing anything else
+// unpacks the whole array into values
+typedef struct {
+    Obj obj;
+    bool packed;
+    int count;
+    int capacity;
+    union {
+        double* numbers;
+        Value* values;
+    } as;
+} ObjArray;
+
+// any value but nil or NaN is a key. count is the live entries,
+// the table's own count takes in tombstones too
+typedef struct {
+    Obj obj;
+    int count;
+    Table table;
+} ObjMap;
+
+typedef struct {
+    Obj obj;
+    ObjString* name;
+    int arity;
+    // one of these, or neither for a native defined by the host
+    // that a snapshot was restored without
+    NativeFn function;
+    NumberFn number;
+} ObjNative;
+
+// a field layout shared by every instance of a class that got its
+// fields in the same order. adding a field follows the transition
+// for its name to the next shape, made the first time it's taken.
+// the new field is always the last slot, so a shape's fields are
+// found walking back through its parents
+struct ObjShape {
+    Obj obj;
+    ObjShape* parent;
+    // the field added on the way here, NULL for a class's root
+    ObjString* name;
+    int count;
+    // field name to the shape that adds it
+    Table transitions;
+};
+
+typedef struct {
+    Obj obj;
+    ObjString* name;
+    // shape of an instance with no fields yet
+    ObjShape* root;
+} ObjClass;
+
+typedef struct {
+    Obj obj;
+    ObjClass* klass;
+    ObjShape* shape;
+    int capacity;
+    Value* fields;
+} ObjInstance;
+
+struct ObjFunction {
+    Obj obj;
+    int arity;
+    int upvalue_count;
+    Chunk chunk;
+    ObjString* name;
+};
+
+// upvalues are stored flat in the closure. one copied from a local
+// that's never assigned again is the value itself, one shared with
+// the enclosing function is an ObjUpvalue, which no script can
+// otherwise get hold of
+typedef struct {
+    Obj obj;
+    ObjFunction* function;
+    int upvalue_count;
+    Value upvalues[];
+} ObjClosure;
+
+// a shared variable, at its stack slot until that goes out of
+// scope and then moved into closed. open ones are listed on the vm
+// from the top of the stack down
+struct ObjUpvalue {
+    Obj obj;
+    Value* location;
+    Value closed;
+    ObjUpvalue* next;
+    // whose stack location points into while it's open
+    struct ObjFiber* fiber;
+};
+
+// a call in progress. the running one's ip lives in the vm, the
+// ones below it hold where they pick up again
+typedef struct {
+    // NULL for the top level script
+    ObjFunction* function;
+    Chunk* chunk;
+    uint8_t* ip;
+    Value* slots;
+    // NULL for a function that captures nothing
+    Value* upvalues;
+} CallFrame;
+
+typedef enum {
+    FIBER_NEW,
+    // running, or waiting for a fiber it resumed
+    FIBER_RUNNING,
+    // yielded to whatever resumed it
+    FIBER_SUSPENDED,
+    // in the run queue
+    FIBER_QUEUED,
+    // parked until the file it's reading has something
+    FIBER_WAITING,
+    FIBER_DONE
+} FiberState;
+
+// a fiber starts this small and grows as calls need more
+#define FIBER_STACK_MIN (2 * UINT8_COUNT)
+#define FIBER_FRAMES_MIN 4
+
+// a coroutine with its own stack and frames. while it runs the vm
+// works on copies of where they're at, saved back when another
+// fiber takes over. a finished fiber gives its stack back
+typedef struct ObjFiber {
+    Obj obj;
+    FiberState state;
+    // called when it starts, nil for a vm's main fiber
+    Value function;
+    // gets control back when this one yields or returns
+    struct ObjFiber* caller;
+    struct ObjFiber* next_queued;
+    // what the native call it stopped in returns once it runs again
+    Value value;
+    // the file it's waiting to read
+    int fd;
+
+    CallFrame* frames;
+    int frame_count;
+    int frame_capacity;
+    Value* stack;
+    Value* stack_top;
+    int stack_capacity;
+    ObjUpvalue* open_upvalues;
+} ObjFiber;
+
+#define IS_ARRAY(value)     (is_obj_type(value, OBJ_ARRAY))
+#define IS_MAP(value)       (is_obj_type(value, OBJ_MAP))
+#define IS_NATIVE(value)    (is_obj_type(value, OBJ_NATIVE))
+#define IS_CLASS(value)     (is_obj_type(value, OBJ_CLASS))
+#define IS_INSTANCE(value)  (is_obj_type(value, OBJ_INSTANCE))
+#define IS_FUNCTION(value)  (is_obj_type(value, OBJ_FUNCTION))
+#define IS_CLOSURE(value)   (is_obj_type(value, OBJ_CLOSURE))
+#define IS_UPVALUE(value)   (is_obj_type(value, OBJ_UPVALUE))
+#define IS_FIBER(value)     (is_obj_type(value, OBJ_FIBER))
+#define AS_ARRAY(value)     ((ObjArray*)AS_OBJ(value))
+#define AS_MAP(value)       ((ObjMap*)AS_OBJ(value))
+#define AS_NATIVE(value)    ((ObjNative*)AS_OBJ(value))
+#define AS_CLASS(value)     ((ObjClass*)AS_OBJ(value))
+#define AS_INSTANCE(value)  ((ObjInstance*)AS_OBJ(value))
+#define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
+#define AS_CLOSURE(value)   ((ObjClosure*)AS_OBJ(value))
+#define AS_UPVALUE(value)   ((ObjUpvalue*)AS_OBJ(value))
+#define AS_FIBER(value)     ((ObjFiber*)AS_OBJ(value))
+
+uint32_t hash_string(const char* key, int length);
+// strings are interned in and owned by the given vm
+ObjString* take_string(VM* vm, char* chars, int length);
+ObjString* copy_string(VM* vm, const char* chars, int length);
+// a + b, made straight into the nursery while a chunk runs
+ObjString* concatenate_strings(VM* vm, ObjString* a, ObjString* b);
+// the old copy of a young string, made the first time it's asked for
+ObjString* promote_string(VM* vm, ObjString* string);
+// owned by vm but not interned, for snapshots which restore
+// the intern table whole
+ObjString* restore_string(VM* vm, char* chars, int length, uint32_t hash);
+ObjArray* new_array(VM* vm);
+ObjMap* new_map(VM* vm);
+ObjNative* new_native(VM* vm, ObjString* name, int arity, NativeFn function, NumberFn number);
+ObjShape* new_shape(VM* vm, ObjShape* parent, ObjString* name);
+ObjClass* new_class(VM* vm, ObjString* name, ObjShape* root);
+// with no room for fields yet, shape is usually the class's root
+ObjInstance* new_instance(VM* vm, ObjClass* klass, ObjShape* shape);
+ObjFunction* new_function(VM* vm, ObjString* name);
+// upvalues start out nil
+ObjClosure* new_closure(VM* vm, ObjFunction* function);
+// room for upvalue_count upvalues and no function yet, for
+// snapshots which link closures to functions afterwards
+ObjClosure* restore_closure(VM* vm, int upvalue_count);
+ObjUpvalue* new_upvalue(VM* vm, Value* slot);
+// a new fiber that will call function, a closure or function
+ObjFiber* new_fiber(VM* vm, Value function);
+// sets up a fiber that isn't on the heap, like a vm's main one
+void init_fiber(ObjFiber* fiber, Value function, int stack_capacity, int frame_capacity);
+// gives back a fiber's stack and frames, once it's done
+void free_fiber_stack(ObjFiber* fiber);
+void write_object(Writer* writer, Value value);
 
 static inline bool is_obj_type(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
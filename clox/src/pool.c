@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "pool.h"
+
+typedef struct {
+    PoolJob* job;
+    int task_count;
+    // next unclaimed task, workers grab one at a time so slow
+    // tasks don't hold up a whole pre-assigned batch
+    atomic_int next_task;
+} Pool;
+
+int default_worker_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+static void* worker(void* arg) {
+    Pool* pool = (Pool*)arg;
+    PoolJob* job = pool->job;
+
+    void* state = job->start != NULL ? job->start(job->context) : NULL;
+
+    for (;;) {
+        int task = atomic_fetch_add(&pool->next_task, 1);
+        if (task >= pool->task_count) break;
+        job->run(job->context, state, task);
+    }
+
+    if (job->stop != NULL) job->stop(job->context, state);
+    return NULL;
+}
+
+void run_pool(PoolJob* job, int task_count, int worker_count) {
+    Pool pool;
+    pool.job = job;
+    pool.task_count = task_count;
+    atomic_init(&pool.next_task, 0);
+
+    if (worker_count > task_count) worker_count = task_count;
+    if (worker_count < 1) return;
+
+    pthread_t* threads = ALLOCATE(pthread_t, worker_count);
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&threads[i], NULL, worker, &pool) != 0) break;
+        started++;
+    }
+
+    // couldn't get a single thread, do the work here instead
+    if (started == 0) worker(&pool);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    FREE_ARRAY(pthread_t, threads, worker_count);
+}
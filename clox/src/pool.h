@@ -0,0 +1,19 @@
+#ifndef clox_pool_h
+#define clox_pool_h
+
+#include "common.h"
+
+// a fixed list of tasks shared out across worker threads,
+// start and stop run once on each worker around its share,
+// whatever start returns is handed to that worker's tasks
+typedef struct {
+    void* (*start)(void* context);
+    void (*run)(void* context, void* worker, int task);
+    void (*stop)(void* context, void* worker);
+    void* context;
+} PoolJob;
+
+int default_worker_count();
+void run_pool(PoolJob* job, int task_count, int worker_count);
+
+#endif
@@ -4,18 +4,19 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
-
-Scanner scanner;
-
-void init_scanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+// runs of whitespace, comment bodies, identifiers and string
+// contents are skipped 16 bytes at a time with SSE2 compares,
+// build with -DCLOX_SCALAR_SCANNER for the plain loops only
+#if defined(__SSE2__) && !defined(CLOX_SCALAR_SCANNER)
+#define SCANNER_SIMD
+#include <emmintrin.h>
+#endif
+
+void init_scanner(Scanner* scanner, const char* source, size_t length) {
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + length;
+    scanner->line = 1;
 }
 
 static bool is_digit(char c) {
@@ -28,55 +29,154 @@ static bool is_alpha(char c) {
             c == '_';
 }
 
-static char peek() {
-    return *scanner.current;
+static bool is_at_end(Scanner* scanner) {
+    return scanner->current >= scanner->end;
+}
+
+static char peek(Scanner* scanner) {
+    if (is_at_end(scanner)) return '\0';
+    return *scanner->current;
 }
 
-static bool is_at_end() {
-    // assume string ends with null terminator
-    return peek() == '\0';
+static char peek_next(Scanner* scanner) {
+    if (scanner->end - scanner->current < 2) return '\0';
+    return scanner->current[1]; 
 }
 
-static char peek_next() {
-    if (is_at_end()) return '\0';
-    return scanner.current[1]; 
+static char advance(Scanner* scanner) {
+    return *scanner->current++;
 }
 
-static char advance() {
-    return *scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+    if (is_at_end(scanner)) return false;
+    if (peek(scanner) != expected) return false;
+
+    scanner->current++;
+    return true;
 }
 
-static bool match(char expected) {
-    if (is_at_end()) return false;
-    if (peek() != expected) return false;
+#ifdef SCANNER_SIMD
+// bit i is set where byte i of bytes equals c
+static inline unsigned bytes_equal(__m128i bytes, char c) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+
+// bit i is set where byte i of bytes is from low to high, sse2
+// only has signed compares so both sides are biased by 128
+static inline unsigned bytes_in_range(__m128i bytes, char low, char high) {
+    __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+    __m128i biased = _mm_xor_si128(offset, _mm_set1_epi8((char)0x80));
+    return _mm_movemask_epi8(_mm_cmplt_epi8(biased, _mm_set1_epi8((char)(high - low - 127))));
+}
+
+// moves past the bytes before the first one whose bit is set in
+// stop, counting newlines on the way. false if none of the 16 stop
+static inline bool advance_until(Scanner* scanner, unsigned stop, unsigned newlines) {
+    if (stop == 0) {
+        scanner->line += __builtin_popcount(newlines);
+        scanner->current += 16;
+        return false;
+    }
 
-    scanner.current++;
+    int skipped = __builtin_ctz(stop);
+    scanner->line += __builtin_popcount(newlines & ((1u << skipped) - 1));
+    scanner->current += skipped;
     return true;
 }
 
-static void skip_whitespace() {
+static inline bool has_block(Scanner* scanner) {
+    return scanner->end - scanner->current >= 16;
+}
+
+static inline __m128i load_block(Scanner* scanner) {
+    return _mm_loadu_si128((const __m128i*)scanner->current);
+}
+#endif
+
+// each skip_ function finishes with the same loop the scalar
+// scanner uses, the simd loop in front of it only gets there sooner
+
+static void skip_blanks(Scanner* scanner) {
+#ifdef SCANNER_SIMD
+    while (has_block(scanner)) {
+        __m128i bytes = load_block(scanner);
+        unsigned newlines = bytes_equal(bytes, '\n');
+        unsigned blanks = newlines | bytes_equal(bytes, ' ')
+            | bytes_equal(bytes, '\t') | bytes_equal(bytes, '\r');
+        if (advance_until(scanner, ~blanks & 0xffff, newlines)) return;
+    }
+#endif
+
     for (;;) {
-        char c = peek();
+        char c = peek(scanner);
+        if (c == '\n') {
+            scanner->line++;
+        } else if (c != ' ' && c != '\t' && c != '\r') {
+            return;
+        }
+        advance(scanner);
+    }
+}
+
+// up to but not including the newline so it's counted as whitespace
+static void skip_line_comment(Scanner* scanner) {
+#ifdef SCANNER_SIMD
+    while (has_block(scanner)) {
+        __m128i bytes = load_block(scanner);
+        unsigned newlines = bytes_equal(bytes, '\n');
+        if (advance_until(scanner, newlines, 0)) return;
+    }
+#endif
+
+    while (peek(scanner) != '\n' && !is_at_end(scanner)) advance(scanner);
+}
+
+// from the opening slash through the closing */ or end of input
+static void skip_block_comment(Scanner* scanner) {
+    scanner->current += 2;
+
+    for (;;) {
+#ifdef SCANNER_SIMD
+        while (has_block(scanner)) {
+            __m128i bytes = load_block(scanner);
+            unsigned newlines = bytes_equal(bytes, '\n');
+            if (advance_until(scanner, bytes_equal(bytes, '*'), newlines)) break;
+        }
+#endif
+
+        while (peek(scanner) != '*' && !is_at_end(scanner)) {
+            if (peek(scanner) == '\n') scanner->line++;
+            advance(scanner);
+        }
+
+        if (is_at_end(scanner)) return;
+        advance(scanner);
+        if (match(scanner, '/')) return;
+    }
+}
+
+static void skip_whitespace(Scanner* scanner) {
+    for (;;) {
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
-                break;
-            
             case '\n':
-                scanner.line++;
-                advance();
+                skip_blanks(scanner);
                 break;
 
             case '/':
-                switch (peek_next()) {
+                switch (peek_next(scanner)) {
                     case '/': 
-                        while (peek() != '\n' && !is_at_end()) advance(); 
+                        skip_line_comment(scanner);
                         break;
                     case '*': 
-                        while (peek() != '*' && peek_next() != '/' && !is_at_end()) advance();
+                        skip_block_comment(scanner);
                         break;
+                    default:
+                        // a lone slash is a token, not whitespace
+                        return;
                 }
                 break;
 
@@ -86,136 +186,157 @@ static void skip_whitespace() {
     }
 }
 
-static Token make_token(TokenType type) {
+static Token make_token(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
 
     return token;
 }
 
-static Token error_token(const char* message) {
+static Token error_token(Scanner* scanner, const char* message) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)(strlen(message));
-    token.line = scanner.line;
+    token.line = scanner->line;
 
     return token;
 }
 
-static Token string() {
-    while (peek() != '"' && !is_at_end()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
+static Token string(Scanner* scanner) {
+#ifdef SCANNER_SIMD
+    while (has_block(scanner)) {
+        __m128i bytes = load_block(scanner);
+        unsigned newlines = bytes_equal(bytes, '\n');
+        if (advance_until(scanner, bytes_equal(bytes, '"'), newlines)) break;
+    }
+#endif
+
+    while (peek(scanner) != '"' && !is_at_end(scanner)) {
+        if (peek(scanner) == '\n') scanner->line++;
+        advance(scanner);
     }
 
-    if (is_at_end()) return error_token("Unterminated string");
+    if (is_at_end(scanner)) return error_token(scanner, "Unterminated string");
 
     // closing quotation mark
-    advance();
-    return make_token(TOKEN_STRING);
+    advance(scanner);
+    return make_token(scanner, TOKEN_STRING);
 }
 
-static Token number() {
-    while (is_digit(peek())) advance();
+static Token number(Scanner* scanner) {
+    while (is_digit(peek(scanner))) advance(scanner);
 
     // check for decimal
-    if (peek() == '.' && is_digit(peek_next())) {
+    if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
         // consume '.'
-        advance();
+        advance(scanner);
 
-        while (is_digit(peek())) advance();
+        while (is_digit(peek(scanner))) advance(scanner);
     }
 
-    return make_token(TOKEN_NUMBER);
+    return make_token(scanner, TOKEN_NUMBER);
 }
 
-static TokenType check_keyword(int start, int length, const char* rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length && 
-            memcmp(scanner.start + start, rest, length) == 0) {
+static TokenType check_keyword(Scanner* scanner, int start, int length, const char* rest, TokenType type) {
+    if (scanner->current - scanner->start == start + length && 
+            memcmp(scanner->start + start, rest, length) == 0) {
         return type;
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifier_type() {
+static TokenType identifier_type(Scanner* scanner) {
     // emulate trie traversal for matching reserved keywords
     // through switch statements
-    switch (scanner.start[0]) {
-        case 'a': return check_keyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return check_keyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return check_keyword(1, 3, "lse", TOKEN_ELSE);
+    switch (scanner->start[0]) {
+        case 'a': return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
+        case 'c': return check_keyword(scanner, 1, 4, "lass", TOKEN_CLASS);
+        case 'e': return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
         case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return check_keyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return check_keyword(2, 1, "r", TOKEN_FOR);
-                    case 'u': return check_keyword(2, 1, "n", TOKEN_FUN);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'a': return check_keyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+                    case 'o': return check_keyword(scanner, 2, 1, "r", TOKEN_FOR);
+                    case 'u': return check_keyword(scanner, 2, 1, "n", TOKEN_FUN);
                 }
             }
             break;
-        case 'i': return check_keyword(1, 1, "f", TOKEN_IF);
-        case 'n': return check_keyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return check_keyword(1, 1, "r", TOKEN_OR);
-        case 'p': return check_keyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return check_keyword(1, 4, "uper", TOKEN_SUPER);
+        case 'i': return check_keyword(scanner, 1, 1, "f", TOKEN_IF);
+        case 'n': return check_keyword(scanner, 1, 2, "il", TOKEN_NIL);
+        case 'o': return check_keyword(scanner, 1, 1, "r", TOKEN_OR);
+        case 'p': return check_keyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+        case 'r': return check_keyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+        case 's': return check_keyword(scanner, 1, 4, "uper", TOKEN_SUPER);
         case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return check_keyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return check_keyword(2, 2, "ue", TOKEN_TRUE);
+            if (scanner->current - scanner->start > 1) {
+                switch (scanner->start[1]) {
+                    case 'h': return check_keyword(scanner, 2, 2, "is", TOKEN_THIS);
+                    case 'r': return check_keyword(scanner, 2, 2, "ue", TOKEN_TRUE);
                 }
             }
             break;
-        case 'v': return check_keyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
+        case 'v': return check_keyword(scanner, 1, 2, "ar", TOKEN_VAR);
+        case 'w': return check_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
     }
 
-    return TOKEN_ERROR; // unreachable
+    return TOKEN_IDENTIFIER;
 }
 
-static Token identifier() {
-    while (is_alpha(peek()) || is_digit(peek())) advance();
+static Token identifier(Scanner* scanner) {
+#ifdef SCANNER_SIMD
+    while (has_block(scanner)) {
+        __m128i bytes = load_block(scanner);
+        // setting bit 5 folds upper case onto lower case letters
+        // without touching digits or underscore
+        __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+        unsigned word = bytes_in_range(folded, 'a', 'z')
+            | bytes_in_range(bytes, '0', '9') | bytes_equal(bytes, '_');
+        if (advance_until(scanner, ~word & 0xffff, 0)) break;
+    }
+#endif
 
-    return make_token(identifier_type());
+    while (is_alpha(peek(scanner)) || is_digit(peek(scanner))) advance(scanner);
+
+    return make_token(scanner, identifier_type(scanner));
 }
 
-Token scan_token() {
-    skip_whitespace();
+Token scan_token(Scanner* scanner) {
+    skip_whitespace(scanner);
 
-    scanner.start = scanner.current;
+    scanner->start = scanner->current;
 
-    if (is_at_end()) return make_token(TOKEN_EOF);
+    if (is_at_end(scanner)) return make_token(scanner, TOKEN_EOF);
 
-    char ch = advance();
-    if (is_digit(ch)) return number();
-    if (is_alpha(ch)) return identifier();
+    char ch = advance(scanner);
+    if (is_digit(ch)) return number(scanner);
+    if (is_alpha(ch)) return identifier(scanner);
 
     switch (ch) {
-        case '(': return make_token(TOKEN_LEFT_PAREN);
-        case ')': return make_token(TOKEN_RIGHT_PAREN);
-        case '{': return make_token(TOKEN_LEFT_BRACE);
-        case '}': return make_token(TOKEN_RIGHT_BRACE);
-        case ';': return make_token(TOKEN_SEMICOLON);
-        case ',': return make_token(TOKEN_COMMA);
-        case '.': return make_token(TOKEN_DOT);
-        case '-': return make_token(TOKEN_MINUS);
-        case '+': return make_token(TOKEN_PLUS);
-        case '/': return make_token(TOKEN_SLASH);
-        case '*': return make_token(TOKEN_STAR);
-        case '!': return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
-        case '=': return make_token(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
-        case '<': return make_token(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
-        case '>': return make_token(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-        case '"': return string();
+        case '(': return make_token(scanner, TOKEN_LEFT_PAREN);
+        case ')': return make_token(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return make_token(scanner, TOKEN_LEFT_BRACE);
+        case '}': return make_token(scanner, TOKEN_RIGHT_BRACE);
+        case '[': return make_token(scanner, TOKEN_LEFT_BRACKET);
+        case ']': return make_token(scanner, TOKEN_RIGHT_BRACKET);
+        case ';': return make_token(scanner, TOKEN_SEMICOLON);
+        case ':': return make_token(scanner, TOKEN_COLON);
+        case ',': return make_token(scanner, TOKEN_COMMA);
+        case '.': return make_token(scanner, TOKEN_DOT);
+        case '-': return make_token(scanner, TOKEN_MINUS);
+        case '+': return make_token(scanner, TOKEN_PLUS);
+        case '/': return make_token(scanner, TOKEN_SLASH);
+        case '*': return make_token(scanner, TOKEN_STAR);
+        case '!': return make_token(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        case '=': return make_token(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        case '<': return make_token(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        case '>': return make_token(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        case '"': return string(scanner);
     }
 
-    return error_token("Unexpected character.");
+    return error_token(scanner, "Unexpected character.");
 }
-
-Scanner scanner;
\ No newline at end of file
@@ -1,11 +1,14 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "common.h"
+
 typedef enum {
     // Single-char tokens
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
-    TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
+    TOKEN_COLON, TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
 
     // One or two char tokens
@@ -34,7 +37,16 @@ typedef struct {
     int line;
 } Token;
 
-void init_scanner(const char* source);
-Token scan_token();
+typedef struct {
+    const char* start;
+    const char* current;
+    // one past the last byte of source
+    const char* end;
+    int line;
+} Scanner;
+
+// source needn't be NUL terminated
+void init_scanner(Scanner* scanner, const char* source, size_t length);
+Token scan_token(Scanner* scanner);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,297 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "serve.h"
+#include "table.h"
+#include "vm.h"
+
+// a request is the script source, ended by the client shutting
+// down its side of the connection. the response is the exit code
+// on a line of its own followed by everything the script printed
+
+// compiled chunks kept per worker, direct mapped by source hash
+#define CACHE_SIZE 64
+
+typedef struct {
+    // NULL while the slot is empty
+    char* source;
+    int length;
+    uint32_t hash;
+    Chunk chunk;
+} CachedScript;
+
+typedef struct {
+    int listener;
+
+    atomic_long requests;
+    atomic_long hits;
+} Server;
+
+typedef struct {
+    Server* server;
+    int id;
+    pthread_t thread;
+
+    // chunks hold strings interned in this vm so the
+    // cache can't be shared with other workers
+    VM vm;
+    CachedScript cache[CACHE_SIZE];
+} Worker;
+
+static double now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+static bool write_all(int fd, const char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+// everything up to end of stream, NULL terminated and
+// malloc'd like the sources read_file() returns
+static char* read_all(int fd, int* length) {
+    int capacity = 0;
+    char* bytes = NULL;
+    *length = 0;
+
+    for (;;) {
+        if (capacity < *length + 4096) {
+            capacity = GROW_CAPACITY(capacity + 4096);
+            bytes = (char*)realloc(bytes, capacity);
+            if (bytes == NULL) return NULL;
+        }
+
+        ssize_t count = read(fd, bytes + *length, capacity - *length - 1);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            free(bytes);
+            return NULL;
+        }
+        if (count == 0) break;
+        *length += count;
+    }
+
+    bytes[*length] = '\0';
+    return bytes;
+}
+
+static void evict(VM* vm, CachedScript* entry) {
+    if (entry->source == NULL) return;
+    FREE_ARRAY(char, entry->source, entry->length + 1);
+    release_chunk(vm, &entry->chunk);
+    free_chunk(&entry->chunk);
+    entry->source = NULL;
+}
+
+// NULL if source doesn't compile, failures aren't cached
+static Chunk* cached_chunk(Worker* worker, const char* source, int length, bool* hit) {
+    uint32_t hash = hash_string(source, length);
+    CachedScript* entry = &worker->cache[hash & (CACHE_SIZE - 1)];
+
+    *hit = entry->source != NULL
+        && entry->hash == hash
+        && entry->length == length
+        && memcmp(entry->source, source, length) == 0;
+    if (*hit) return &entry->chunk;
+
+    evict(&worker->vm, entry);
+    init_chunk(&entry->chunk);
+    entry->chunk.backend = worker->vm.backend;
+    if (!compile(&worker->vm, source, length, &entry->chunk)) {
+        free_chunk(&entry->chunk);
+        return NULL;
+    }
+
+    keep_chunk(&worker->vm, &entry->chunk);
+    entry->source = ALLOCATE(char, length + 1);
+    memcpy(entry->source, source, length + 1);
+    entry->length = length;
+    entry->hash = hash;
+    return &entry->chunk;
+}
+
+static void handle_request(Worker* worker, int client) {
+    VM* vm = &worker->vm;
+    int length;
+    char* source = read_all(client, &length);
+    if (source == NULL) return;
+
+    double start = now_ms();
+
+    // script output and errors both go back to the client
+    char* output = NULL;
+    size_t output_size = 0;
+    FILE* out = open_memstream(&output, &output_size);
+    set_output(vm, out);
+    vm->err = out;
+
+    bool hit;
+    Chunk* chunk = cached_chunk(worker, source, length, &hit);
+    InterpretResult result = chunk == NULL
+        ? INTERPRET_COMPILE_ERROR
+        : run_chunk(vm, chunk);
+
+    // requests don't see each other's globals
+    reset_globals(vm);
+
+    set_output(vm, stdout);
+    vm->err = stderr;
+    fclose(out);
+
+    double elapsed = now_ms() - start;
+
+    char header[16];
+    int header_length = snprintf(header, sizeof(header), "%d\n", exit_code(result));
+    if (write_all(client, header, header_length)) {
+        write_all(client, output, output_size);
+    }
+    free(output);
+    free(source);
+
+    long requests = atomic_fetch_add(&worker->server->requests, 1) + 1;
+    long hits = atomic_fetch_add(&worker->server->hits, hit ? 1 : 0) + (hit ? 1 : 0);
+    fprintf(stderr, "worker %d: %-4s %.3f ms, hit rate %.1f%% (%ld/%ld)\n",
+        worker->id, hit ? "hit" : "miss", elapsed,
+        100.0 * hits / requests, hits, requests);
+}
+
+static void* run_worker(void* arg) {
+    Worker* worker = (Worker*)arg;
+
+    for (;;) {
+        int client = accept(worker->server->listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+
+        handle_request(worker, client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+static bool socket_address(const char* socket_path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", socket_path);
+        return false;
+    }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+void serve(const char* socket_path, int worker_count, Backend backend, bool optimize,
+        bool print_passes, Limits limits, int gc_threads) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) exit(64);
+
+    Server server;
+    atomic_init(&server.requests, 0);
+    atomic_init(&server.hits, 0);
+
+    server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    // replace a socket left behind by an earlier server
+    unlink(socket_path);
+    if (server.listener < 0
+        || bind(server.listener, (struct sockaddr*)&address, sizeof(address)) < 0
+        || listen(server.listener, SOMAXCONN) < 0) {
+        perror(socket_path);
+        exit(74);
+    }
+
+    // every worker blocks in accept on the same socket and
+    // the kernel hands each connection to one of them
+    Worker* workers = ALLOCATE(Worker, worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        Worker* worker = &workers[i];
+        worker->server = &server;
+        worker->id = i;
+        // without the file natives, a client only gets to read
+        // what it sends
+        init_VM(&worker->vm);
+        worker->vm.backend = backend;
+        worker->vm.optimize = optimize;
+        worker->vm.print_passes = print_passes;
+        worker->vm.limits = limits;
+        worker->vm.gc_threads = gc_threads;
+        for (int j = 0; j < CACHE_SIZE; j++) worker->cache[j].source = NULL;
+    }
+
+    fprintf(stderr, "serving on %s with %d workers\n", socket_path, worker_count);
+
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) break;
+        started++;
+    }
+    if (started == 0) run_worker(&workers[0]);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        for (int j = 0; j < CACHE_SIZE; j++) evict(&workers[i].vm, &workers[i].cache[j]);
+        free_VM(&workers[i].vm);
+    }
+    FREE_ARRAY(Worker, workers, worker_count);
+    close(server.listener);
+    unlink(socket_path);
+}
+
+int send_script(const char* socket_path, const char* source, size_t source_length) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) return 64;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror(socket_path);
+        return 74;
+    }
+
+    int length;
+    char* response = NULL;
+    if (write_all(server, source, source_length)
+        && shutdown(server, SHUT_WR) == 0) {
+        response = read_all(server, &length);
+    }
+    close(server);
+
+    char* output;
+    long code = response == NULL ? -1 : strtol(response, &output, 10);
+    if (response == NULL || *output != '\n') {
+        fprintf(stderr, "Bad response from \"%s\".\n", socket_path);
+        return 74;
+    }
+
+    fwrite(output + 1, 1, length - (output + 1 - response), stdout);
+    free(response);
+    return (int)code;
+}
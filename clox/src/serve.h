@@ -0,0 +1,18 @@
+#ifndef clox_serve_h
+#define clox_serve_h
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+// answer scripts sent to a unix socket until killed, each
+// worker thread has its own VM and cache of compiled chunks.
+// every request runs under limits, collecting with gc_threads.
+// print_passes reports go back with each script's output
+void serve(const char* socket_path, int worker_count, Backend backend, bool optimize,
+    bool print_passes, Limits limits, int gc_threads);
+// run source on a server, printing its output, returns the
+// exit code a local run of it would have had
+int send_script(const char* socket_path, const char* source, size_t length);
+
+#endif
@@ -0,0 +1,30 @@
+#include "memory.h"
+#include "shape.h"
+#include "table.h"
+
+int shape_slot(ObjShape* shape, ObjString* name) {
+    for (; shape->name != NULL; shape = shape->parent) {
+        if (shape->name == name) return shape->count - 1;
+    }
+    return -1;
+}
+
+ObjShape* shape_add(VM* vm, ObjShape* shape, ObjString* name) {
+    Value next;
+    if (table_get(&shape->transitions, name, &next)) return (ObjShape*)AS_OBJ(next);
+
+    ObjShape* added = new_shape(vm, shape, name);
+    table_set(&shape->transitions, name, OBJ_VAL(added));
+    return added;
+}
+
+void instance_reshape(VM* vm, ObjInstance* instance, ObjShape* shape) {
+    if (shape->count > instance->capacity) {
+        int old_capacity = instance->capacity;
+        instance->capacity = GROW_CAPACITY(old_capacity);
+        if (instance->capacity < shape->count) instance->capacity = shape->count;
+        instance->fields = GROW_ARRAY(Value, instance->fields, old_capacity, instance->capacity);
+        track_allocation(vm, sizeof(Value) * (instance->capacity - old_capacity));
+    }
+    instance->shape = shape;
+}
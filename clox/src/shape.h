@@ -0,0 +1,14 @@
+#ifndef clox_shape_h
+#define clox_shape_h
+
+#include "common.h"
+#include "object.h"
+
+// slot of the field name in instances of shape, -1 if they don't have it
+int shape_slot(ObjShape* shape, ObjString* name);
+// shape reached adding the field name to shape
+ObjShape* shape_add(VM* vm, ObjShape* shape, ObjString* name);
+// move instance to shape, which has its shape as an ancestor
+void instance_reshape(VM* vm, ObjInstance* instance, ObjShape* shape);
+
+#endif
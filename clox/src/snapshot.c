@@ -0,0 +1,743 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "array.h"
+#include "map.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "snapshot.h"
+#include "source.h"
+#include "table.h"
+
+#define SNAPSHOT_MAGIC "cloxsnap"
+#define SNAPSHOT_VERSION 7
+
+// sections follow the header in this order: object records,
+// object payloads, the intern table, globals, then the chunk's
+// code, lines, constants and string constant table
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    // layouts differ between builds, e.g. with -fshort-enums
+    uint32_t value_size;
+    uint32_t entry_size;
+    uint32_t backend;
+    uint32_t object_count;
+    uint32_t strings_capacity;
+    uint32_t strings_count;
+    uint32_t globals_capacity;
+    uint32_t globals_count;
+    uint32_t code_count;
+    uint32_t constant_count;
+    uint32_t string_constants_capacity;
+    uint32_t string_constants_count;
+    // inline caches start out empty again
+    uint32_t cache_count;
+    uint64_t payload_size;
+} SnapshotHeader;
+
+// length is a string's length, an array's or map's count, a
+// shape's or instance's field count, a function's code count, a
+// closure's upvalue count or a native's arity, hash is a string's
+// hash, whether an array is packed, a function's constant count
+// or a fiber's state
+typedef struct {
+    uint32_t type;
+    uint32_t length;
+    uint32_t hash;
+} SnapshotObject;
+
+// object pointers to their numbers, 1 based so 0 stays NULL
+typedef struct {
+    int capacity;
+    Obj** keys;
+    uint32_t* numbers;
+} ObjectNumbers;
+
+static uint32_t pointer_slot(ObjectNumbers* map, Obj* object) {
+    uint64_t bits = (uint64_t)(uintptr_t)object;
+    return (uint32_t)((bits >> 4) * 0x9e3779b97f4a7c15u >> 32) & (map->capacity - 1);
+}
+
+static uint32_t* number_slot(ObjectNumbers* map, Obj* object) {
+    uint32_t slot = pointer_slot(map, object);
+    while (map->keys[slot] != NULL && map->keys[slot] != object) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->keys[slot] = object;
+    return &map->numbers[slot];
+}
+
+static void number_objects(VM* vm, ObjectNumbers* map, uint32_t count) {
+    map->capacity = 8;
+    while (map->capacity < count * 2) map->capacity *= 2;
+    map->keys = ALLOCATE(Obj*, map->capacity);
+    map->numbers = ALLOCATE(uint32_t, map->capacity);
+    memset(map->keys, 0, sizeof(Obj*) * map->capacity);
+
+    uint32_t number = 1;
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        *number_slot(map, object) = number++;
+    }
+}
+
+static void free_object_numbers(ObjectNumbers* map) {
+    FREE_ARRAY(Obj*, map->keys, map->capacity);
+    FREE_ARRAY(uint32_t, map->numbers, map->capacity);
+}
+
+static void* encode_pointer(ObjectNumbers* map, Obj* object) {
+    if (object == NULL) return NULL;
+    return (void*)(uintptr_t)*number_slot(map, object);
+}
+
+static Value encode_value(ObjectNumbers* map, Value value) {
+    if (IS_OBJ(value)) value.as.obj = (Obj*)encode_pointer(map, AS_OBJ(value));
+    return value;
+}
+
+static SnapshotObject object_record(Obj* object) {
+    SnapshotObject record = { object->type, 0, 0 };
+    switch (object->type) {
+        case OBJ_STRING:
+            record.length = ((ObjString*)object)->length;
+            record.hash = ((ObjString*)object)->hash;
+            break;
+        case OBJ_ARRAY:
+            record.length = ((ObjArray*)object)->count;
+            record.hash = ((ObjArray*)object)->packed;
+            break;
+        case OBJ_MAP:
+            record.length = ((ObjMap*)object)->count;
+            break;
+        case OBJ_SHAPE:
+            record.length = ((ObjShape*)object)->count;
+            break;
+        case OBJ_INSTANCE:
+            record.length = ((ObjInstance*)object)->shape->count;
+            break;
+        case OBJ_FUNCTION:
+            record.length = ((ObjFunction*)object)->chunk.count;
+            record.hash = ((ObjFunction*)object)->chunk.constants.count;
+            break;
+        case OBJ_CLOSURE:
+            record.length = ((ObjClosure*)object)->upvalue_count;
+            break;
+        case OBJ_CLASS:
+        case OBJ_UPVALUE:
+            // all of either is in its payload
+            break;
+        case OBJ_NATIVE:
+            // natives are found again by name
+            record.length = ((ObjNative*)object)->arity;
+            break;
+        case OBJ_FIBER:
+            record.hash = ((ObjFiber*)object)->state;
+            break;
+    }
+    return record;
+}
+
+static uint64_t payload_size(SnapshotObject* record) {
+    switch (record->type) {
+        case OBJ_STRING:
+            return (uint64_t)record->length + 1;
+        case OBJ_NATIVE:
+            return sizeof(void*);
+        case OBJ_ARRAY:
+            return (uint64_t)record->length * (record->hash ? sizeof(double) : sizeof(Value));
+        case OBJ_MAP:
+            return (uint64_t)record->length * 2 * sizeof(Value);
+        case OBJ_SHAPE:
+        case OBJ_CLASS:
+            return 2 * sizeof(void*);
+        case OBJ_INSTANCE:
+            return 2 * sizeof(void*) + (uint64_t)record->length * sizeof(Value);
+        case OBJ_FUNCTION:
+            // name, arity, upvalue and cache counts, then the chunk
+            return sizeof(void*) + 3 * sizeof(uint32_t)
+                + (uint64_t)record->length * (sizeof(uint8_t) + sizeof(int))
+                + (uint64_t)record->hash * sizeof(Value);
+        case OBJ_CLOSURE:
+            return sizeof(void*) + (uint64_t)record->length * sizeof(Value);
+        case OBJ_UPVALUE:
+        case OBJ_FIBER:
+            return sizeof(Value);
+    }
+    return 0;
+}
+
+static void write_payload(FILE* file, ObjectNumbers* map, Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            fwrite(string->chars, 1, string->length + 1, file);
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (array->packed) {
+                fwrite(array->as.numbers, sizeof(double), array->count, file);
+                break;
+            }
+            for (int i = 0; i < array->count; i++) {
+                Value value = encode_value(map, array->as.values[i]);
+                fwrite(&value, sizeof(Value), 1, file);
+            }
+            break;
+        }
+        case OBJ_MAP: {
+            // only the live entries, keys hashed by address land
+            // somewhere else once read back so the table is rebuilt
+            Table* table = &((ObjMap*)object)->table;
+            for (int i = 0; i < table->capacity; i++) {
+                if (IS_NIL(table->entries[i].key)) continue;
+                Value pair[2] = {
+                    encode_value(map, table->entries[i].key),
+                    encode_value(map, table->entries[i].value),
+                };
+                fwrite(pair, sizeof(Value), 2, file);
+            }
+            break;
+        }
+        case OBJ_NATIVE: {
+            void* name = encode_pointer(map, (Obj*)((ObjNative*)object)->name);
+            fwrite(&name, sizeof(void*), 1, file);
+            break;
+        }
+        case OBJ_SHAPE: {
+            // transitions are rebuilt from every shape's parent
+            ObjShape* shape = (ObjShape*)object;
+            void* pointers[2] = {
+                encode_pointer(map, (Obj*)shape->parent),
+                encode_pointer(map, (Obj*)shape->name),
+            };
+            fwrite(pointers, sizeof(void*), 2, file);
+            break;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            void* pointers[2] = {
+                encode_pointer(map, (Obj*)klass->name),
+                encode_pointer(map, (Obj*)klass->root),
+            };
+            fwrite(pointers, sizeof(void*), 2, file);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            void* pointers[2] = {
+                encode_pointer(map, (Obj*)instance->klass),
+                encode_pointer(map, (Obj*)instance->shape),
+            };
+            fwrite(pointers, sizeof(void*), 2, file);
+            for (int i = 0; i < instance->shape->count; i++) {
+                Value value = encode_value(map, instance->fields[i]);
+                fwrite(&value, sizeof(Value), 1, file);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            // the string constant table only matters while compiling
+            ObjFunction* function = (ObjFunction*)object;
+            Chunk* chunk = &function->chunk;
+            void* name = encode_pointer(map, (Obj*)function->name);
+            uint32_t counts[3] = { function->arity, function->upvalue_count, chunk->cache_count };
+            fwrite(&name, sizeof(void*), 1, file);
+            fwrite(counts, sizeof(uint32_t), 3, file);
+            fwrite(chunk->code, sizeof(uint8_t), chunk->count, file);
+            fwrite(chunk->lines, sizeof(int), chunk->count, file);
+            for (int i = 0; i < chunk->constants.count; i++) {
+                Value value = encode_value(map, chunk->constants.values[i]);
+                fwrite(&value, sizeof(Value), 1, file);
+            }
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            void* function = encode_pointer(map, (Obj*)closure->function);
+            fwrite(&function, sizeof(void*), 1, file);
+            for (int i = 0; i < closure->upvalue_count; i++) {
+                Value value = encode_value(map, closure->upvalues[i]);
+                fwrite(&value, sizeof(Value), 1, file);
+            }
+            break;
+        }
+        case OBJ_UPVALUE: {
+            // nothing runs between scripts, so every upvalue is closed
+            // and only its value is kept
+            Value value = encode_value(map, *((ObjUpvalue*)object)->location);
+            fwrite(&value, sizeof(Value), 1, file);
+            break;
+        }
+        case OBJ_FIBER: {
+            // only new and finished fibers get this far, so the
+            // function is all there is to one
+            Value value = encode_value(map, ((ObjFiber*)object)->function);
+            fwrite(&value, sizeof(Value), 1, file);
+            break;
+        }
+    }
+}
+
+static void write_table(FILE* file, ObjectNumbers* map, Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        Entry entry;
+        memset(&entry, 0, sizeof(Entry));
+        entry.key = encode_value(map, table->entries[i].key);
+        entry.value = encode_value(map, table->entries[i].value);
+        fwrite(&entry, sizeof(Entry), 1, file);
+    }
+}
+
+bool write_snapshot(VM* vm, Chunk* chunk, const char* path) {
+    finish_sweep(vm);
+    // a fiber part way through has frames pointing into
+    // code and stack, which there's no saving
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        if (object->type == OBJ_FIBER && ((ObjFiber*)object)->state != FIBER_NEW
+                && ((ObjFiber*)object)->state != FIBER_DONE) {
+            fprintf(vm->err, "Can't snapshot a fiber that has started and not finished.\n");
+            return false;
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(vm->err, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.value_size = sizeof(Value);
+    header.entry_size = sizeof(Entry);
+    header.backend = chunk->backend;
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        SnapshotObject record = object_record(object);
+        header.object_count++;
+        header.payload_size += payload_size(&record);
+    }
+    header.strings_capacity = vm->strings.capacity;
+    header.strings_count = vm->strings.count;
+    header.globals_capacity = vm->globals.capacity;
+    header.globals_count = vm->globals.count;
+    header.code_count = chunk->count;
+    header.constant_count = chunk->constants.count;
+    header.string_constants_capacity = chunk->string_constants.capacity;
+    header.string_constants_count = chunk->string_constants.count;
+    header.cache_count = chunk->cache_count;
+    fwrite(&header, sizeof(header), 1, file);
+
+    ObjectNumbers map;
+    number_objects(vm, &map, header.object_count);
+
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        SnapshotObject record = object_record(object);
+        fwrite(&record, sizeof(record), 1, file);
+    }
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        write_payload(file, &map, object);
+    }
+
+    write_table(file, &map, &vm->strings);
+    write_table(file, &map, &vm->globals);
+
+    fwrite(chunk->code, sizeof(uint8_t), chunk->count, file);
+    fwrite(chunk->lines, sizeof(int), chunk->count, file);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = encode_value(&map, chunk->constants.values[i]);
+        fwrite(&value, sizeof(Value), 1, file);
+    }
+    write_table(file, &map, &chunk->string_constants);
+
+    free_object_numbers(&map);
+
+    bool written = !ferror(file);
+    if (fclose(file) != 0) written = false;
+    if (!written) fprintf(vm->err, "Could not write file \"%s\".\n", path);
+    return written;
+}
+
+typedef struct {
+    const char* current;
+    const char* end;
+    // objects in the order they were written, what
+    // numbers in the file relocate to
+    Obj** objects;
+    uint32_t object_count;
+} SnapshotReader;
+
+// NULL if the file is shorter than it claims
+static const char* take(SnapshotReader* reader, size_t size) {
+    if ((size_t)(reader->end - reader->current) < size) return NULL;
+    const char* bytes = reader->current;
+    reader->current += size;
+    return bytes;
+}
+
+static bool relocate_pointer(SnapshotReader* reader, void** pointer) {
+    uintptr_t number = (uintptr_t)*pointer;
+    if (number == 0) return true;
+    if (number > reader->object_count) return false;
+    *pointer = reader->objects[number - 1];
+    return true;
+}
+
+static bool relocate_value(SnapshotReader* reader, Value* value) {
+    if (!IS_OBJ(*value)) return true;
+    return value->as.obj != NULL && relocate_pointer(reader, (void**)&value->as.obj);
+}
+
+// a pointer read from a payload, which has to be to an object of
+// type. NULL only where allowed
+static bool read_pointer(SnapshotReader* reader, const char* payload, int index,
+        ObjType type, bool allow_null, void* pointer) {
+    void* object;
+    memcpy(&object, payload + sizeof(void*) * index, sizeof(void*));
+    if (!relocate_pointer(reader, &object)) return false;
+    if (object == NULL ? !allow_null : ((Obj*)object)->type != type) return false;
+
+    memcpy(pointer, &object, sizeof(void*));
+    return true;
+}
+
+static bool read_table(SnapshotReader* reader, Table* table, uint32_t capacity, uint32_t count) {
+    const char* bytes = take(reader, sizeof(Entry) * capacity);
+    if (bytes == NULL || count > capacity) return false;
+
+    // same capacity, same slots, so the table is usable
+    // as soon as its pointers are fixed up
+    table->entries = ALLOCATE(Entry, capacity);
+    table->capacity = capacity;
+    table->count = count;
+    memcpy(table->entries, bytes, sizeof(Entry) * capacity);
+
+    for (uint32_t i = 0; i < capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (!relocate_value(reader, &entry->key)) return false;
+        if (!relocate_value(reader, &entry->value)) return false;
+    }
+    return true;
+}
+
+// inline caches aren't saved, only how many there were, and they
+// start out empty. each belongs to an instruction of the code
+// already read and is found by a two byte operand, a count past
+// either means the file is corrupt rather than a huge allocation
+static bool restore_caches(Chunk* chunk, uint32_t count) {
+    if (count > UINT16_MAX + 1 || count > (uint32_t)chunk->count) return false;
+    if (count == 0) return true;
+
+    chunk->cache_capacity = count;
+    chunk->cache_count = count;
+    chunk->caches = ALLOCATE(InlineCache, chunk->cache_capacity);
+    memset(chunk->caches, 0, sizeof(InlineCache) * chunk->cache_capacity);
+    return true;
+}
+
+// NULL if the record or payload don't make sense
+static Obj* read_object(VM* vm, SnapshotObject* record, const char* payload) {
+    switch (record->type) {
+        case OBJ_STRING: {
+            char* chars = ALLOCATE(char, record->length + 1);
+            memcpy(chars, payload, record->length);
+            chars[record->length] = '\0';
+            return (Obj*)restore_string(vm, chars, record->length, record->hash);
+        }
+        case OBJ_ARRAY: {
+            // unpacked elements are relocated once every
+            // object they might point at exists
+            ObjArray* array = new_array(vm);
+            array->packed = record->hash != 0;
+            array_reserve(vm, array, record->length);
+            memcpy(array->packed ? (void*)array->as.numbers : (void*)array->as.values,
+                payload, payload_size(record));
+            array->count = record->length;
+            return (Obj*)array;
+        }
+        case OBJ_MAP: {
+            // entries go in once their keys can be hashed
+            ObjMap* map = new_map(vm);
+            map_reserve(vm, map, record->length);
+            return (Obj*)map;
+        }
+        // pointers are filled in once every object exists
+        case OBJ_SHAPE: {
+            ObjShape* shape = new_shape(vm, NULL, NULL);
+            shape->count = record->length;
+            return (Obj*)shape;
+        }
+        case OBJ_CLASS:
+            return (Obj*)new_class(vm, NULL, NULL);
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = new_instance(vm, NULL, NULL);
+            instance->capacity = record->length;
+            instance->fields = ALLOCATE(Value, instance->capacity);
+            memcpy(instance->fields, payload + 2 * sizeof(void*), sizeof(Value) * record->length);
+            return (Obj*)instance;
+        }
+        case OBJ_FUNCTION: {
+            uint32_t counts[3];
+            memcpy(counts, payload + sizeof(void*), sizeof(counts));
+            if (counts[0] > UINT8_MAX || counts[1] > UINT8_COUNT) return NULL;
+
+            // constants are relocated with the other pointers
+            ObjFunction* function = new_function(vm, NULL);
+            function->arity = counts[0];
+            function->upvalue_count = counts[1];
+            Chunk* chunk = &function->chunk;
+            const char* bytes = payload + sizeof(void*) + sizeof(counts);
+            chunk->capacity = record->length;
+            chunk->count = record->length;
+            chunk->code = ALLOCATE(uint8_t, chunk->capacity);
+            chunk->lines = ALLOCATE(int, chunk->capacity);
+            memcpy(chunk->code, bytes, sizeof(uint8_t) * chunk->count);
+            bytes += sizeof(uint8_t) * chunk->count;
+            memcpy(chunk->lines, bytes, sizeof(int) * chunk->count);
+            bytes += sizeof(int) * chunk->count;
+            for (uint32_t i = 0; i < record->hash; i++) {
+                Value value;
+                memcpy(&value, bytes + sizeof(Value) * i, sizeof(Value));
+                write_value_array(&chunk->constants, value);
+            }
+
+            // a function left unfinished goes with the rest of the heap
+            if (!restore_caches(chunk, counts[2])) return NULL;
+            return (Obj*)function;
+        }
+        case OBJ_CLOSURE: {
+            if (record->length > UINT8_COUNT) return NULL;
+            ObjClosure* closure = restore_closure(vm, record->length);
+            memcpy(closure->upvalues, payload + sizeof(void*), sizeof(Value) * record->length);
+            return (Obj*)closure;
+        }
+        case OBJ_FIBER: {
+            if (record->hash != FIBER_NEW && record->hash != FIBER_DONE) return NULL;
+            ObjFiber* fiber = new_fiber(vm, NIL_VAL);
+            memcpy(&fiber->function, payload, sizeof(Value));
+            fiber->state = (FiberState)record->hash;
+            if (fiber->state == FIBER_DONE) free_fiber_stack(fiber);
+            return (Obj*)fiber;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpvalue* upvalue = new_upvalue(vm, NULL);
+            memcpy(&upvalue->closed, payload, sizeof(Value));
+            upvalue->location = &upvalue->closed;
+            return (Obj*)upvalue;
+        }
+        case OBJ_NATIVE: {
+            int arity = (int)record->length;
+            if (arity < ARITY_ANY || arity > UINT8_MAX) return NULL;
+            return (Obj*)new_native(vm, NULL, arity, NULL, NULL);
+        }
+    }
+    return NULL;
+}
+
+// fill in what read_object couldn't, now that every object exists
+static bool link_object(VM* vm, SnapshotReader* reader, Obj* object, SnapshotObject* record,
+        const char* payload) {
+    switch (object->type) {
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            if (array->packed) return true;
+            for (int i = 0; i < array->count; i++) {
+                if (!relocate_value(reader, &array->as.values[i])) return false;
+            }
+            return true;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+            for (uint32_t i = 0; i < record->length; i++) {
+                Value pair[2];
+                memcpy(pair, payload + sizeof(pair) * i, sizeof(pair));
+                if (!relocate_value(reader, &pair[0]) || !relocate_value(reader, &pair[1])
+                        || !valid_key(pair[0])) {
+                    return false;
+                }
+                map_set(vm, map, pair[0], pair[1]);
+            }
+            return true;
+        }
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            if (!read_pointer(reader, payload, 0, OBJ_SHAPE, true, &shape->parent)
+                    || !read_pointer(reader, payload, 1, OBJ_STRING, true, &shape->name)) {
+                return false;
+            }
+
+            // a root has neither, any other shape has one more
+            // field than its parent
+            if ((shape->parent == NULL) != (shape->name == NULL)) return false;
+            if (shape->parent == NULL) return shape->count == 0;
+            if (shape->count != shape->parent->count + 1) return false;
+            table_set(&shape->parent->transitions, shape->name, OBJ_VAL(shape));
+            return true;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            return read_pointer(reader, payload, 0, OBJ_STRING, false, &klass->name)
+                && read_pointer(reader, payload, 1, OBJ_SHAPE, false, &klass->root)
+                && klass->root->count == 0;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            if (!read_pointer(reader, payload, 0, OBJ_CLASS, false, &instance->klass)
+                    || !read_pointer(reader, payload, 1, OBJ_SHAPE, false, &instance->shape)
+                    || instance->shape->count != (int)record->length) {
+                return false;
+            }
+            for (int i = 0; i < instance->capacity; i++) {
+                if (!relocate_value(reader, &instance->fields[i])) return false;
+            }
+            return true;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            if (!read_pointer(reader, payload, 0, OBJ_STRING, false, &function->name)) return false;
+            ValueArray* constants = &function->chunk.constants;
+            for (int i = 0; i < constants->count; i++) {
+                if (!relocate_value(reader, &constants->values[i])) return false;
+            }
+            return true;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            if (!read_pointer(reader, payload, 0, OBJ_FUNCTION, false, &closure->function)
+                    || closure->function->upvalue_count != closure->upvalue_count) {
+                return false;
+            }
+            for (int i = 0; i < closure->upvalue_count; i++) {
+                if (!relocate_value(reader, &closure->upvalues[i])) return false;
+            }
+            return true;
+        }
+        case OBJ_UPVALUE:
+            return relocate_value(reader, &((ObjUpvalue*)object)->closed);
+        case OBJ_FIBER: {
+            // a new one has to have something it can start by calling
+            ObjFiber* fiber = (ObjFiber*)object;
+            if (!relocate_value(reader, &fiber->function)) return false;
+            return fiber->state == FIBER_DONE || IS_CLOSURE(fiber->function)
+                || IS_FUNCTION(fiber->function);
+        }
+        case OBJ_NATIVE: {
+            // one the host defined stays unbound until it's defined again
+            ObjNative* native = (ObjNative*)object;
+            if (!read_pointer(reader, payload, 0, OBJ_STRING, false, &native->name)) return false;
+            restore_native(native);
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+static bool read_objects(VM* vm, SnapshotReader* reader, SnapshotHeader* header) {
+    const char* records = take(reader, sizeof(SnapshotObject) * header->object_count);
+    const char* payloads = take(reader, header->payload_size);
+    if (records == NULL || payloads == NULL) return false;
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < header->object_count; i++) {
+        SnapshotObject record;
+        memcpy(&record, records + sizeof(record) * i, sizeof(record));
+        uint64_t size = payload_size(&record);
+        if (offset + size > header->payload_size) return false;
+
+        Obj* object = read_object(vm, &record, payloads + offset);
+        if (object == NULL) return false;
+        offset += size;
+
+        reader->objects[i] = object;
+        reader->object_count++;
+    }
+
+    offset = 0;
+    for (uint32_t i = 0; i < reader->object_count; i++) {
+        SnapshotObject record;
+        memcpy(&record, records + sizeof(record) * i, sizeof(record));
+        if (!link_object(vm, reader, reader->objects[i], &record, payloads + offset)) return false;
+        offset += payload_size(&record);
+    }
+    return true;
+}
+
+static bool read_chunk(SnapshotReader* reader, SnapshotHeader* header, Chunk* chunk) {
+    const char* code = take(reader, sizeof(uint8_t) * header->code_count);
+    const char* lines = take(reader, sizeof(int) * header->code_count);
+    const char* constants = take(reader, sizeof(Value) * header->constant_count);
+    if (code == NULL || lines == NULL || constants == NULL) return false;
+
+    chunk->backend = (Backend)header->backend;
+    chunk->capacity = header->code_count;
+    chunk->count = header->code_count;
+    chunk->code = ALLOCATE(uint8_t, chunk->capacity);
+    chunk->lines = ALLOCATE(int, chunk->capacity);
+    memcpy(chunk->code, code, sizeof(uint8_t) * chunk->count);
+    memcpy(chunk->lines, lines, sizeof(int) * chunk->count);
+
+    for (uint32_t i = 0; i < header->constant_count; i++) {
+        Value value;
+        memcpy(&value, constants + sizeof(Value) * i, sizeof(Value));
+        if (!relocate_value(reader, &value)) return false;
+        write_value_array(&chunk->constants, value);
+    }
+
+    if (!restore_caches(chunk, header->cache_count)) return false;
+    return read_table(reader, &chunk->string_constants,
+        header->string_constants_capacity, header->string_constants_count);
+}
+
+bool read_snapshot(VM* vm, Chunk* chunk, const char* path) {
+    Source source;
+    if (!load_source(path, &source, vm->err)) return false;
+
+    SnapshotReader reader = { source.bytes, source.bytes + source.length, NULL, 0 };
+    SnapshotHeader header;
+    const char* bytes = take(&reader, sizeof(header));
+    if (bytes != NULL) memcpy(&header, bytes, sizeof(header));
+
+    if (bytes == NULL
+            || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+            || header.version != SNAPSHOT_VERSION
+            || header.value_size != sizeof(Value)
+            || header.entry_size != sizeof(Entry)) {
+        fprintf(vm->err, "\"%s\" is not a snapshot from this build of clox.\n", path);
+        free_source(&source);
+        return false;
+    }
+
+    // every object has a record, so a count the file can't
+    // hold means it's corrupt rather than a huge allocation
+    if ((uint64_t)header.object_count * sizeof(SnapshotObject) > (uint64_t)(reader.end - reader.current)) {
+        fprintf(vm->err, "Snapshot \"%s\" is truncated or corrupt.\n", path);
+        free_source(&source);
+        return false;
+    }
+
+    reader.objects = ALLOCATE(Obj*, header.object_count);
+    free_table(&vm->strings);
+    free_table(&vm->globals);
+    free_chunk(chunk);
+
+    bool loaded = read_objects(vm, &reader, &header)
+        && read_table(&reader, &vm->strings, header.strings_capacity, header.strings_count)
+        && read_table(&reader, &vm->globals, header.globals_capacity, header.globals_count)
+        && read_chunk(&reader, &header, chunk);
+
+    if (!loaded) {
+        fprintf(vm->err, "Snapshot \"%s\" is truncated or corrupt.\n", path);
+        free_table(&vm->strings);
+        free_table(&vm->globals);
+        free_chunk(chunk);
+    }
+
+    FREE_ARRAY(Obj*, reader.objects, header.object_count);
+    free_source(&source);
+    return loaded;
+}
@@ -0,0 +1,22 @@
+#ifndef clox_snapshot_h
+#define clox_snapshot_h
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+// the heap an initialization script leaves behind, every object,
+// the intern and global tables and the script's chunk, written out
+// so a later process can start from it instead of running the
+// script again. pointers are stored as object numbers and relocated
+// on the way back in, tables keep their layout so nothing is hashed.
+// snapshots only load into the same build that wrote them
+
+// false, with the reason reported to vm->err, if path can't be written
+bool write_snapshot(VM* vm, Chunk* chunk, const char* path);
+// replaces vm's intern table and globals, natives included,
+// and fills chunk with the script's code. false, reported to
+// vm->err, if path isn't a snapshot from this build
+bool read_snapshot(VM* vm, Chunk* chunk, const char* path);
+
+#endif
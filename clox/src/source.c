@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
+
+// pipes, terminals and anything else that can't be mapped
+// are read until end of stream into a growing buffer
+static bool read_stream(int fd, Source* source) {
+    size_t capacity = 0;
+    size_t length = 0;
+    char* bytes = NULL;
+
+    for (;;) {
+        if (length == capacity) {
+            capacity = capacity < 4096 ? 4096 : capacity * 2;
+            char* grown = (char*)realloc(bytes, capacity);
+            if (grown == NULL) {
+                free(bytes);
+                return false;
+            }
+            bytes = grown;
+        }
+
+        ssize_t count = read(fd, bytes + length, capacity - length);
+        if (count < 0) {
+            free(bytes);
+            return false;
+        }
+        if (count == 0) break;
+        length += count;
+    }
+
+    source->bytes = bytes;
+    source->length = length;
+    source->mapped = false;
+    return true;
+}
+
+bool load_source(const char* path, Source* source, FILE* err) {
+    bool standard_input = strcmp(path, "-") == 0;
+    int fd = standard_input ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(err, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+
+    struct stat info;
+    bool mappable = fstat(fd, &info) == 0
+        && S_ISREG(info.st_mode)
+        && info.st_size > 0;
+
+    bool loaded;
+    if (mappable) {
+        void* bytes = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        loaded = bytes != MAP_FAILED;
+        if (loaded) {
+            // scanned front to back exactly once
+            posix_madvise(bytes, info.st_size, POSIX_MADV_SEQUENTIAL);
+            source->bytes = (const char*)bytes;
+            source->length = info.st_size;
+            source->mapped = true;
+        }
+    } else {
+        loaded = read_stream(fd, source);
+    }
+
+    if (!standard_input) close(fd);
+    if (!loaded) fprintf(err, "Could not read file \"%s\".\n", path);
+    return loaded;
+}
+
+void free_source(Source* source) {
+    if (source->mapped) {
+        munmap((void*)source->bytes, source->length);
+    } else {
+        free((void*)source->bytes);
+    }
+    source->bytes = NULL;
+    source->length = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef clox_source_h
+#define clox_source_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+// script text, not NUL terminated since regular files are mapped
+// straight into memory and scanned in place
+typedef struct {
+    const char* bytes;
+    size_t length;
+    // mapped sources are unmapped, read ones freed
+    bool mapped;
+} Source;
+
+// path "-" reads stdin. false, with the reason reported to
+// err, if path can't be read
+bool load_source(const char* path, Source* source, FILE* err);
+void free_source(Source* source);
+
+#endif
@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "scanner.h"
+#include "stream.h"
+
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+// length of the longest prefix of text made of whole top level
+// statements, 0 if there isn't one yet. a token the scanner only
+// stopped because it ran out of input may continue in the next
+// read, so nothing from there on counts
+static size_t statements_end(const char* text, size_t length) {
+    Scanner scanner;
+    init_scanner(&scanner, text, length);
+
+    int depth = 0;
+    size_t end = 0;
+    // a block closing at the top level ends its statement
+    // unless an else follows
+    size_t block_end = 0;
+    // a top level brace after anything but the end of a statement,
+    // a condition or a class name opens a map literal, which
+    // doesn't end one
+    bool block = false;
+    TokenType previous = TOKEN_SEMICOLON;
+
+    for (;;) {
+        Token token = scan_token(&scanner);
+        if (token.type == TOKEN_EOF || scanner.current >= text + length) break;
+
+        if (block_end != 0) {
+            if (token.type != TOKEN_ELSE) end = block_end;
+            block_end = 0;
+        }
+
+        switch (token.type) {
+            case TOKEN_LEFT_BRACE:
+                if (depth == 0) {
+                    block = previous == TOKEN_SEMICOLON || previous == TOKEN_RIGHT_BRACE ||
+                            previous == TOKEN_RIGHT_PAREN || previous == TOKEN_ELSE ||
+                            previous == TOKEN_IDENTIFIER;
+                }
+                depth++;
+                break;
+            case TOKEN_LEFT_PAREN:
+            case TOKEN_LEFT_BRACKET:
+                depth++;
+                break;
+            case TOKEN_RIGHT_PAREN:
+            case TOKEN_RIGHT_BRACKET:
+                if (depth > 0) depth--;
+                break;
+            case TOKEN_RIGHT_BRACE:
+                if (depth > 0) depth--;
+                if (depth == 0 && block) block_end = scanner.current - text;
+                break;
+            case TOKEN_SEMICOLON:
+                if (depth == 0) end = scanner.current - text;
+                break;
+            default:
+                break;
+        }
+        previous = token.type;
+    }
+
+    return end;
+}
+
+static int count_lines(const char* text, size_t length) {
+    int lines = 0;
+    const char* end = text + length;
+    while ((text = memchr(text, '\n', end - text)) != NULL) {
+        lines++;
+        text++;
+    }
+    return lines;
+}
+
+static InterpretResult run_statements(VM* vm, const char* text, size_t length, int line) {
+    Chunk chunk;
+    init_chunk(&chunk);
+    chunk.backend = vm->backend;
+
+    if (!compile_from_line(vm, text, length, line, &chunk)) {
+        free_chunk(&chunk);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    InterpretResult result = run_chunk(vm, &chunk);
+    free_chunk(&chunk);
+    return result;
+}
+
+InterpretResult interpret_stream(VM* vm, int fd) {
+    size_t capacity = STREAM_BUFFER_SIZE;
+    size_t length = 0;
+    char* buffer = ALLOCATE(char, capacity);
+    int line = 1;
+    InterpretResult result = INTERPRET_OK;
+
+    for (bool at_end = false; !at_end && result == INTERPRET_OK;) {
+        // only a statement longer than the buffer makes it grow
+        if (length == capacity) {
+            buffer = GROW_ARRAY(char, buffer, capacity, capacity * 2);
+            capacity *= 2;
+        }
+
+        ssize_t count = read(fd, buffer + length, capacity - length);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            fprintf(vm->err, "Could not read script.\n");
+            result = INTERPRET_COMPILE_ERROR;
+            break;
+        }
+
+        at_end = count == 0;
+        length += count;
+
+        // whatever is left at the end of input is compiled as is
+        // so an unfinished statement gets its usual error
+        size_t end = at_end ? length : statements_end(buffer, length);
+        if (end == 0) continue;
+
+        result = run_statements(vm, buffer, end, line);
+        line += count_lines(buffer, end);
+
+        memmove(buffer, buffer + end, length - end);
+        length -= end;
+    }
+
+    FREE_ARRAY(char, buffer, capacity);
+    return result;
+}
+
+bool input_complete(const char* text, size_t length) {
+    Scanner scanner;
+    init_scanner(&scanner, text, length);
+    int depth = 0;
+
+    for (;;) {
+        Token token = scan_token(&scanner);
+        switch (token.type) {
+            case TOKEN_EOF:
+                return depth <= 0;
+            case TOKEN_LEFT_PAREN:
+            case TOKEN_LEFT_BRACE:
+            case TOKEN_LEFT_BRACKET:
+                depth++;
+                break;
+            case TOKEN_RIGHT_PAREN:
+            case TOKEN_RIGHT_BRACE:
+            case TOKEN_RIGHT_BRACKET:
+                depth--;
+                break;
+            case TOKEN_ERROR:
+                // a string still open at the end of the text
+                if (*scanner.start == '"' && scanner.current >= text + length) return false;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// start over with a fresh chunk once the constant pool is this
+// full, one entry rarely needs more than what's left. code already
+// run is never needed again, so it's capped too
+#define SESSION_CONSTANTS_MAX 192
+#define SESSION_CODE_MAX (64 * 1024)
+
+void init_session(VM* vm, Session* session) {
+    init_chunk(&session->chunk);
+    session->chunk.backend = vm->backend;
+    session->line = 1;
+}
+
+void free_session(Session* session) {
+    free_chunk(&session->chunk);
+}
+
+InterpretResult interpret_entry(VM* vm, Session* session, const char* source, size_t length) {
+    // register code can't be followed by stack code, and only an
+    // empty chunk can switch to it, so under the register backend
+    // each entry gets a chunk of its own
+    Chunk* chunk = &session->chunk;
+    if (chunk->constants.count > SESSION_CONSTANTS_MAX || chunk->count > SESSION_CODE_MAX
+            || (vm->backend == BACKEND_REGISTER && chunk->count > 0)) {
+        free_session(session);
+        int line = session->line;
+        init_session(vm, session);
+        session->line = line;
+    }
+
+    // the entry's code goes over the previous entry's final
+    // return, which is put back if this one doesn't compile
+    int start = chunk->count > 0 ? chunk->count - 1 : 0;
+    uint8_t previous_return = chunk->count > 0 ? chunk->code[start] : 0;
+    chunk->count = start;
+
+    int line = session->line;
+    session->line += count_lines(source, length);
+
+    if (!compile_from_line(vm, source, length, line, chunk)) {
+        chunk->count = start;
+        if (start > 0) write_chunk(chunk, previous_return, line);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return run_chunk_from(vm, chunk, start);
+}
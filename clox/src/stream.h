@@ -0,0 +1,28 @@
+#ifndef clox_stream_h
+#define clox_stream_h
+
+#include "vm.h"
+
+// compile and run a script as it's read from fd, a batch of
+// whole top level statements at a time, so memory stays bounded
+// by the read buffer and the longest statement rather than the
+// size of the script
+InterpretResult interpret_stream(VM* vm, int fd);
+
+// false while text ends inside brackets or a string, so an
+// interactive reader knows to ask for another line
+bool input_complete(const char* text, size_t length);
+
+// an interactive session compiles each entry onto the end of one
+// long lived chunk, so constants and global names interned for
+// earlier entries are reused instead of compiled again
+typedef struct {
+    Chunk chunk;
+    int line;
+} Session;
+
+void init_session(VM* vm, Session* session);
+void free_session(Session* session);
+InterpretResult interpret_entry(VM* vm, Session* session, const char* source, size_t length);
+
+#endif
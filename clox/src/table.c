@@ -6,7 +6,6 @@
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
 
 void init_table(Table* table) {
     table->count = 0;
@@ -19,15 +18,49 @@ void free_table(Table* table) {
     init_table(table);
 }
 
-static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
-   uint32_t index = key->hash % capacity;
+uint32_t hash_value(Value value) {
+    switch (value.type) {
+        case VAL_BOOL: return AS_BOOL(value) ? 3 : 5;
+        case VAL_NIL: return 7;
+        case VAL_NUMBER: {
+            // 0 and -0 are equal keys so they must hash the same
+            double number = AS_NUMBER(value);
+            if (number == 0) return 0;
+
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            // whole numbers only differ in their top bits, fold
+            // them down before mixing or they crowd a few slots
+            bits ^= bits >> 32;
+            bits *= 0x9e3779b97f4a7c15u;
+            return (uint32_t)(bits ^ (bits >> 32));
+        }
+        case VAL_OBJ: {
+            if (IS_STRING(value)) return AS_STRING(value)->hash;
+
+            // any other object is its own identity
+            uint64_t bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+            return (uint32_t)(((bits >> 4) * 0x9e3779b97f4a7c15u) >> 32);
+        }
+    }
+    return 0;
+}
+
+static inline bool keys_equal(Value a, Value b) {
+    // strings are interned so objects compare by pointer
+    if (IS_OBJ(b)) return IS_OBJ(a) && AS_OBJ(a) == AS_OBJ(b);
+    return values_equal(a, b);
+}
+
+static Entry* find_entry(Entry* entries, int capacity, Value key, uint32_t hash) {
+   uint32_t index = hash % capacity;
     Entry* tombstone = NULL;
 
    // linear probing
    for (;;) {
        Entry* entry = &entries[index];
 
-       if (entry->key == NULL) {
+       if (IS_NIL(entry->key)) {
            if (IS_NIL(entry->value)) {
                // empty entry, return tombstone entry instead of current pointer
                // for find_insert so they don't waste memory
@@ -36,7 +69,7 @@ static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
                // found a tombstone
                if (tombstone == NULL) tombstone = entry;
            }
-       } else if (entry->key == key) {
+       } else if (keys_equal(entry->key, key)) {
            // found the key
            return entry;
        }
@@ -48,7 +81,7 @@ static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
 static void adjust_capacity(Table* table, int capacity) {
     Entry* entries = ALLOCATE(Entry, capacity);
     for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
+        entries[i].key = NIL_VAL;
         entries[i].value = NIL_VAL;
     }
 
@@ -57,9 +90,9 @@ static void adjust_capacity(Table* table, int capacity) {
     // re-insert every key-value pair 
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key == NULL) continue;
+        if (IS_NIL(entry->key)) continue;
 
-        Entry* dest = find_entry(entries, capacity, entry->key);
+        Entry* dest = find_entry(entries, capacity, entry->key, hash_value(entry->key));
         dest->key = entry->key;
         dest->value = entry->value;
         table->count++;
@@ -70,15 +103,35 @@ static void adjust_capacity(Table* table, int capacity) {
     table->capacity = capacity;
 }
 
-bool table_set(Table* table, ObjString* key, Value value) {
+void table_reserve(Table* table, int count) {
+    // any more and doubling the capacity would overflow
+    if (count > TABLE_RESERVE_MAX) count = TABLE_RESERVE_MAX;
+    int capacity = table->capacity;
+    while (count > capacity * TABLE_MAX_LOAD) capacity = GROW_CAPACITY(capacity);
+    if (capacity > table->capacity) adjust_capacity(table, capacity);
+}
+
+static int live_entries(Table* table) {
+    int count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (!IS_NIL(table->entries[i].key)) count++;
+    }
+    return count;
+}
+
+static bool set_entry(Table* table, Value key, uint32_t hash, Value value) {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
+        // tombstones count toward the load. when they're most of
+        // it, as in the intern table once the nursery has churned
+        // through it, clearing them out is enough
+        int capacity = table->capacity;
+        if (live_entries(table) + 1 > capacity * TABLE_MAX_LOAD / 2) capacity = GROW_CAPACITY(capacity);
         adjust_capacity(table, capacity); 
     }
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
+    Entry* entry = find_entry(table->entries, table->capacity, key, hash);
 
-    bool is_new_key = entry->key == NULL;
+    bool is_new_key = IS_NIL(entry->key);
     // include tombstones in cell count to prevent
     // tombstone-filled table which can result in an 
     // infinite loop in find_insert
@@ -89,15 +142,15 @@ bool table_set(Table* table, ObjString* key, Value value) {
     return is_new_key;
 }
 
-bool table_delete(Table* table, ObjString* key) {
+static bool delete_entry(Table* table, Value key, uint32_t hash) {
     if (table->count == 0) return false;
 
     // find entry
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    Entry* entry = find_entry(table->entries, table->capacity, key, hash);
+    if (IS_NIL(entry->key)) return false;
 
-    // replace with NULL:true tombstone entry
-    entry->key = NULL;
+    // replace with nil:true tombstone entry
+    entry->key = NIL_VAL;
     entry->value = BOOL_VAL(true);
 
     return true;
@@ -105,25 +158,67 @@ bool table_delete(Table* table, ObjString* key) {
 
 // returns whether key exists and if so sets the value pointer
 // to the corresponding value
-bool table_get(Table* table, ObjString* key, Value* value) {
+static bool get_entry(Table* table, Value key, uint32_t hash, Value* value) {
    if (table->count == 0) return false;
 
-   Entry* entry = find_entry(table->entries, table->capacity, key);
-   if (entry->key == NULL) return false;
+   Entry* entry = find_entry(table->entries, table->capacity, key, hash);
+   if (IS_NIL(entry->key)) return false;
 
    *value = entry->value;
    return true; 
 }
 
+bool table_set(Table* table, ObjString* key, Value value) {
+    return set_entry(table, OBJ_VAL(key), key->hash, value);
+}
+
+bool table_delete(Table* table, ObjString* key) {
+    return delete_entry(table, OBJ_VAL(key), key->hash);
+}
+
+bool table_get(Table* table, ObjString* key, Value* value) {
+    return get_entry(table, OBJ_VAL(key), key->hash, value);
+}
+
+bool table_set_value(Table* table, Value key, Value value) {
+    return set_entry(table, key, hash_value(key), value);
+}
+
+bool table_delete_value(Table* table, Value key) {
+    return delete_entry(table, key, hash_value(key));
+}
+
+bool table_get_value(Table* table, Value key, Value* value) {
+    return get_entry(table, key, hash_value(key), value);
+}
+
 void table_add_all(Table* from, Table* to) {
     for (int i = 0; i < from->capacity; i++) {
         Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-           table_set(to, entry->key, entry->value); 
+        if (!IS_NIL(entry->key)) {
+           table_set_value(to, entry->key, entry->value); 
         }
     }
 }
 
+void table_remove_white(Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (!IS_OBJ(entry->key)) continue;
+        Obj* key = AS_OBJ(entry->key);
+        if (!key->marked && !key->young) table_delete_value(table, entry->key);
+    }
+}
+
+void table_move_string(Table* table, ObjString* from, ObjString* to) {
+    if (to == NULL) {
+        table_delete(table, from);
+        return;
+    }
+    Entry* entry = find_entry(table->entries, table->capacity, OBJ_VAL(from), from->hash);
+    entry->key = OBJ_VAL(to);
+}
+
 ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
@@ -132,16 +227,18 @@ ObjString* table_find_string(Table* table, const char* chars, int length, uint32
     for (;;) {
         Entry* entry = &table->entries[index];
 
-        if (entry->key == NULL) {
+        if (IS_NIL(entry->key)) {
             // stop if we find an empty non-tombstone entry
             if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-                entry->key->hash == hash &&
-                memcmp(entry->key->chars, chars, length) == 0) {
-            // found it
-            return entry->key;
+        } else if (IS_STRING(entry->key)) {
+            ObjString* key = AS_STRING(entry->key);
+            if (key->length == length && key->hash == hash &&
+                    memcmp(key->chars, chars, length) == 0) {
+                // found it
+                return key;
+            }
         }
 
         index = (index + 1) % table->capacity;
     }
-}
\ No newline at end of file
+}
@@ -5,7 +5,9 @@
 #include "value.h"
 
 typedef struct {
-    ObjString* key;
+    // nil in empty slots and tombstones, their value
+    // tells them apart
+    Value key;
     Value value;
 } Entry;
 
@@ -15,12 +17,31 @@ typedef struct {
     Entry* entries;
 } Table;
 
+#define TABLE_MAX_LOAD 0.75
+// the most keys table_reserve() makes room for, the largest power
+// of two capacity an int holds at its max load
+#define TABLE_RESERVE_MAX (int)((1 << 30) * TABLE_MAX_LOAD)
+
 void init_table(Table* table);
 void free_table(Table* table);
+// room for count keys without growing, up to TABLE_RESERVE_MAX
+void table_reserve(Table* table, int count);
+
+// keys are any value but nil. strings are the common case, the
+// ObjString* versions use the hash the string already has
 bool table_set(Table* table, ObjString* key, Value value);
 bool table_delete(Table* table, ObjString* key);
 bool table_get(Table* table, ObjString* key, Value* value);
+bool table_set_value(Table* table, Value key, Value value);
+bool table_delete_value(Table* table, Value key);
+bool table_get_value(Table* table, Value key, Value* value);
+uint32_t hash_value(Value value);
+
 void table_add_all(Table* from, Table* to);
+// drop the entries whose keys the collection in progress didn't reach
+void table_remove_white(Table* table);
+// point from's entry at to, which hashes the same, or drop it for NULL
+void table_move_string(Table* table, ObjString* from, ObjString* to);
 ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
 
-#endif
\ No newline at end of file
+#endif
@@ -27,14 +27,21 @@ void free_value_array(ValueArray* array) {
     init_value_array(array);
 }
 
-void print_value(Value value) {
+void print_value(FILE* out, Value value) {
+    Writer writer;
+    init_writer(&writer, out);
+    write_value(&writer, value);
+    flush_writer(&writer);
+}
+
+void write_value(Writer* writer, Value value) {
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            write_string(writer, AS_BOOL(value) ? "true" : "false");
             break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-        case VAL_OBJ: print_object(value); break;
+        case VAL_NIL: write_string(writer, "nil"); break;
+        case VAL_NUMBER: write_number(writer, AS_NUMBER(value)); break;
+        case VAL_OBJ: write_object(writer, value); break;
     }
 }
 
@@ -1,29 +1,21 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <stdio.h>
+
+#include "clox.h"
 #include "common.h"
+#include "writer.h"
 
 // forward declare some structs
 // for cyclical dependencies
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct ObjShape ObjShape;
+typedef struct ObjFunction ObjFunction;
+typedef struct ObjUpvalue ObjUpvalue;
 
-typedef enum {
-    VAL_BOOL,
-    VAL_NIL,
-    VAL_NUMBER,
-    VAL_OBJ
-} ValueType;
-
-typedef struct {
-    ValueType type;
-    union {
-        bool boolean;
-        double number;
-        Obj* obj;
-    } as;
-} Value;
-
+// Value itself is in clox.h, embedders pass them in and out
 #define IS_BOOL(value)      ((value).type == VAL_BOOL)
 #define IS_NIL(value)       ((value).type == VAL_NIL)
 #define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
@@ -54,6 +46,7 @@ bool values_equal(Value a, Value b);
 void init_value_array(ValueArray* array);
 void write_value_array(ValueArray* array, Value value);
 void free_value_array(ValueArray* array);
-void print_value(Value value);
+void print_value(FILE* out, Value value);
+void write_value(Writer* writer, Value value);
 
 #endif
\ No newline at end of file
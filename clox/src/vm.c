@@ -1,88 +1,482 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "array.h"
 #include "common.h"
+#include "map.h"
+#include "native.h"
+#include "shape.h"
 #include "vm.h"
 #include "debug.h"
 #include "compiler.h"
 #include "object.h"
 #include "memory.h"
 
-VM vm;
+// most calls between safepoints, so the clock is looked at
+// every few microseconds of script at most
+#ifdef DEBUG_STRESS_GC
+#define SAFEPOINT_CALLS 1
+#else
+#define SAFEPOINT_CALLS 1024
+#endif
 
-static void reset_stack() {
+static void reset_stack(VM* vm) {
     // stack size is constant and only value at pointer
     // can be accessed so no need to clear values
-    vm.stack_top = vm.stack;
+    vm->fiber = &vm->root;
+    vm->root.state = FIBER_RUNNING;
+    vm->frames = vm->root.frames;
+    vm->stack = vm->root.stack;
+    vm->stack_top = vm->stack;
+    vm->frame_count = 0;
+    vm->open_upvalues = NULL;
+    vm->switch_to = NULL;
 }
 
-void init_VM() {
-    reset_stack();
-    vm.objects = NULL;
+void init_VM(VM* vm) {
+    init_fiber(&vm->root, NIL_VAL, STACK_MAX, FRAMES_MAX);
+    // the root is part of the vm, the collector never frees it
+    vm->root.obj.marked = false;
+    vm->root.obj.permanent = true;
+    vm->root.obj.young = false;
+    vm->root.obj.remembered = false;
+    init_scheduler(&vm->scheduler);
+    reset_stack(vm);
+    vm->objects = NULL;
+    vm->backend = BACKEND_STACK;
+    vm->optimize = false;
+    vm->print_passes = false;
+    vm->limits.fuel = 0;
+    vm->limits.seconds = 0;
+    vm->limits.heap = 0;
+    vm->stopped = INTERPRET_OK;
+    vm->running = false;
+    vm->bytes_allocated = 0;
+    vm->next_gc = GC_HEAP_MIN;
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    vm->memory = pages > 0 && page_size > 0 ? (size_t)pages * (size_t)page_size : SIZE_MAX;
+    vm->gc_stretch = 1;
+    vm->gc_end = monotonic_seconds();
+    vm->gray.count = 0;
+    vm->gray.capacity = 0;
+    vm->gray.objects = NULL;
+    vm->kept_chunks = NULL;
+    vm->kept_count = 0;
+    vm->kept_capacity = 0;
+    vm->nursery.start = NULL;
+    vm->nursery.top = NULL;
+    vm->nursery.end = NULL;
+    vm->nursery.remembered.count = 0;
+    vm->nursery.remembered.capacity = 0;
+    vm->nursery.remembered.objects = NULL;
+    vm->nursery.globals_remembered = false;
+    vm->gc_threads = 1;
+    vm->sweeping = false;
+    vm->swept = NULL;
+    vm->swept_last = NULL;
+    vm->sweep_seconds = 0;
+    memset(&vm->gc_stats, 0, sizeof(GcStats));
+    init_writer(&vm->out, stdout);
+    vm->err = stderr;
 
-    init_table(&vm.globals);
-    init_table(&vm.strings);
+    init_table(&vm->globals);
+    init_table(&vm->strings);
+    define_natives(vm);
 }
 
-void free_VM() {
-    free_table(&vm.globals);
-    free_table(&vm.strings);
-    free_objects();
+void reset_globals(VM* vm) {
+    // natives are kept under their own names, anything a script
+    // stored over them is dropped like any other global
+    Table natives;
+    init_table(&natives);
+    for (int i = 0; i < vm->globals.capacity; i++) {
+        Entry* entry = &vm->globals.entries[i];
+        if (IS_STRING(entry->key) && IS_NATIVE(entry->value) &&
+                AS_OBJ(entry->key) == (Obj*)AS_NATIVE(entry->value)->name) {
+            table_set_value(&natives, entry->key, entry->value);
+        }
+    }
+
+    free_table(&vm->globals);
+    vm->globals = natives;
+    close_files(&vm->scheduler);
 }
 
-void push(Value value) {
-    *vm.stack_top++ = value;
+void free_VM(VM* vm) {
+    flush_writer(&vm->out);
+    free_table(&vm->globals);
+    free_table(&vm->strings);
+    free_objects(vm);
+    free_fiber_stack(&vm->root);
+    free_scheduler(&vm->scheduler);
+    free(vm->gray.objects);
+    free(vm->kept_chunks);
+    free(vm->nursery.start);
+    free(vm->nursery.remembered.objects);
 }
 
-Value pop() {
-    return *--vm.stack_top;
+void push(VM* vm, Value value) {
+    *vm->stack_top++ = value;
 }
 
-static Value peek(int distance) {
-    return vm.stack_top[-1 - distance];
+Value pop(VM* vm) {
+    return *--vm->stack_top;
+}
+
+static Value peek(VM* vm, int distance) {
+    return vm->stack_top[-1 - distance];
 }
 
 static bool is_falsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-    ObjString* b = AS_STRING(pop());
-    ObjString* a = AS_STRING(pop());
+// false if the result won't fit in the heap. the operands stay
+// on the stack until it's made, so a collection can't take them
+static bool concatenate(VM* vm) {
+    ObjString* b = AS_STRING(peek(vm, 0));
+    ObjString* a = AS_STRING(peek(vm, 1));
 
     int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    if (!heap_room(vm, sizeof(ObjString) + length + 1)) return false;
 
-    ObjString* result = take_string(chars, length);
-    push(OBJ_VAL(result));
+    ObjString* result = concatenate_strings(vm, a, b);
+    vm->stack_top -= 2;
+    push(vm, OBJ_VAL(result));
+    return true;
 }
 
-void set(Value value) {
-    *(vm.stack_top - 1) = value;
+void set(VM* vm, Value value) {
+    *(vm->stack_top - 1) = value;
 }
 
-static void runtime_error(const char* format, ...) {
+static void runtime_error(VM* vm, const char* format, ...) {
+    // keep errors after anything printed before them
+    flush_writer(&vm->out);
+
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
+
+    // a run that ends parked on files has no frames left
+    if (vm->frame_count > 0) vm->frames[vm->frame_count - 1].ip = vm->ip;
+    for (int i = vm->frame_count - 1; i >= 0; i--) {
+        CallFrame* frame = &vm->frames[i];
+        size_t instruction = frame->ip - frame->chunk->code - 1;
+        fprintf(vm->err, "[line %d] in ", frame->chunk->lines[instruction]);
+        if (frame->function == NULL) {
+            fprintf(vm->err, "script\n");
+        } else {
+            fprintf(vm->err, "%s()\n", frame->function->name->chars);
+        }
+    }
+
+    // the error ends the script, along with every fiber it started
+    reset_fibers(vm);
+    reset_stack(vm);
+}
+
+// a whole number index within the array's bounds
+static bool check_index(VM* vm, Value target, Value index, int* result) {
+    if (!IS_NUMBER(index)) {
+        runtime_error(vm, "Array index must be a number.");
+        return false;
+    }
+
+    double number = AS_NUMBER(index);
+    if (!(number >= 0 && number < AS_ARRAY(target)->count)) {
+        runtime_error(vm, "Array index out of bounds.");
+        return false;
+    }
+    if (number != (int)number) {
+        runtime_error(vm, "Array index must be a whole number.");
+        return false;
+    }
+
+    *result = (int)number;
+    return true;
+}
+
+static bool check_key(VM* vm, Value key) {
+    if (!valid_key(key)) {
+        runtime_error(vm, "Map keys can't be nil or NaN.");
+        return false;
+    }
+    return true;
+}
+
+// target[index], missing map keys read as nil
+static bool get_index(VM* vm, Value target, Value index, Value* value) {
+    if (IS_MAP(target)) {
+        if (!check_key(vm, index)) return false;
+        if (!map_get(AS_MAP(target), index, value)) *value = NIL_VAL;
+        return true;
+    }
+
+    if (!IS_ARRAY(target)) {
+        runtime_error(vm, "Only arrays and maps can be indexed.");
+        return false;
+    }
+
+    int position;
+    if (!check_index(vm, target, index, &position)) return false;
+    *value = array_get(AS_ARRAY(target), position);
+    return true;
+}
+
+static bool set_index(VM* vm, Value target, Value index, Value value) {
+    if (IS_MAP(target)) {
+        if (!check_key(vm, index)) return false;
+        map_set(vm, AS_MAP(target), index, value);
+        return true;
+    }
+
+    if (!IS_ARRAY(target)) {
+        runtime_error(vm, "Only arrays and maps can be indexed.");
+        return false;
+    }
+
+    int position;
+    if (!check_index(vm, target, index, &position)) return false;
+    array_set(vm, AS_ARRAY(target), position, value);
+    return true;
+}
+
+// the entry for shape at a property access site, filled in on a
+// miss. NULL if instances of shape lack the field and add is false,
+// otherwise the entry says where to put it. once every way is taken
+// scratch is filled in instead and the site stops learning shapes
+static CacheEntry* cache_lookup(VM* vm, InlineCache* cache, ObjShape* shape,
+        ObjString* name, bool add, CacheEntry* scratch) {
+    CacheEntry* entry = scratch;
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        CacheEntry* way = &cache->entries[i];
+        if (way->shape == shape) return way;
+        if (way->shape == NULL) {
+            entry = way;
+            break;
+        }
+    }
+
+    int slot = shape_slot(shape, name);
+    if (slot == -1 && !add) return NULL;
+
+    entry->shape = shape;
+    entry->next = NULL;
+    entry->slot = slot;
+    if (slot == -1) {
+        entry->next = shape_add(vm, shape, name);
+        entry->slot = entry->next->count - 1;
+    }
+    return entry;
+}
+
+static bool call(VM* vm, ObjFunction* function, Value* upvalues, int arg_count) {
+    if (arg_count != function->arity) {
+        runtime_error(vm, "Expected %d arguments but got %d.", function->arity, arg_count);
+        return false;
+    }
+    if (vm->frame_count == FRAMES_MAX) {
+        runtime_error(vm, "Stack overflow.");
+        return false;
+    }
+
+    if (vm->frame_count == vm->fiber->frame_capacity ||
+            vm->stack_top + UINT8_COUNT > vm->stack + vm->fiber->stack_capacity) {
+        grow_fiber(vm);
+    }
+
+    vm->frames[vm->frame_count - 1].ip = vm->ip;
+    CallFrame* frame = &vm->frames[vm->frame_count++];
+    frame->function = function;
+    frame->chunk = &function->chunk;
+    frame->slots = vm->stack_top - arg_count - 1;
+    frame->upvalues = upvalues;
+
+    vm->chunk = &function->chunk;
+    vm->ip = function->chunk.code;
+    return true;
+}
+
+// runs to completion right away, in place of callee and its arguments
+static bool call_native(VM* vm, ObjNative* native, int arg_count) {
+    if (native->arity != ARITY_ANY && arg_count != native->arity) {
+        runtime_error(vm, "Expected %d arguments but got %d.", native->arity, arg_count);
+        return false;
+    }
+
+    Value* args = vm->stack_top - arg_count;
+    Value result;
+    if (native->number != NULL) {
+        double numbers[NUMBER_ARGS_MAX];
+        for (int i = 0; i < arg_count; i++) {
+            if (!IS_NUMBER(args[i])) {
+                runtime_error(vm, "%s() takes numbers.", native->name->chars);
+                return false;
+            }
+            numbers[i] = AS_NUMBER(args[i]);
+        }
+        result = NUMBER_VAL(native->number(numbers));
+    } else if (native->function != NULL) {
+        if (!native->function(vm, arg_count, args, &result)) {
+            runtime_error(vm, "%s", AS_CSTRING(result));
+            return false;
+        }
+    } else {
+        runtime_error(vm, "%s() has to be defined again after a snapshot is restored.",
+            native->name->chars);
+        return false;
+    }
+
+    vm->stack_top = args - 1;
+    push(vm, result);
+    // a fiber switching away gets what it's resumed with
+    // in place of result when it runs again
+    if (vm->switch_to != NULL) switch_fiber(vm);
+    return true;
+}
+
+// callee sits below its arguments and is replaced by the result,
+// for a function once it returns
+static bool call_value(VM* vm, Value callee, int arg_count) {
+    if (IS_CLOSURE(callee)) {
+        ObjClosure* closure = AS_CLOSURE(callee);
+        return call(vm, closure->function, closure->upvalues, arg_count);
+    }
+    if (IS_FUNCTION(callee)) return call(vm, AS_FUNCTION(callee), NULL, arg_count);
+
+    if (IS_CLASS(callee)) {
+        if (arg_count != 0) {
+            runtime_error(vm, "Expected 0 arguments but got %d.", arg_count);
+            return false;
+        }
+
+        ObjClass* klass = AS_CLASS(callee);
+        vm->stack_top[-1] = OBJ_VAL(new_instance(vm, klass, klass->root));
+        return true;
+    }
+
+    if (!IS_NATIVE(callee)) {
+        runtime_error(vm, "Can only call functions and classes.");
+        return false;
+    }
+    return call_native(vm, AS_NATIVE(callee), arg_count);
+}
+
+double monotonic_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// budgets for a chunk that's about to run. the first call
+// reaches a safepoint straight away and starts the countdown
+static void start_limits(VM* vm) {
+    vm->fuel = vm->limits.fuel == 0 ? UINT64_MAX : vm->limits.fuel;
+    vm->deadline = vm->limits.seconds > 0 ? monotonic_seconds() + vm->limits.seconds : 0;
+    vm->countdown = 0;
+    vm->period = 0;
+    vm->stopped = INTERPRET_OK;
+}
+
+void request_safepoint(VM* vm) {
+    // charged for the calls made so far instead of a whole period
+    vm->period -= vm->countdown;
+    vm->countdown = 0;
+}
+
+// reached every period calls, false once a limit ends the run
+static bool safepoint(VM* vm) {
+    vm->fuel -= vm->period;
+    if (vm->fuel == 0) {
+        vm->stopped = INTERPRET_OUT_OF_FUEL;
+        runtime_error(vm, "Ran out of fuel.");
+        return false;
+    }
+    if (vm->deadline != 0 && monotonic_seconds() >= vm->deadline) {
+        vm->stopped = INTERPRET_TIMEOUT;
+        runtime_error(vm, "Ran past the deadline.");
+        return false;
+    }
+#ifdef DEBUG_STRESS_GC
+    collect_young(vm);
+    collect_garbage(vm);
+#else
+    // a full collection empties the remembered set first, so its
+    // objects don't pile up to be walked at the end of the run
+    bool full = vm->bytes_allocated > vm->next_gc;
+    if (full || vm->nursery.top - vm->nursery.start >= NURSERY_SIZE / 2 ||
+            vm->nursery.remembered.count >= REMEMBERED_MAX) {
+        collect_young(vm);
+    }
+    if (full) collect_garbage(vm);
+#endif
+    if (vm->limits.heap != 0 && vm->bytes_allocated > vm->limits.heap) {
+        runtime_error(vm, "Out of memory.");
+        return false;
+    }
+
+    vm->period = vm->fuel < SAFEPOINT_CALLS ? (int)vm->fuel : SAFEPOINT_CALLS;
+    // this call is the first of them
+    vm->countdown = vm->period - 1;
+    return true;
+}
+
+int wait_limit(VM* vm) {
+    if (vm->deadline == 0) return -1;
+    double left = vm->deadline - monotonic_seconds();
+    if (left <= 0) return 0;
+    // rounded up so the wait doesn't end just short of it
+    return (int)(left * 1e3) + 1;
+}
 
-    size_t instruction = vm.ip - vm.chunk->code - 1;
-    int line = vm.chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+// the open upvalue for slot, made if there isn't one yet
+static ObjUpvalue* capture_upvalue(VM* vm, Value* slot) {
+    ObjUpvalue* previous = NULL;
+    ObjUpvalue* upvalue = vm->open_upvalues;
+    while (upvalue != NULL && upvalue->location > slot) {
+        previous = upvalue;
+        upvalue = upvalue->next;
+    }
+    if (upvalue != NULL && upvalue->location == slot) return upvalue;
 
-    reset_stack();
+    ObjUpvalue* created = new_upvalue(vm, slot);
+    created->next = upvalue;
+    if (previous == NULL) {
+        vm->open_upvalues = created;
+    } else {
+        previous->next = created;
+    }
+    return created;
 }
 
-static InterpretResult run() {
-    #define READ_BYTE() (*vm.ip++)
-    #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+// close every open upvalue at or above last
+static void close_upvalues(VM* vm, Value* last) {
+    while (vm->open_upvalues != NULL && vm->open_upvalues->location >= last) {
+        ObjUpvalue* upvalue = vm->open_upvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        write_barrier(vm, (Obj*)upvalue, upvalue->closed);
+        vm->open_upvalues = upvalue->next;
+    }
+}
+
+static InterpretResult run(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+
+    #define READ_BYTE() (*vm->ip++)
+    #define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
     #define READ_STRING() AS_STRING(READ_CONSTANT())
+    #define READ_SHORT() (vm->ip += 2, (uint16_t)(vm->ip[-2] | (vm->ip[-1] << 8)))
 
     // use do-while loop to avoid macro expansion
     // syntax issues (needs to be in a block and have semicolon at end
@@ -90,63 +484,66 @@ static InterpretResult run() {
     // flip a and b to reverse order of stack operands 
     #define BINARY_OP(value_type, op) \
         do { \
-            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-                runtime_error("Operands must be numbers."); \
+            if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+                runtime_error(vm, "Operands must be numbers."); \
                 return INTERPRET_RUNTIME_ERROR; \
             } \
-            double b = AS_NUMBER(pop()); \
-            double a = AS_NUMBER(pop()); \
-            push(value_type(a op b)); \
+            double b = AS_NUMBER(pop(vm)); \
+            double a = AS_NUMBER(pop(vm)); \
+            push(vm, value_type(a op b)); \
         } while (false)
 
     for (;;) {
         #ifdef DEBUG_TRACE_EXECUTION
             printf("        ");
-            for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+            for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
                 printf("[ ");
-                print_value(*slot);
+                print_value(stdout, *slot);
                 printf(" ]");
             }
             printf("\n");
-            disassemble_instruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+            disassemble_instruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
         #endif
 
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
-                push(constant);
+                push(vm, constant);
                 break;
             }
-            case OP_NIL: push(NIL_VAL); break;
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
+            case OP_NIL: push(vm, NIL_VAL); break;
+            case OP_TRUE: push(vm, BOOL_VAL(true)); break;
+            case OP_FALSE: push(vm, BOOL_VAL(false)); break;
             case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(values_equal(a, b)));
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(values_equal(a, b)));
                 break;
             }
             case OP_NEGATE: 
-                if (!IS_NUMBER(peek(0))) {
-                    runtime_error("Operand must be a number.");
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtime_error(vm, "Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
                 break;
             case OP_GREATER:    BINARY_OP(BOOL_VAL, >); break;
             case OP_LESS:       BINARY_OP(BOOL_VAL, <); break;
             case OP_ADD: {
                 // support both arithmetic + and string concat
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
+                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    if (!concatenate(vm)) {
+                        runtime_error(vm, "Out of memory.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
+                    double b = AS_NUMBER(pop(vm));
+                    double a = AS_NUMBER(pop(vm));
+                    push(vm, NUMBER_VAL(a + b));
                 } else {
-                    runtime_error(
+                    runtime_error(vm, 
                         "Operands must be two numbers or two strings."
                     );
                     return INTERPRET_RUNTIME_ERROR;
@@ -157,66 +554,450 @@ static InterpretResult run() {
             case OP_MULTIPLY:   BINARY_OP(NUMBER_VAL, *); break;
             case OP_DIVIDE:     BINARY_OP(NUMBER_VAL, /); break;
             case OP_NOT:
-                push(BOOL_VAL(is_falsey(pop())));
+                push(vm, BOOL_VAL(is_falsey(pop(vm))));
                 break;
-            case OP_POP: pop(); break;
+            case OP_POP: pop(vm); break;
+            case OP_DUP: push(vm, peek(vm, 0)); break;
             case OP_GET_GLOBAL: {
                 ObjString* name = READ_STRING();
                 Value value;
-                if (!table_get(&vm.globals, name, &value)) {
-                    runtime_error("Undefined variable '%s'.", name->chars);
+                if (!table_get(&vm->globals, name, &value)) {
+                    runtime_error(vm, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(value);
+                push(vm, value);
                 break;
             }
             case OP_SET_GLOBAL: {
                 ObjString* name = READ_STRING();
-                if (table_set(&vm.globals, name, peek(0))) {
-                    table_delete(&vm.globals, name);
-                    runtime_error("Undefined variable '%s'.", name->chars);
+                globals_barrier(vm, peek(vm, 0));
+                if (table_set(&vm->globals, name, peek(vm, 0))) {
+                    table_delete(&vm->globals, name);
+                    runtime_error(vm, "Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING();
-                table_set(&vm.globals, name, peek(0));
-                pop();
+                globals_barrier(vm, peek(vm, 0));
+                table_set(&vm->globals, name, peek(vm, 0));
+                pop(vm);
                 break;
             }
             case OP_PRINT: {
-                print_value(pop());
-                printf("\n");
+                write_value(&vm->out, pop(vm));
+                write_newline(&vm->out);
+                break;
+            }
+            case OP_BUILD_ARRAY: {
+                int count = READ_BYTE();
+                ObjArray* array = new_array(vm);
+                array_reserve(vm, array, count);
+                for (Value* element = vm->stack_top - count; element < vm->stack_top; element++) {
+                    array_push(vm, array, *element);
+                }
+
+                vm->stack_top -= count;
+                push(vm, OBJ_VAL(array));
+                break;
+            }
+            case OP_BUILD_MAP: {
+                ObjMap* map = new_map(vm);
+                map_reserve(vm, map, READ_BYTE());
+                push(vm, OBJ_VAL(map));
+                break;
+            }
+            case OP_MAP_ENTRY: {
+                // the map stays under each key and value pushed
+                if (!check_key(vm, peek(vm, 1))) return INTERPRET_RUNTIME_ERROR;
+
+                map_set(vm, AS_MAP(peek(vm, 2)), peek(vm, 1), peek(vm, 0));
+                vm->stack_top -= 2;
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value value;
+                if (!get_index(vm, peek(vm, 1), peek(vm, 0), &value)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                vm->stack_top -= 2;
+                push(vm, value);
+                break;
+            }
+            case OP_SET_INDEX: {
+                // assignment is an expression, the value is left
+                // in place of the target
+                Value value = peek(vm, 0);
+                if (!set_index(vm, peek(vm, 2), peek(vm, 1), value)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                vm->stack_top -= 3;
+                push(vm, value);
+                break;
+            }
+            case OP_CALL: {
+                int arg_count = READ_BYTE();
+                if (--vm->countdown < 0 && !safepoint(vm)) return INTERPRET_RUNTIME_ERROR;
+                if (!call_value(vm, peek(vm, arg_count), arg_count)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frame_count - 1];
+                break;
+            }
+            case OP_GET_LOCAL:
+                push(vm, frame->slots[READ_BYTE()]);
+                break;
+            case OP_SET_LOCAL:
+                frame->slots[READ_BYTE()] = peek(vm, 0);
+                break;
+            case OP_GET_UPVALUE: {
+                Value value = frame->upvalues[READ_BYTE()];
+                if (IS_UPVALUE(value)) value = *AS_UPVALUE(value)->location;
+                push(vm, value);
+                break;
+            }
+            case OP_SET_UPVALUE: {
+                // only shared upvalues are ever assigned
+                ObjUpvalue* upvalue = AS_UPVALUE(frame->upvalues[READ_BYTE()]);
+                *upvalue->location = peek(vm, 0);
+                // an open one is a slot on its fiber's stack
+                Obj* holder = upvalue->location == &upvalue->closed ? (Obj*)upvalue : (Obj*)upvalue->fiber;
+                write_barrier(vm, holder, peek(vm, 0));
+                break;
+            }
+            case OP_CLOSURE: {
+                ObjClosure* closure = new_closure(vm, AS_FUNCTION(READ_CONSTANT()));
+                push(vm, OBJ_VAL(closure));
+                for (int i = 0; i < closure->upvalue_count; i++) {
+                    uint8_t kind = READ_BYTE();
+                    uint8_t index = READ_BYTE();
+                    switch (kind) {
+                        case CAPTURE_UPVALUE:
+                            closure->upvalues[i] = frame->upvalues[index];
+                            break;
+                        case CAPTURE_LOCAL:
+                            closure->upvalues[i] = OBJ_VAL(capture_upvalue(vm, frame->slots + index));
+                            break;
+                        case CAPTURE_COPY:
+                            closure->upvalues[i] = frame->slots[index];
+                            break;
+                    }
+                    write_barrier(vm, (Obj*)closure, closure->upvalues[i]);
+                }
+                break;
+            }
+            case OP_CLOSE_UPVALUE:
+                close_upvalues(vm, vm->stack_top - 1);
+                pop(vm);
+                break;
+            case OP_CLASS: {
+                // every class has its own root so instances of
+                // different classes never share a shape
+                ObjString* name = READ_STRING();
+                push(vm, OBJ_VAL(new_class(vm, name, new_shape(vm, NULL, NULL))));
+                break;
+            }
+            case OP_GET_PROPERTY: {
+                ObjString* name = READ_STRING();
+                InlineCache* cache = &vm->chunk->caches[READ_SHORT()];
+                if (!IS_INSTANCE(peek(vm, 0))) {
+                    runtime_error(vm, "Only instances have properties.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // a site that only ever sees one shape hits the first way
+                ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+                CacheEntry* entry = &cache->entries[0];
+                CacheEntry scratch;
+                if (entry->shape != instance->shape) {
+                    entry = cache_lookup(vm, cache, instance->shape, name, false, &scratch);
+                    if (entry == NULL) {
+                        runtime_error(vm, "Undefined property '%s'.", name->chars);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+
+                vm->stack_top[-1] = instance->fields[entry->slot];
+                break;
+            }
+            case OP_SET_PROPERTY: {
+                ObjString* name = READ_STRING();
+                InlineCache* cache = &vm->chunk->caches[READ_SHORT()];
+                if (!IS_INSTANCE(peek(vm, 1))) {
+                    runtime_error(vm, "Only instances have fields.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+                CacheEntry* entry = &cache->entries[0];
+                CacheEntry scratch;
+                if (entry->shape != instance->shape) {
+                    entry = cache_lookup(vm, cache, instance->shape, name, true, &scratch);
+                }
+                if (entry->next != NULL) instance_reshape(vm, instance, entry->next);
+                instance->fields[entry->slot] = peek(vm, 0);
+                write_barrier(vm, (Obj*)instance, peek(vm, 0));
+
+                // the value is left in place of the instance
+                Value value = pop(vm);
+                vm->stack_top[-1] = value;
                 break;
             }
             case OP_RETURN: {
-                // exit interpreter
-                return INTERPRET_OK;
+                // the script has nothing to return. it ends once every
+                // fiber it started has, and a fiber ends with its function
+                if (vm->frame_count == 1) {
+                    Value result = vm->fiber == &vm->root ? NIL_VAL : pop(vm);
+                    if (!finish_fiber(vm, result)) {
+                        // the rest were parked on files past the deadline
+                        if (vm->stopped == INTERPRET_OK) return INTERPRET_OK;
+                        runtime_error(vm, "Ran past the deadline.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    frame = &vm->frames[vm->frame_count - 1];
+                    break;
+                }
+
+                Value result = pop(vm);
+                close_upvalues(vm, frame->slots);
+                vm->stack_top = frame->slots;
+                push(vm, result);
+
+                vm->frame_count--;
+                frame = &vm->frames[vm->frame_count - 1];
+                vm->chunk = frame->chunk;
+                vm->ip = frame->ip;
+                break;
             }
         }
     }
 
     #undef READ_BYTE
     #undef READ_CONSTANT
+    #undef READ_SHORT
     #undef BINARY_OP
     #undef READ_STRING
 }
 
-InterpretResult interpret(const char* source) {
+static inline Value rk_value(Value* registers, Value* constants, uint8_t operand) {
+    if (operand & RK_CONSTANT) return constants[operand & ~RK_CONSTANT];
+    return registers[operand];
+}
+
+static InterpretResult run_register(VM* vm) {
+    // registers live in the value stack, the compiler never
+    // hands out more than REGISTERS_MAX of them
+    Value* registers = vm->stack;
+    Value* constants = vm->chunk->constants.values;
+    // keep the stack clear of the register window for helpers
+    // that still push and pop. the collector sees every register,
+    // so none can be left over from an earlier run
+    vm->stack_top = vm->stack + REGISTERS_MAX;
+    for (int i = 0; i < REGISTERS_MAX; i++) registers[i] = NIL_VAL;
+    // ip is cached locally since operands make it the hottest
+    // variable in the loop, store it back before reporting errors
+    uint8_t* ip = vm->ip;
+
+    #define READ_BYTE() (*ip++)
+    #define READ_STRING() AS_STRING(constants[READ_BYTE()])
+    #define READ_RK() rk_value(registers, constants, READ_BYTE())
+    #define RUNTIME_ERROR(...) \
+        do { \
+            vm->ip = ip; \
+            runtime_error(vm, __VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+
+    // operands are read before dst is written since the
+    // allocator usually reuses an operand's register for it
+    #define BINARY_OP(value_type, op) \
+        do { \
+            uint8_t dst = READ_BYTE(); \
+            Value a = READ_RK(); \
+            Value b = READ_RK(); \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            registers[dst] = value_type(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } while (false)
+
+    for (;;) {
+        #ifdef DEBUG_TRACE_EXECUTION
+            disassemble_instruction(vm->chunk, (int)(ip - vm->chunk->code));
+        #endif
+
+        uint8_t instruction;
+        switch (instruction = READ_BYTE()) {
+            case ROP_LOAD_CONSTANT: {
+                uint8_t dst = READ_BYTE();
+                registers[dst] = constants[READ_BYTE()];
+                break;
+            }
+            case ROP_NIL: registers[READ_BYTE()] = NIL_VAL; break;
+            case ROP_TRUE: registers[READ_BYTE()] = BOOL_VAL(true); break;
+            case ROP_FALSE: registers[READ_BYTE()] = BOOL_VAL(false); break;
+            case ROP_EQUAL: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_RK();
+                Value b = READ_RK();
+                registers[dst] = BOOL_VAL(values_equal(a, b));
+                break;
+            }
+            case ROP_GREATER:   BINARY_OP(BOOL_VAL, >); break;
+            case ROP_LESS:      BINARY_OP(BOOL_VAL, <); break;
+            case ROP_NEGATE: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_RK();
+                if (!IS_NUMBER(a)) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+
+                registers[dst] = NUMBER_VAL(-AS_NUMBER(a));
+                break;
+            }
+            case ROP_ADD: {
+                uint8_t dst = READ_BYTE();
+                Value a = READ_RK();
+                Value b = READ_RK();
+                if (IS_NUMBER(a) && IS_NUMBER(b)) {
+                    registers[dst] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+                } else if (IS_STRING(a) && IS_STRING(b)) {
+                    // concatenate(vm) works on the stack
+                    push(vm, a);
+                    push(vm, b);
+                    if (!concatenate(vm)) RUNTIME_ERROR("Out of memory.");
+                    registers[dst] = pop(vm);
+                } else {
+                    RUNTIME_ERROR(
+                        "Operands must be two numbers or two strings."
+                    );
+                }
+                break;
+            }
+            case ROP_SUBTRACT:  BINARY_OP(NUMBER_VAL, -); break;
+            case ROP_MULTIPLY:  BINARY_OP(NUMBER_VAL, *); break;
+            case ROP_DIVIDE:    BINARY_OP(NUMBER_VAL, /); break;
+            case ROP_NOT: {
+                uint8_t dst = READ_BYTE();
+                registers[dst] = BOOL_VAL(is_falsey(READ_RK()));
+                break;
+            }
+            case ROP_GET_GLOBAL: {
+                uint8_t dst = READ_BYTE();
+                ObjString* name = READ_STRING();
+                if (!table_get(&vm->globals, name, &registers[dst])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
+                }
+                break;
+            }
+            case ROP_SET_GLOBAL: {
+                ObjString* name = READ_STRING();
+                Value value = READ_RK();
+                globals_barrier(vm, value);
+                if (table_set(&vm->globals, name, value)) {
+                    table_delete(&vm->globals, name);
+                    RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
+                }
+                break;
+            }
+            case ROP_DEFINE_GLOBAL: {
+                ObjString* name = READ_STRING();
+                Value value = READ_RK();
+                globals_barrier(vm, value);
+                table_set(&vm->globals, name, value);
+                break;
+            }
+            case ROP_PRINT: {
+                write_value(&vm->out, READ_RK());
+                write_newline(&vm->out);
+                break;
+            }
+            case ROP_RETURN: {
+                return INTERPRET_OK;
+            }
+        }
+    }
+
+    #undef READ_BYTE
+    #undef READ_STRING
+    #undef READ_RK
+    #undef RUNTIME_ERROR
+    #undef BINARY_OP
+}
+
+InterpretResult interpret(VM* vm, const char* source, size_t length) {
     Chunk chunk;
     init_chunk(&chunk);
+    chunk.backend = vm->backend;
 
-    if (!compile(source, &chunk)) {
+    if (!compile(vm, source, length, &chunk)) {
         free_chunk(&chunk);
         return INTERPRET_COMPILE_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    InterpretResult result = run_chunk(vm, &chunk);
+    free_chunk(&chunk);
+    return result;
+}
 
-    InterpretResult result = run();
+InterpretResult run_chunk(VM* vm, Chunk* chunk) {
+    return run_chunk_from(vm, chunk, 0);
+}
 
-    free_chunk(&chunk);
+InterpretResult run_chunk_from(VM* vm, Chunk* chunk, int offset) {
+    reset_stack(vm);
+    vm->chunk = chunk;
+    vm->ip = chunk->code + offset;
+
+    CallFrame* frame = &vm->frames[vm->frame_count++];
+    frame->function = NULL;
+    frame->chunk = chunk;
+    frame->ip = vm->ip;
+    frame->slots = vm->stack;
+    frame->upvalues = NULL;
+
+    // register code never calls, so it runs without safepoints
+    start_limits(vm);
+    vm->running = true;
+    InterpretResult result = chunk->backend == BACKEND_REGISTER
+        ? run_register(vm)
+        : run(vm);
+    // nothing young outlives a run, so what the embedder is given
+    // between runs stays put. a full collection that came due late
+    // in the run is done now too, with the chunk kept for whoever
+    // runs or saves it again, even if an error dropped its frame
+    collect_young(vm);
+#ifdef DEBUG_STRESS_GC
+    bool full = true;
+#else
+    bool full = vm->bytes_allocated > vm->next_gc;
+#endif
+    if (full) {
+        keep_chunk(vm, chunk);
+        collect_garbage(vm);
+        release_chunk(vm, chunk);
+    }
+    vm->running = false;
+    if (result == INTERPRET_RUNTIME_ERROR && vm->stopped != INTERPRET_OK) result = vm->stopped;
+
+    flush_writer(&vm->out);
     return result;
+}
+
+int exit_code(InterpretResult result) {
+    switch (result) {
+        case INTERPRET_COMPILE_ERROR: return 65;
+        case INTERPRET_RUNTIME_ERROR: return 70;
+        case INTERPRET_OUT_OF_FUEL:
+        case INTERPRET_TIMEOUT: return 75;
+        default: return 0;
+    }
+}
+
+void set_output(VM* vm, FILE* out) {
+    flush_writer(&vm->out);
+    init_writer(&vm->out, out);
 }
\ No newline at end of file
@@ -1,36 +1,144 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <pthread.h>
+
 #include "chunk.h"
+#include "fiber.h"
+#include "object.h"
 #include "value.h"
 #include "table.h"
+#include "writer.h"
+
+#define FRAMES_MAX 64
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
 
-#define STACK_MAX 256
+// caps on every run of a chunk, 0 for none. fuel counts calls,
+// the only way a script without loops runs for long: the code
+// between two calls is straight-line and at most a chunk long
+typedef struct {
+    uint64_t fuel;
+    double seconds;
+    // bytes the heap can hold, across runs. going over is a
+    // runtime error once a collection can't bring it back under
+    size_t heap;
+} Limits;
 
+// strings made while a chunk runs are bumped off here, most are
+// garbage by the next young collection. the rest are copied out
 typedef struct {
+    char* start;
+    char* top;
+    char* end;
+    // old objects that have been given young strings since the
+    // last young collection, and whether globals have
+    ObjStack remembered;
+    bool globals_remembered;
+} Nursery;
+
+// every piece of interpreter state hangs off this struct, so a
+// process can host as many independent instances as it likes
+struct VM {
+    // the running frame's chunk and ip
     Chunk* chunk;
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    // the running fiber's frames and stack, saved back to it
+    // when another fiber takes over
+    CallFrame* frames;
+    int frame_count;
+    Value* stack;
     Value* stack_top;
+    ObjUpvalue* open_upvalues;
+
+    ObjFiber* fiber;
+    // the script's own fiber, which lives as long as the vm
+    ObjFiber root;
+    // set by a native to hand control to another fiber once it returns
+    ObjFiber* switch_to;
+    Scheduler scheduler;
+
+    Limits limits;
+    // calls left until the next safepoint, which charges them to
+    // fuel and looks at the clock. period is how many it started at
+    int countdown;
+    int period;
+    uint64_t fuel;
+    // monotonic seconds, 0 for none
+    double deadline;
+    // the limit that ended the run, INTERPRET_OK if none did
+    InterpretResult stopped;
+
     Table strings;
     Table globals;
 
-    // ref linked list for garbage collection
-    Obj* objects;
-} VM;
+    // instruction format scripts are compiled to
+    Backend backend;
+    // run the IR passes before emitting bytecode
+    bool optimize;
+    bool print_passes;
 
-typedef enum {
-    INTERPRET_OK,
-    INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
-} InterpretResult;
+    // script output is buffered, errors are reported straight
+    // to err after flushing it
+    Writer out;
+    FILE* err;
 
-extern VM vm;
+    // ref linked list for garbage collection
+    Obj* objects;
+    // objects are only collected while a chunk runs
+    bool running;
+    // bytes live after the last collection plus allocated since,
+    // and how many make the next safepoint collect
+    size_t bytes_allocated;
+    size_t next_gc;
+    // the machine's memory, which caps the heap even without a
+    // limit so an allocation too big for it is a runtime error
+    size_t memory;
+    // multiplies the headroom left after a collection, see pace()
+    double gc_stretch;
+    // monotonic seconds
+    double gc_end;
+    // objects marked and not yet traced from, kept between
+    // collections that mark on this thread
+    ObjStack gray;
+    // chunks kept between runs, see keep_chunk()
+    Chunk** kept_chunks;
+    int kept_count;
+    int kept_capacity;
+    Nursery nursery;
+    // threads a collection can mark and sweep with, 1 keeps it
+    // all on the thread running the script
+    int gc_threads;
+    // a sweep handed to a thread of its own, which has what it
+    // kept in swept until finish_sweep() takes it back
+    bool sweeping;
+    pthread_t sweeper;
+    Obj* swept;
+    Obj* swept_last;
+    double sweep_seconds;
+    GcStats gc_stats;
+};
 
-void init_VM();
-void free_VM();
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+void init_VM(VM* vm);
+void free_VM(VM* vm);
+// drop every global except the natives, between unrelated scripts
+void reset_globals(VM* vm);
+InterpretResult interpret(VM* vm, const char* source, size_t length);
+// run an already compiled chunk, which can be run again
+// afterwards as long as vm is the one it was compiled with
+InterpretResult run_chunk(VM* vm, Chunk* chunk);
+// starting at offset, for chunks that have code appended
+InterpretResult run_chunk_from(VM* vm, Chunk* chunk, int offset);
+double monotonic_seconds();
+// have the next call be a safepoint, for a collection that's due
+void request_safepoint(VM* vm);
+// ms left before the running chunk's deadline, for waits that
+// block. -1 if it has none, 0 once it's passed
+int wait_limit(VM* vm);
+// the process exit status a run ending with result has
+int exit_code(InterpretResult result);
+// flushes what was printed so far before switching
+void set_output(VM* vm, FILE* out);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
 #endif
\ No newline at end of file
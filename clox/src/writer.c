@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+void init_writer(Writer* writer, FILE* file) {
+    writer->file = file;
+    writer->count = 0;
+#ifdef DEBUG_TRACE_EXECUTION
+    // keep output in step with the trace written straight to stdout
+    writer->flush_lines = true;
+#else
+    writer->flush_lines = isatty(fileno(file));
+#endif
+}
+
+void flush_writer(Writer* writer) {
+    if (writer->count == 0) return;
+    fwrite(writer->buffer, 1, writer->count, writer->file);
+    fflush(writer->file);
+    writer->count = 0;
+}
+
+void write_bytes(Writer* writer, const char* bytes, int length) {
+    if (writer->count + length > WRITER_BUFFER_SIZE) {
+        flush_writer(writer);
+
+        // too big to be worth copying through the buffer
+        if (length > WRITER_BUFFER_SIZE) {
+            fwrite(bytes, 1, length, writer->file);
+            return;
+        }
+    }
+
+    memcpy(writer->buffer + writer->count, bytes, length);
+    writer->count += length;
+}
+
+void write_string(Writer* writer, const char* string) {
+    write_bytes(writer, string, (int)strlen(string));
+}
+
+void write_newline(Writer* writer) {
+    if (writer->count == WRITER_BUFFER_SIZE) flush_writer(writer);
+    writer->buffer[writer->count++] = '\n';
+    if (writer->flush_lines) flush_writer(writer);
+}
+
+void write_number(Writer* writer, double number) {
+    char buffer[32];
+    write_bytes(writer, buffer, format_number(buffer, number));
+}
+
+// digits of value, which is less than 10^6, right aligned at end
+static char* format_digits(char* end, uint32_t value) {
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+// %g prints 6 significant digits, in plain notation when the
+// exponent is from -4 to 5. numbers in that range are rounded
+// to 6 digits here directly and anything else, or any rounding
+// too close to call in double precision, goes to snprintf
+int format_number(char* buffer, double number) {
+    double magnitude = fabs(number);
+    char* out = buffer;
+    if (signbit(number)) *out++ = '-';
+
+    // whole numbers are the common case in scripts
+    if (magnitude < 1e6 && magnitude == (uint32_t)magnitude) {
+        char digits[8];
+        char* first = format_digits(digits + sizeof(digits), (uint32_t)magnitude);
+        int length = (int)(digits + sizeof(digits) - first);
+        memcpy(out, first, length);
+        return (int)(out - buffer) + length;
+    }
+
+    if (!(magnitude >= 1e-4 && magnitude < 1e6)) {
+        return snprintf(buffer, 32, "%g", number);
+    }
+
+    int exponent = 5;
+    while (exponent >= 0 ? magnitude < powers_of_ten[exponent]
+                         : magnitude * powers_of_ten[-exponent] < 1) {
+        exponent--;
+    }
+
+    // scale so the 6 significant digits are the integer part,
+    // one rounding since every power used is exact
+    double scaled = magnitude * powers_of_ten[5 - exponent];
+    double whole = floor(scaled);
+    double fraction = scaled - whole;
+    if (fabs(fraction - 0.5) < 1e-6 || scaled < 1e5) {
+        return snprintf(buffer, 32, "%g", number);
+    }
+
+    uint32_t digits = (uint32_t)whole + (fraction > 0.5);
+    if (digits >= 1000000) {
+        // rounded up to the next power of ten
+        digits /= 10;
+        exponent++;
+        if (exponent > 5) return snprintf(buffer, 32, "%g", number);
+    }
+
+    char text[6];
+    format_digits(text + 6, digits);
+
+    // drop trailing zeros after the point
+    int kept = 6;
+    int whole_digits = exponent >= 0 ? exponent + 1 : 0;
+    while (kept > whole_digits && text[kept - 1] == '0') kept--;
+
+    if (exponent >= 0) {
+        memcpy(out, text, whole_digits);
+        out += whole_digits;
+        if (kept > whole_digits) *out++ = '.';
+    } else {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = -1; i > exponent; i--) *out++ = '0';
+    }
+    memcpy(out, text + whole_digits, kept - whole_digits);
+    out += kept - whole_digits;
+
+    return (int)(out - buffer);
+}
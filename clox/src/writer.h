@@ -0,0 +1,28 @@
+#ifndef clox_writer_h
+#define clox_writer_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+#define WRITER_BUFFER_SIZE 8192
+
+// buffers script output in front of a FILE, flushed when full,
+// when its owner says so and after every line on a terminal
+typedef struct {
+    FILE* file;
+    bool flush_lines;
+    int count;
+    char buffer[WRITER_BUFFER_SIZE];
+} Writer;
+
+void init_writer(Writer* writer, FILE* file);
+void flush_writer(Writer* writer);
+void write_bytes(Writer* writer, const char* bytes, int length);
+void write_string(Writer* writer, const char* string);
+void write_newline(Writer* writer);
+// same text printf("%g") gives
+void write_number(Writer* writer, double number);
+int format_number(char* buffer, double number);
+
+#endif
@@ -0,0 +1,140 @@
+// the embedding interface, built against the library by make test
+// with nothing but clox.h. scripts here don't print, what they
+// leave in globals is checked
+
+#include <stdio.h>
+#include <string.h>
+
+#include "clox.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    failures++;
+}
+
+static bool global_is(VM* vm, const char* name, const char* expected) {
+    Value value;
+    const char* chars;
+    if (!clox_get_global(vm, name, &value) || !clox_to_string(value, &chars)) return false;
+    return strcmp(chars, expected) == 0;
+}
+
+// values made and read through the interface, not their fields
+static void values() {
+    VM* vm = clox_new_vm();
+    clox_set_global(vm, "n", clox_number(2));
+    clox_set_global(vm, "yes", clox_bool(true));
+    clox_set_global(vm, "none", clox_nil());
+    CloxScript* script = clox_compile(vm, "var m = n * 3; var t = (m == 6) == yes; var z = none;");
+    check(clox_run(vm, script) == INTERPRET_OK, "run with values set");
+
+    Value value;
+    double number = 0;
+    bool boolean = false;
+    const char* chars;
+    check(clox_get_global(vm, "m", &value) && clox_to_number(value, &number) && number == 6, "number out");
+    check(!clox_to_string(value, &chars) && !clox_to_bool(value, &boolean), "number isn't anything else");
+    check(clox_get_global(vm, "t", &value) && clox_to_bool(value, &boolean) && boolean, "bool out");
+
+    clox_free_script(script);
+    clox_free_vm(vm);
+}
+
+// a vm can't touch files until the embedder gives it the natives
+static void file_natives() {
+    VM* vm = clox_new_vm();
+    CloxScript* script = clox_compile(vm, "var file = open(\"/dev/null\"); var got = read(file);");
+    check(clox_run(vm, script) == INTERPRET_RUNTIME_ERROR, "no files by default");
+    clox_define_file_natives(vm);
+    check(clox_run(vm, script) == INTERPRET_OK, "files once defined");
+
+    clox_free_script(script);
+    clox_free_vm(vm);
+}
+
+// two scripts compiled up front and run in turns, so each one's
+// constants and cached shapes have to outlast the other's runs
+static void kept_scripts() {
+    VM* vm = clox_new_vm();
+    CloxScript* a = clox_compile(vm,
+        "class P {} var p = P(); p.name = \"a\" + \"!\"; p.n = 1;\n"
+        "fun get(x) { return x.name; } var a = get(p);\n");
+    CloxScript* b = clox_compile(vm,
+        "fun junk() { var s = \"j\" + \"unk\"; return [s, {\"k\": s}]; }\n"
+        "fun f0() { junk(); junk(); } fun f1() { f0(); f0(); } fun f2() { f1(); f1(); }\n"
+        "f2(); f2(); var b = \"b\";\n");
+
+    bool ok = true;
+    for (int i = 0; i < 50; i++) {
+        ok = ok && clox_run(vm, a) == INTERPRET_OK && clox_run(vm, b) == INTERPRET_OK;
+    }
+    check(ok, "kept scripts run in turns");
+    check(global_is(vm, "a", "a!") && global_is(vm, "b", "b"), "kept scripts' results");
+
+    // freeing one leaves the other and the globals alone
+    clox_set_global(vm, "input", clox_string(vm, "held"));
+    clox_free_script(b);
+    CloxScript* c = clox_compile(vm, "var c = input + \"!\";");
+    check(clox_run(vm, a) == INTERPRET_OK && clox_run(vm, c) == INTERPRET_OK, "runs after a free");
+    check(global_is(vm, "c", "held!"), "global set outside a run");
+
+    clox_free_script(a);
+    clox_free_script(c);
+    clox_free_vm(vm);
+}
+
+// what each script compiles to goes once it's freed, so a loop of
+// distinct scripts stays under a small heap limit
+static void compile_loop() {
+    VM* vm = clox_new_vm();
+    clox_set_heap_limit(vm, 2 * 1024 * 1024);
+
+    int failed = 0;
+    char source[256];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(source, sizeof(source),
+            "fun f(a) { return a + \"%d\"; } class C {} var c = C(); c.x%d = f(\"s\");\n", i, i);
+        clox_set_global(vm, "input", clox_string(vm, source));
+        CloxScript* script = clox_compile(vm, source);
+        if (script == NULL || clox_run(vm, script) != INTERPRET_OK) failed++;
+        if (script != NULL) clox_free_script(script);
+    }
+    check(failed == 0, "distinct scripts under a heap limit");
+    clox_free_vm(vm);
+}
+
+// a script that never calls never reaches a safepoint, what it
+// leaves behind is collected once its run is over
+static void call_free_runs() {
+    VM* vm = clox_new_vm();
+    char input[16 * 1024];
+    memset(input, 'x', sizeof(input) - 1);
+    input[sizeof(input) - 1] = '\0';
+    clox_set_global(vm, "input", clox_string(vm, input));
+    clox_set_global(vm, "k", clox_string(vm, ""));
+    // strings are interned, k makes each run's new
+    CloxScript* script = clox_compile(vm, "k = k + \"x\"; var s = input + k; s = s + s;");
+
+    bool ok = true;
+    for (int i = 0; i < 200; i++) ok = ok && clox_run(vm, script) == INTERPRET_OK;
+    check(ok, "call free runs");
+    GcStats stats;
+    clox_gc_stats(vm, &stats);
+    check(stats.full.count > 0, "collections at the end of runs");
+
+    clox_free_script(script);
+    clox_free_vm(vm);
+}
+
+int main() {
+    values();
+    file_natives();
+    kept_scripts();
+    compile_loop();
+    call_free_runs();
+    printf("api tests %s\n", failures == 0 ? "passed" : "failed");
+    return failures == 0 ? 0 : 1;
+}
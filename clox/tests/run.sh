@@ -0,0 +1,59 @@
+#!/bin/sh
+# runs every script here with the given clox under each backend and
+# checks it against the comments in the script:
+#   // expect: text                  a line it prints, in order
+#   // expect runtime error: message  the first line it writes to stderr
+#   // expect error: message          a line of its compile errors
+#   // expect register warning: text  a line it writes to stderr when
+#                                     it's run with --register
+# a script expecting an error has to exit with that error's code.
+# warnings, like the register backend falling back, aren't errors
+
+clox=${1:?usage: run.sh path/to/clox}
+dir=$(dirname "$0")
+out=$(mktemp)
+err=$(mktemp)
+expected=$(mktemp)
+trap 'rm -f "$out" "$err" "$expected"' EXIT
+
+passed=0
+failed=0
+for test in "$dir"/*.lox; do
+    [ -e "$test" ] || continue
+    sed -n 's|.*// expect: ||p' "$test" > "$expected"
+    runtime=$(sed -n 's|.*// expect runtime error: ||p' "$test")
+    compile=$(sed -n 's|.*// expect error: ||p' "$test")
+    warning=$(sed -n 's|.*// expect register warning: ||p' "$test")
+    code=0
+    [ -n "$runtime" ] && code=70
+    [ -n "$compile" ] && code=65
+
+    for mode in --stack --register "--register --optimize"; do
+        "$clox" $mode "$test" > "$out" 2> "$err"
+        status=$?
+        problem=
+        if [ "$status" -ne "$code" ]; then
+            problem="exited $status, expected $code"
+        elif ! cmp -s "$expected" "$out"; then
+            problem="printed something else"
+        elif [ -n "$runtime" ] && [ "$(grep -v '^\[line [0-9]*\] Warning: ' "$err" | head -n 1)" != "$runtime" ]; then
+            problem="failed with something else"
+        elif [ -n "$compile" ] && printf '%s\n' "$compile" | grep -qvxFf "$err"; then
+            problem="failed to compile with something else"
+        elif [ -n "$warning" ] && [ "$mode" != --stack ] && ! grep -qxF "$warning" "$err"; then
+            problem="didn't warn"
+        fi
+
+        if [ -z "$problem" ]; then
+            passed=$((passed + 1))
+            continue
+        fi
+        failed=$((failed + 1))
+        echo "FAIL $test $mode: $problem"
+        diff "$expected" "$out" | head -n 10
+        head -n 5 "$err"
+    done
+done
+
+echo "$passed passed, $failed failed with $clox"
+[ "$failed" -eq 0 ]